@@ -16,6 +16,8 @@ AgeChart::AgeChart()
 {
     min = LOW; lowerWhisker = LOW; lowerQuartile = LOW; median = LOW;
     upperQuartile = LOW; upperWhisker = LOW; max = LOW;
+    approximate = false;
+    errorBound = 0.0;
 }
 
 bool AgeChart::valid() const
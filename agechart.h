@@ -22,6 +22,10 @@ struct AgeChart
     qint64      upperQuartile;
     qint64      upperWhisker;
     qint64      max;
+    //! Estimated from a histogram and not computed from the files yet.
+    bool        approximate;
+    //! Guaranteed rank error of the percentiles as a fraction of the total size. Zero if exact.
+    double      errorBound;
 
     AgeChart();
     bool valid() const;
@@ -14,6 +14,7 @@
 #include <QPainter>
 #include <QPalette>
 #include <cmath>
+#include <utility>
 
 template <double(*Func)(double)>
 static QVariant ratioOf(const QVariant &numerator, const QVariant &denominator)
@@ -47,6 +48,10 @@ AgeChartItemDelegate::AgeChartItemDelegate(QObject* parent):
 {
     m_rowHeight = QApplication::style()->pixelMetric(QStyle::PM_LargeIconSize);
     calculateColors();
+    m_missingTimer.setSingleShot(true);
+    connect(&m_missingTimer, &QTimer::timeout, this, [this]() {
+        emit chartsMissing(std::exchange(m_missing, {}));
+    });
 }
 
 void AgeChartItemDelegate::paint(QPainter *painter,
@@ -59,9 +64,15 @@ void AgeChartItemDelegate::paint(QPainter *painter,
     }
 
     QVariant v = index.data(Qt::DisplayRole);
-    auto paintBusy = [this, painter, option, index]() {
+    auto reportMissing = [this, index]() {
+        m_missing.append(index);
+        if (!m_missingTimer.isActive())
+            m_missingTimer.start(0);
+    };
+    auto paintBusy = [painter, option, reportMissing]() {
         QIcon icon = QIcon::fromTheme(QStringLiteral("clock"));
         icon.paint(painter, option.rect);
+        reportMissing();
     };
 
     auto size = index.data(DirModel::R_SIZE);
@@ -86,6 +97,9 @@ void AgeChartItemDelegate::paint(QPainter *painter,
         paintBusy();
         return;
     }
+    // The estimate is drawn until the exact chart of the row on screen is calculated.
+    if (chartCoords.approximate)
+        reportMissing();
 
     if (minAge.value<qint64>() == maxAge.value<qint64>()) {
         // Bail if we can't determine width of the chart.
@@ -130,19 +144,28 @@ void AgeChartItemDelegate::paint(QPainter *painter,
     int boxMid = (boxTop + boxBottom) / 2;
     QColor boxColor = QColor(200, 200, 200);
 
+    // Approximate charts are drawn dashed and unfilled until the exact one replaces them.
+    Qt::PenStyle penStyle = chartCoords.approximate ? Qt::DashLine : Qt::SolidLine;
+
     if (chartCoords.singleton()) {
+        painter->save();
+        painter->setPen(QPen(m_penColor, 1, penStyle));
         painter->drawLine(xPos(chartCoords.median),
                           boxTop,
                           xPos(chartCoords.median),
                           boxBottom);
+        painter->restore();
         return;
     }
 
     // Draw the box plot elements.
     painter->save();
 
-    painter->setPen(m_penColor);
-    painter->setBrush(m_fillColor);
+    painter->setPen(QPen(m_penColor, 1, penStyle));
+    if (chartCoords.approximate)
+        painter->setBrush(Qt::NoBrush);
+    else
+        painter->setBrush(m_fillColor);
 
     painter->drawRect(xPos(chartCoords.lowerQuartile),
                       boxTop,
@@ -12,6 +12,7 @@
 
 #include <QStyledItemDelegate>
 #include <QColor>
+#include <QTimer>
 
 class AgeChartItemDelegate final : public QStyledItemDelegate
 {
@@ -34,12 +35,19 @@ public slots:
     void calculateColors();
     void setScaling(Scaling s);
 
+signals:
+    //! Rows painted without an exact chart since the last time, once the view is done
+    //! painting.
+    void chartsMissing(QModelIndexList indexes);
+
 private:
     int m_rowHeight;
     QColor m_penColor;
     QColor m_fillColor;
     QColor m_medianColor;
     Scaling m_scaling;
+    mutable QModelIndexList m_missing;
+    mutable QTimer m_missingTimer;
 };
 
 #endif // AGECHARTITEMDELEGATE_H
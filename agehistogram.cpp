@@ -0,0 +1,110 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "agehistogram.h"
+#include "chartpercentiles.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Bucket 0 holds ages up to one second (and files from the future). The rest split ages of
+// 1 s .. 2^32 s (136 years) evenly on a log scale, about 9% of the age per bucket.
+constexpr double BUCKETS_PER_DOUBLING = (AgeHistogram::NUM_BUCKETS - 2) / 32.0;
+
+AgeHistogram::AgeHistogram(qint64 reference)
+{
+    m_reference = reference;
+    m_min = std::numeric_limits<qint64>::max();
+    m_max = std::numeric_limits<qint64>::lowest();
+    m_weights.fill(0.0f);
+}
+
+int AgeHistogram::bucket(qint64 age)
+{
+    if (age <= 1)
+        return 0;
+    int b = 1 + static_cast<int>(std::log2(static_cast<double>(age)) * BUCKETS_PER_DOUBLING);
+    return std::min(b, NUM_BUCKETS - 1);
+}
+
+qint64 AgeHistogram::bucketAge(int bucket)
+{
+    if (bucket == 0)
+        return 0;
+    // Geometric midpoint of the bucket.
+    return static_cast<qint64>(std::exp2((bucket - 0.5) / BUCKETS_PER_DOUBLING));
+}
+
+void AgeHistogram::add(qint64 time, qint64 size)
+{
+    m_weights[bucket(m_reference - time)] += static_cast<float>(size);
+    m_min = std::min(m_min, time);
+    m_max = std::max(m_max, time);
+}
+
+void AgeHistogram::add(const AgeHistogram &other)
+{
+    Q_ASSERT(m_reference == other.m_reference);
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        m_weights[i] += other.m_weights[i];
+    }
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+void AgeHistogram::subtract(const AgeHistogram &other)
+{
+    Q_ASSERT(m_reference == other.m_reference);
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        m_weights[i] = std::max(0.0f, m_weights[i] - other.m_weights[i]);
+    }
+}
+
+double AgeHistogram::totalWeight() const
+{
+    double total = 0.0;
+    for (float w : m_weights) {
+        total += w;
+    }
+    return total;
+}
+
+AgeChart AgeHistogram::chart() const
+{
+    AgeChart ret;
+    ret.approximate = true;
+    if (m_min > m_max)
+        return ret;
+    const double total = totalWeight();
+    const std::array<int, ChartPercentiles::SIZE> percents = ChartPercentiles::percents();
+    double thresholds[ChartPercentiles::SIZE];
+    for (size_t i = 0; i < percents.size(); ++i) {
+        thresholds[i] = (percents[i] > 50) ? total - total * (100 - percents[i]) / 100
+                                           : total * percents[i] / 100;
+    }
+    constexpr int numTargets = ChartPercentiles::SIZE;
+
+    // Oldest bucket first, so that time is ascending.
+    double accumulated = 0.0;
+    int next = 0;
+    for (int b = NUM_BUCKETS - 1; b >= 0 && next < numTargets; --b) {
+        accumulated += m_weights[b];
+        qint64 time = std::clamp(m_reference - bucketAge(b), m_min, m_max);
+        while (next < numTargets && accumulated >= thresholds[next]) {
+            ret.*ChartPercentiles::FIELDS[next] = time;
+            ++next;
+        }
+    }
+    for (; next < numTargets; ++next) {
+        ret.*ChartPercentiles::FIELDS[next] = m_max;
+    }
+    ret.min = m_min;
+    ret.max = m_max;
+    return ret;
+}
@@ -0,0 +1,50 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef AGEHISTOGRAM_H
+#define AGEHISTOGRAM_H
+
+#include <QtCore>
+#include <array>
+#include "agechart.h"
+
+//! Size-weighted histogram of file ages in log-spaced buckets, relative to a reference time.
+//! Histograms with the same reference can be added and subtracted, so they are merged bottom-up
+//! through the tree and give an approximate box plot without touching the files.
+class AgeHistogram
+{
+public:
+    static constexpr int NUM_BUCKETS = 256;
+
+    explicit AgeHistogram(qint64 reference);
+
+    void add(qint64 time, qint64 size);
+    void add(const AgeHistogram &other);
+    //! Min and max times cannot be subtracted and stay as they were.
+    void subtract(const AgeHistogram &other);
+
+    qint64 reference() const
+    { return m_reference; }
+
+    double totalWeight() const;
+
+    //! Approximate chart. Quartiles and whiskers fall on bucket midpoints, min and max are exact.
+    AgeChart chart() const;
+
+    static int bucket(qint64 age);
+    static qint64 bucketAge(int bucket);
+
+private:
+    qint64                              m_reference;
+    qint64                              m_min;
+    qint64                              m_max;
+    std::array<float, NUM_BUCKETS>      m_weights;
+};
+
+#endif // AGEHISTOGRAM_H
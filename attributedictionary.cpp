@@ -0,0 +1,127 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "attributedictionary.h"
+
+#include <cerrno>
+#include <cstring>
+
+// POSIX.
+#include <grp.h>
+#include <pwd.h>
+#include <unistd.h>
+
+// Longer suffixes are rarely extensions, and would only fill the dictionary.
+constexpr size_t ATTRIBUTES_MAX_EXTENSION = 15;
+
+AttributeDictionary::AttributeDictionary()
+{
+    // Id 0 is the empty extension.
+    internExtension(QByteArray());
+}
+
+const char *AttributeDictionary::dimensionName(Dimension dimension)
+{
+    static const char *names[] = { "extension", "owner", "group" };
+    static_assert(sizeof(names) / sizeof(names[0]) == NUM_DIMENSIONS);
+    return names[dimension];
+}
+
+size_t AttributeDictionary::size(Dimension dimension) const
+{
+    return (dimension == EXTENSION) ? m_extensionNames.size() : m_values[dimension].size();
+}
+
+AttributeDictionary::id_t AttributeDictionary::extension(const char *fileName)
+{
+    const char *dot = strrchr(fileName, '.');
+    // Hidden files like .bashrc have no extension.
+    if (dot == nullptr || dot == fileName || dot[1] == '\0')
+        return 0;
+    size_t length = strlen(dot + 1);
+    if (length > ATTRIBUTES_MAX_EXTENSION)
+        return 0;
+    char lower[ATTRIBUTES_MAX_EXTENSION];
+    for (size_t i = 0; i < length; ++i) {
+        char c = dot[1 + i];
+        lower[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    // Look up without copying; only new extensions are allocated.
+    auto i = m_extensionIds.constFind(QByteArray::fromRawData(lower, length));
+    if (i != m_extensionIds.cend())
+        return i.value();
+    return internExtension(QByteArray(lower, length));
+}
+
+AttributeDictionary::id_t AttributeDictionary::internExtension(const QByteArray &extension)
+{
+    if (m_extensionNames.size() >= OTHER)
+        return OTHER;
+    id_t id = static_cast<id_t>(m_extensionNames.size());
+    m_extensionNames.push_back(extension);
+    m_extensionIds.insert(extension, id);
+    return id;
+}
+
+AttributeDictionary::id_t AttributeDictionary::intern(Dimension dimension, quint32 key)
+{
+    QHash<quint32, id_t> &ids = m_ids[dimension];
+    auto i = ids.constFind(key);
+    if (i != ids.cend())
+        return i.value();
+    std::vector<quint32> &values = m_values[dimension];
+    if (values.size() >= OTHER)
+        return OTHER;
+    id_t id = static_cast<id_t>(values.size());
+    values.push_back(key);
+    ids.insert(key, id);
+    return id;
+}
+
+QString AttributeDictionary::name(Dimension dimension, id_t id) const
+{
+    if (id == OTHER)
+        return QStringLiteral("(other)");
+    if (dimension == EXTENSION) {
+        const QByteArray &ext = m_extensionNames[id];
+        return ext.isEmpty() ? QStringLiteral("(none)") : QString::fromLocal8Bit(ext);
+    }
+    quint32 key = m_values[dimension][id];
+    std::vector<char> buffer(1024);
+    int rv;
+    // Names are looked up only for the few groups shown, so they are not cached.
+    if (dimension == OWNER) {
+        struct passwd pw, *result = nullptr;
+        while ((rv = getpwuid_r(key, &pw, buffer.data(), buffer.size(), &result)) == ERANGE)
+            buffer.resize(buffer.size() * 2);
+        if (rv == 0 && result != nullptr)
+            return QString::fromLocal8Bit(result->pw_name);
+    }
+    else {
+        struct group gr, *result = nullptr;
+        while ((rv = getgrgid_r(key, &gr, buffer.data(), buffer.size(), &result)) == ERANGE)
+            buffer.resize(buffer.size() * 2);
+        if (rv == 0 && result != nullptr)
+            return QString::fromLocal8Bit(result->gr_name);
+    }
+    return QString::number(key);
+}
+
+AttributeDictionary::id_t
+AttributeDictionary::translate(const AttributeDictionary &other, Dimension dimension, id_t id)
+{
+    if (id == OTHER)
+        return OTHER;
+    if (dimension == EXTENSION) {
+        const QByteArray &ext = other.m_extensionNames[id];
+        auto i = m_extensionIds.constFind(ext);
+        return (i != m_extensionIds.cend()) ? i.value() : internExtension(ext);
+    }
+    return intern(dimension, other.m_values[dimension][id]);
+}
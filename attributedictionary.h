@@ -0,0 +1,62 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef ATTRIBUTEDICTIONARY_H
+#define ATTRIBUTEDICTIONARY_H
+
+#include <QtCore>
+#include <array>
+#include <limits>
+#include <vector>
+
+//! Interns file attributes of a scan as 16-bit ids: extensions, owners and groups. Files store
+//! only the ids. Interning is not thread-safe; the scanner fills the dictionary and everything
+//! else only reads it.
+class AttributeDictionary
+{
+public:
+    Q_DISABLE_COPY_MOVE(AttributeDictionary)
+    using id_t = quint16;
+
+    enum Dimension: quint8 { EXTENSION, OWNER, GROUP, NUM_DIMENSIONS };
+    static const char *dimensionName(Dimension dimension);
+
+    //! Shared by all values once a dimension has this many distinct ones.
+    static constexpr id_t OTHER = std::numeric_limits<id_t>::max();
+
+    AttributeDictionary();
+
+    //! Id of the extension of the file name, lower case. Files without one share an id.
+    id_t extension(const char *fileName);
+    id_t owner(quint32 uid)
+    { return intern(OWNER, uid); }
+    id_t group(quint32 gid)
+    { return intern(GROUP, gid); }
+
+    //! Number of ids in use, not counting OTHER.
+    size_t size(Dimension dimension) const;
+
+    //! Extension, user or group name. Names of users and groups are looked up on each call.
+    QString name(Dimension dimension, id_t id) const;
+
+    //! Id of the same value in this dictionary, interning it if needed.
+    id_t translate(const AttributeDictionary &other, Dimension dimension, id_t id);
+
+private:
+    id_t intern(Dimension dimension, quint32 key);
+    id_t internExtension(const QByteArray &extension);
+
+    //! Uids and gids by id, indexed by dimension. The extension slots are unused.
+    std::array<std::vector<quint32>, NUM_DIMENSIONS>    m_values;
+    std::array<QHash<quint32, id_t>, NUM_DIMENSIONS>    m_ids;
+    QHash<QByteArray, id_t>                             m_extensionIds;
+    std::vector<QByteArray>                             m_extensionNames;
+};
+
+#endif // ATTRIBUTEDICTIONARY_H
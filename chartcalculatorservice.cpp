@@ -8,43 +8,52 @@
  */
 
 #include <QPromise>
-#include <boost/intrusive/list.hpp>
+#include <QRegularExpression>
+#include <QThread>
+#include <algorithm>
 #include <limits>
+#include <boost/intrusive/list.hpp>
 #include "chartcalculatorservice.h"
+#include "chartpercentiles.h"
+#include "executor.h"
+#include "quantilescan.h"
+#include "quantileselect.h"
+#include "treereclaimer.h"
 
-constexpr qint64 LOW = std::numeric_limits<decltype(AgeChart::min)>::lowest();
+// Requests of a batch calculated by one task: this many, or fewer if they merge this many
+// files. Larger tasks would hold results back for longer.
+constexpr size_t CHARTCALCULATOR_BATCH_REQUESTS = 256;
+constexpr size_t CHARTCALCULATOR_BATCH_FILES = 1 << 20;
 
 class ChartCalculatorServicePrivate final
 {
 private:
-    class CalculationTaskBase:
-            public QRunnable,
+    class TaskBase:
             public boost::intrusive::list_base_hook<>
     {
     public:
-        CalculationTaskBase(QPromise<AgeChart> &&pro,
-                            DirTree *tree,
-                            QRecursiveMutex *lock,
-                            boost::intrusive::list<CalculationTaskBase> *list):
-            m_pro{std::move(pro)},
+        TaskBase(DirTree *tree,
+                 QRecursiveMutex *lock,
+                 boost::intrusive::list<TaskBase> *list):
             m_tree{tree},
             m_lock{lock},
-            m_list{list}
+            m_list{list},
+            m_pin{TreeReclaimer::pin()}
         {
             QMutexLocker l{lock};
             m_list->push_back(*this);
         }
 
-        void cancel()
-        {
-            auto fut = m_pro.future();
-            fut.cancel();
-            fut.waitForFinished();
-        }
+        virtual ~TaskBase()
+        { }
+
+        virtual void cancel() = 0;
+
+        virtual QFuture<void> future() = 0;
 
         virtual void runPriv() = 0;
 
-        virtual void run() override
+        void run()
         {
             runPriv();
             {
@@ -54,146 +63,429 @@ private:
             }
         }
     protected:
-        QPromise<AgeChart> m_pro;
         DirTree* m_tree;
         QRecursiveMutex* m_lock;
-        boost::intrusive::list<CalculationTaskBase>* m_list;
+        boost::intrusive::list<TaskBase>* m_list;
+        // Keeps the tree alive if it is replaced while this task runs.
+        TreeReclaimer::Pin m_pin;
+    public:
+        CancelToken m_token;
     };
 
-    using TaskList = boost::intrusive::list<CalculationTaskBase>;
+    template <class T>
+    class CalculationTaskBase: public TaskBase
+    {
+    public:
+        using Result = T;
+
+        CalculationTaskBase(QPromise<T> &&pro,
+                            DirTree *tree,
+                            QRecursiveMutex *lock,
+                            boost::intrusive::list<TaskBase> *list):
+            TaskBase(tree, lock, list),
+            m_pro{std::move(pro)}
+        { }
+
+        virtual void cancel() override
+        {
+            m_pro.future().cancel();
+        }
+
+        virtual QFuture<void> future() override
+        {
+            return QFuture<void>(m_pro.future());
+        }
+
+    protected:
+        //! Canceled through the future or the token. A canceled token cancels the future too,
+        //! so that no continuation runs.
+        bool isCanceled()
+        {
+            if (m_token.isCanceled())
+                m_pro.future().cancel();
+            return m_pro.isCanceled();
+        }
+
+        QPromise<T> m_pro;
+    };
+
+    using TaskList = boost::intrusive::list<TaskBase>;
     QRecursiveMutex         m_lock;
     TaskList                m_taskList;
+    CancelToken             m_token;  // Parent of the tokens of all tasks.
+
+    //! Whether at least half of the subtree is indexed, so that queries beat a merge.
+    static bool searchable(const DirTree *tree)
+    {
+        return tree->numIndexedFiles() > 0
+                && tree->numIndexedFiles() >= tree->numSubtreeFiles() - tree->numIndexedFiles();
+    }
 
-    class SubtreeCalculationTask: public CalculationTaskBase
+    //! Chart of the whole subtree. Empty if canceled.
+    static std::optional<AgeChart> subtreeChart(DirTree *tree,
+                                                const std::function<bool()> &isCanceled)
+    {
+        if (tree->subtreeSize() == 0)
+            return AgeChart();
+        if (isCanceled())
+            return std::nullopt;
+
+        // Sketched trees have no files, only summaries.
+        const QuantileSketch *sketch = tree->subtreeSketch();
+        if (sketch != nullptr)
+            return sketch->chart();
+
+        // Summaries of collapsed directories cannot be merged exactly, so estimate it all.
+        if (tree->hasCollapsed()) {
+            QuantileSketch summary;
+            tree->summarizeInto(summary);
+            summary.finalize();
+            return summary.chart();
+        }
+
+        // Indexed subtrees are answered by binary searches instead of a merge, and those
+        // mostly below indexes by searches over them and the files beside them.
+        DirTree::file_time_t min, max;
+        if (searchable(tree) && tree->timeRange(min, max)) {
+            AgeChart ret;
+            std::array<qint64, ChartPercentiles::SIZE> weights =
+                    ChartPercentiles::weights(tree->subtreeSize());
+            ret.min = min;
+            for (size_t i = 0; i < weights.size(); ++i) {
+                ret.*ChartPercentiles::FIELDS[i] = tree->quantile(weights[i], isCanceled);
+            }
+            if (isCanceled())
+                return std::nullopt;
+            ret.max = max;
+            return ret;
+        }
+
+        // Without subdirectories, the subtree is a single sorted run.
+        if (tree->numChildren() == 0)
+            return QuantileScan::chart(tree->files(), tree->subtreeSize(), isCanceled);
+
+        // Large subtrees are shared with idle threads instead of merged on this one.
+        if (QuantileSelect::worthwhile(tree))
+            return QuantileSelect::chart(tree, isCanceled);
+
+        return QuantileScan::chart(tree, isCanceled);
+    }
+
+    //! Chart of the files directly in the directory. Empty if canceled.
+    static std::optional<AgeChart> filesChart(DirTree *tree,
+                                              const std::function<bool()> &isCanceled)
+    {
+        const QuantileSketch *sketch = tree->filesSketch();
+        if (sketch != nullptr)
+            return sketch->chart();
+        return QuantileScan::chart(tree->files(), tree->filesSize(), isCanceled);
+    }
+
+    class SubtreeCalculationTask: public CalculationTaskBase<AgeChart>
     {
     public:
         using CalculationTaskBase::CalculationTaskBase;
 
         virtual void runPriv() override
         {
-            AgeChart ret;
-            if (m_tree->subtreeSize() == 0) {
-                m_pro.addResult(AgeChart());
-                m_pro.finish();
-                return;
-            }
-            qint64 accumulatedWeights = 0;
-            qint64 totalWeight = m_tree->subtreeSize();
-            qint64 lowerWhiskerWeight = totalWeight / 20;
-            qint64 lowerQuartileWeight = totalWeight / 4;
-            qint64 medianWeight = totalWeight / 2;
-            qint64 upperQuartileWeight = totalWeight - (totalWeight / 4);
-            qint64 upperWhiskerWeight = totalWeight - (totalWeight / 20);
-
-            if (m_pro.isCanceled()) {
-                m_pro.finish();
-                return;
-            }
-
-            auto i = m_tree->begin();
-            if (i != m_tree->end()) {
-                ret.min = i->time;
-            }
-            int cnt = 0;
-            for (; i != m_tree->end(); ++i) {
-                cnt++;
-                if (m_pro.isCanceled()) {
-                    m_pro.finish();
-                    return;
-                }
-                accumulatedWeights += i->size;
-                if (ret.lowerWhisker == LOW && accumulatedWeights >= lowerWhiskerWeight) {
-                    ret.lowerWhisker = i->time;
-                }
-                if (ret.lowerQuartile == LOW && accumulatedWeights >= lowerQuartileWeight) {
-                    ret.lowerQuartile = i->time;
-                }
-                if (ret.median == LOW && accumulatedWeights >= medianWeight) {
-                    ret.median = i->time;
-                }
-                if (ret.upperQuartile == LOW && accumulatedWeights >= upperQuartileWeight) {
-                    ret.upperQuartile = i->time;
-                }
-                if (ret.upperWhisker == LOW && accumulatedWeights >= upperWhiskerWeight) {
-                    ret.upperWhisker = i->time;
-                }
-                ret.max = i->time;
-            }
-            m_pro.addResult(ret);
+            std::optional<AgeChart> chart = subtreeChart(m_tree, [this]() {
+                return isCanceled();
+            });
+            if (chart.has_value())
+                m_pro.addResult(chart.value());
             m_pro.finish();
         }
     };
 
-    class FilesCalculationTask: public CalculationTaskBase
+    class FilesCalculationTask: public CalculationTaskBase<AgeChart>
     {
     public:
         using CalculationTaskBase::CalculationTaskBase;
 
         virtual void runPriv() override
         {
-            AgeChart ret;
-            const std::vector<DirTree::FileInfo> &files = m_tree->files();
-            if (files.size() == 0) {
-                m_pro.addResult(AgeChart());
-                m_pro.finish();
-                return;
-            }
+            std::optional<AgeChart> chart = filesChart(m_tree, [this]() {
+                return isCanceled();
+            });
+            if (chart.has_value())
+                m_pro.addResult(chart.value());
+            m_pro.finish();
+        }
+    };
 
-            qint64 accumulatedWeights = 0;
-            qint64 totalWeight = m_tree->filesSize();
-            qint64 lowerWhiskerWeight = totalWeight / 20;
-            qint64 lowerQuartileWeight = totalWeight / 4;
-            qint64 medianWeight = totalWeight / 2;
-            qint64 upperQuartileWeight = totalWeight - (totalWeight / 4);
-            qint64 upperWhiskerWeight = totalWeight - (totalWeight / 20);
-
-            if (m_pro.isCanceled()) {
-                m_pro.finish();
-                return;
-            }
+    //! Consecutive requests of a batch, calculated one after another. The charts are
+    //! delivered together, or not at all if canceled.
+    class BatchTask: public CalculationTaskBase<ChartCalculatorService::Batch>
+    {
+    public:
+        using Request = ChartCalculatorService::Request;
 
-            auto i = files.begin();
-            if (i != files.end()) {
-                ret.min = i->time;
-            }
-            for (; i != files.end(); ++i) {
-                if (m_pro.isCanceled()) {
+        BatchTask(QPromise<ChartCalculatorService::Batch> &&pro,
+                  DirTree *tree,
+                  QRecursiveMutex *lock,
+                  boost::intrusive::list<TaskBase> *list,
+                  size_t first,
+                  std::span<const Request> requests):
+            CalculationTaskBase(std::move(pro), tree, lock, list),
+            m_first{first},
+            m_requests(requests.begin(), requests.end())
+        { }
+
+        virtual void runPriv() override
+        {
+            std::function<bool()> isCanceled = [this]() { return this->isCanceled(); };
+            ChartCalculatorService::Batch batch;
+            batch.first = m_first;
+            batch.charts.reserve(m_requests.size());
+            for (const Request &r : m_requests) {
+                std::optional<AgeChart> chart = r.files ? filesChart(r.tree, isCanceled)
+                                                        : subtreeChart(r.tree, isCanceled);
+                if (!chart.has_value()) {
                     m_pro.finish();
                     return;
                 }
-                accumulatedWeights += i->size;
-                if (ret.lowerWhisker == LOW && accumulatedWeights >= lowerWhiskerWeight) {
-                    ret.lowerWhisker = i->time;
+                batch.charts.push_back(chart.value());
+            }
+            m_pro.addResult(std::move(batch));
+            m_pro.finish();
+        }
+
+    private:
+        size_t                  m_first;
+        std::vector<Request>    m_requests;
+    };
+
+    using Request = ChartCalculatorService::Request;
+    using Aggregate = ChartCalculatorService::Aggregate;
+
+    //! The requests without those inside others, in pre-order. A subtree holds the subtrees
+    //! and files of the directories below it, and its own files.
+    static std::vector<Request> disjoint(std::span<const Request> requests)
+    {
+        std::vector<Request> sorted(requests.begin(), requests.end());
+        std::sort(sorted.begin(), sorted.end(), [](const Request &a, const Request &b) {
+            if (a.tree->preorder() != b.tree->preorder())
+                return a.tree->preorder() < b.tree->preorder();
+            return !a.files && b.files;
+        });
+        std::vector<Request> ret;
+        quint32 end = 0;  // Of the last subtree kept.
+        for (const Request &r : sorted) {
+            if (r.tree->preorder() < end || (!ret.empty() && ret.back().tree == r.tree))
+                continue;
+            ret.push_back(r);
+            if (!r.files)
+                end = r.tree->subtreeEnd();
+        }
+        return ret;
+    }
+
+    //! Subtrees below the tree whose relative paths match, not descending into matches.
+    //! Returns false if canceled.
+    static bool match(DirTree *tree, const QRegularExpression &regex, QString &path,
+                      std::vector<Request> &out, const std::function<bool()> &isCanceled)
+    {
+        if (isCanceled())
+            return false;
+        for (size_t i = 0; i < tree->numChildren(); ++i) {
+            DirTree *child = tree->child(i);
+            const qsizetype length = path.size();
+            if (length > 0)
+                path.append(u'/');
+            path.append(child->name());
+            if (regex.match(path).hasMatch())
+                out.push_back({child, false});
+            else if (!match(child, regex, path, out, isCanceled))
+                return false;
+            path.truncate(length);
+        }
+        return true;
+    }
+
+    //! Aggregate of requests that do not overlap, so that each directory is read once. Empty
+    //! if canceled.
+    static std::optional<Aggregate> aggregate(std::span<const Request> requests,
+                                              const std::function<bool()> &isCanceled)
+    {
+        Aggregate ret{AgeChart(), {0, 0}, requests.size()};
+        bool exact = true;
+        for (const Request &r : requests) {
+            if (r.files) {
+                ret.totals.size += r.tree->filesSize();
+                ret.totals.count += r.tree->numFiles();
+                exact = exact && r.tree->filesSketch() == nullptr;
+            }
+            else {
+                ret.totals.size += r.tree->subtreeSize();
+                ret.totals.count += r.tree->numSubtreeFiles();
+                exact = exact && !r.tree->hasCollapsed() && r.tree->subtreeSketch() == nullptr;
+            }
+        }
+        if (ret.totals.size == 0)
+            return ret;
+
+        std::optional<AgeChart> chart;
+        if (requests.size() == 1) {
+            // Indexes, sketches and all shortcuts of a single chart apply.
+            chart = requests[0].files ? filesChart(requests[0].tree, isCanceled)
+                                      : subtreeChart(requests[0].tree, isCanceled);
+        }
+        else if (!exact) {
+            // Summaries cannot be merged exactly, so estimate it all.
+            QuantileSketch summary;
+            for (const Request &r : requests) {
+                if (isCanceled())
+                    return std::nullopt;
+                if (!r.files) {
+                    r.tree->summarizeInto(summary);
                 }
-                if (ret.lowerQuartile == LOW && accumulatedWeights >= lowerQuartileWeight) {
-                    ret.lowerQuartile = i->time;
+                else if (r.tree->filesSketch() != nullptr) {
+                    summary.add(*r.tree->filesSketch());
                 }
-                if (ret.median == LOW && accumulatedWeights >= medianWeight) {
-                    ret.median = i->time;
+                else {
+                    for (const DirTree::FileInfo &f : r.tree->files()) {
+                        summary.add(f.time, f.size);
+                    }
                 }
-                if (ret.upperQuartile == LOW && accumulatedWeights >= upperQuartileWeight) {
-                    ret.upperQuartile = i->time;
+            }
+            summary.finalize();
+            chart = summary.chart();
+        }
+        else {
+            // The directories of all requests are cut into buckets together, in parallel.
+            std::vector<const DirTree*> dirs;
+            for (const Request &r : requests) {
+                if (r.files) {
+                    dirs.push_back(r.tree);
+                    continue;
                 }
-                if (ret.upperWhisker == LOW && accumulatedWeights >= upperWhiskerWeight) {
-                    ret.upperWhisker = i->time;
+                std::span<DirTree* const> nodes = r.tree->subtreeNodes();
+                Q_ASSERT(!nodes.empty());
+                dirs.insert(dirs.end(), nodes.begin(), nodes.end());
+            }
+            chart = QuantileSelect::chart(dirs, ret.totals.size, isCanceled);
+        }
+        if (!chart.has_value())
+            return std::nullopt;
+        ret.chart = chart.value();
+        return ret;
+    }
+
+    //! Aggregate of requests, or of the subtrees matching a pattern below the tree.
+    class AggregateTask: public CalculationTaskBase<Aggregate>
+    {
+    public:
+        AggregateTask(QPromise<Aggregate> &&pro,
+                      DirTree *tree,
+                      QRecursiveMutex *lock,
+                      boost::intrusive::list<TaskBase> *list,
+                      std::span<const Request> requests,
+                      const QString &pattern):
+            CalculationTaskBase(std::move(pro), tree, lock, list),
+            m_requests(requests.begin(), requests.end()),
+            m_pattern{pattern}
+        { }
+
+        virtual void runPriv() override
+        {
+            std::function<bool()> isCanceled = [this]() { return this->isCanceled(); };
+            std::vector<Request> requests;
+            if (m_tree != nullptr) {
+                QRegularExpression regex = QRegularExpression::fromWildcard(
+                        m_pattern, Qt::CaseInsensitive,
+                        QRegularExpression::NonPathWildcardConversion);
+                QString path;
+                if (!match(m_tree, regex, path, requests, isCanceled)) {
+                    m_pro.finish();
+                    return;
                 }
-                ret.max = i->time;
             }
-            m_pro.addResult(ret);
+            else {
+                requests = disjoint(m_requests);
+            }
+            std::optional<Aggregate> result = aggregate(requests, isCanceled);
+            if (result.has_value())
+                m_pro.addResult(std::move(result.value()));
             m_pro.finish();
         }
+
+    private:
+        std::vector<Request>    m_requests;
+        QString                 m_pattern;
     };
 
-    template <class C>
-    QFuture<AgeChart> calculate(DirTree *tree)
+    //! Background pass that sorts all directories, builds the cumulative indexes and then
+    //! calculates the charts of the whole tree into a store.
+    class PrepareTask: public CalculationTaskBase<ChartStorePtr>
+    {
+    public:
+        PrepareTask(QPromise<ChartStorePtr> &&pro,
+                    DirTree *tree,
+                    QRecursiveMutex *lock,
+                    boost::intrusive::list<TaskBase> *list,
+                    size_t indexMinFiles,
+                    size_t memoryBudget,
+                    int metrics):
+            CalculationTaskBase(std::move(pro), tree, lock, list),
+            m_indexMinFiles{indexMinFiles},
+            m_memoryBudget{memoryBudget},
+            m_metrics{metrics}
+        { }
+
+        virtual void runPriv() override
+        {
+            std::function<bool()> isCanceled = [this]() { return this->isCanceled(); };
+            if (m_tree->sortAll(isCanceled)
+                    && m_tree->buildIndex(m_indexMinFiles, remainingBudget(), isCanceled)) {
+                ChartStorePtr store = ChartStore::compute(m_tree, m_metrics, isCanceled,
+                                                          remainingBudget());
+                if (store != nullptr)
+                    m_pro.addResult(std::move(store));
+            }
+            m_pro.finish();
+        }
+
+    private:
+        //! What the memory budget leaves beside the tree and its indexes.
+        size_t remainingBudget() const
+        {
+            if (m_memoryBudget == 0)
+                return std::numeric_limits<size_t>::max();
+            return m_memoryBudget - std::min(m_memoryBudget, m_tree->subtreeMemoryUsage());
+        }
+
+        size_t m_indexMinFiles;
+        size_t m_memoryBudget;
+        int m_metrics;
+    };
+
+    //! Files merged for the request, roughly. Sketched subtrees take none, indexed ones only
+    //! the files beside the indexes.
+    static size_t cost(const ChartCalculatorService::Request &r)
+    {
+        if (r.files)
+            return r.tree->filesSketch() != nullptr ? 0 : r.tree->numFiles();
+        if (r.tree->subtreeSketch() != nullptr)
+            return 0;
+        if (searchable(r.tree))
+            return r.tree->numSubtreeFiles() - r.tree->numIndexedFiles();
+        return r.tree->numSubtreeFiles();
+    }
+
+    template <class C, typename... Args>
+    QFuture<typename C::Result> calculate(DirTree *tree, Executor::Priority priority,
+                                          Args... args)
     {
         QMutexLocker l{&m_lock};
-        QPromise<AgeChart> pro;
+        QPromise<typename C::Result> pro;
         pro.start();
-        QFuture<AgeChart> fut = pro.future();
-        QRunnable *runnable = new C{std::move(pro), tree, &m_lock, &m_taskList};
-        runnable->setAutoDelete(true);
-        QThreadPool::globalInstance()->start(runnable);
+        QFuture<typename C::Result> fut = pro.future();
+        C *task = new C{std::move(pro), tree, &m_lock, &m_taskList, args...};
+        task->m_token = m_token.child();
+        Executor::instance().start(priority, [task]() {
+            task->run();
+            delete task;
+        }, task->m_token);
         return fut;
     }
 
@@ -203,21 +495,84 @@ public:
 
     ~ChartCalculatorServicePrivate()
     {
-        cancelAll();
+        cancelAll(true);
+        // Finished tasks still take the lock to leave the list.
+        for (;;) {
+            {
+                QMutexLocker l{&m_lock};
+                if (m_taskList.empty())
+                    break;
+            }
+            QThread::yieldCurrentThread();
+        }
     }
 
     QFuture<AgeChart> calculateSubtree(DirTree *tree)
-    { return calculate<SubtreeCalculationTask>(tree); }
+    { return calculate<SubtreeCalculationTask>(tree, Executor::Priority::VISIBLE); }
 
     QFuture<AgeChart> calculateFiles(DirTree *tree)
-    { return calculate<FilesCalculationTask>(tree); }
+    { return calculate<FilesCalculationTask>(tree, Executor::Priority::VISIBLE); }
 
-    void cancelAll()
+    QFuture<ChartStorePtr> prepare(DirTree *tree, size_t indexMinFiles, size_t memoryBudget,
+                                   int metrics)
     {
-        QMutexLocker l{&m_lock};
-        while (!m_taskList.empty()) {
-            auto iter = m_taskList.begin();
-            iter->cancel();
+        return calculate<PrepareTask>(tree, Executor::Priority::BACKGROUND, indexMinFiles,
+                                      memoryBudget, metrics);
+    }
+
+    QFuture<Aggregate> aggregate(std::span<const Request> requests)
+    {
+        return calculate<AggregateTask>(nullptr, Executor::Priority::INTERACTIVE, requests,
+                                        QString());
+    }
+
+    QFuture<Aggregate> aggregate(DirTree *tree, const QString &pattern)
+    {
+        return calculate<AggregateTask>(tree, Executor::Priority::INTERACTIVE,
+                                        std::span<const Request>(), pattern);
+    }
+
+    QList<QFuture<ChartCalculatorService::Batch>> calculateMany(
+            std::span<const ChartCalculatorService::Request> requests,
+            Executor::Priority priority)
+    {
+        QList<QFuture<ChartCalculatorService::Batch>> futs;
+        size_t first = 0;
+        size_t files = 0;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            if (i > first && (i - first == CHARTCALCULATOR_BATCH_REQUESTS ||
+                              files >= CHARTCALCULATOR_BATCH_FILES)) {
+                futs.append(calculate<BatchTask>(nullptr, priority, first,
+                                                 requests.subspan(first, i - first)));
+                first = i;
+                files = 0;
+            }
+            files += cost(requests[i]);
+        }
+        if (first < requests.size()) {
+            futs.append(calculate<BatchTask>(nullptr, priority, first, requests.subspan(first)));
+        }
+        return futs;
+    }
+
+    void cancelAll(bool wait)
+    {
+        QList<QFuture<void>> futs;
+        {
+            QMutexLocker l{&m_lock};
+            // Tasks that have not started notice the token and cancel their futures.
+            m_token.cancel();
+            m_token = CancelToken();
+            if (wait) {
+                for (TaskBase &task : m_taskList) {
+                    task.cancel();
+                    futs.append(task.future());
+                }
+            }
+        }
+        // Without the lock, which finished tasks need to leave the list.
+        for (QFuture<void> &fut : futs) {
+            fut.waitForFinished();
         }
     }
 };
@@ -230,7 +585,7 @@ ChartCalculatorService::ChartCalculatorService():
 
 ChartCalculatorService::~ChartCalculatorService()
 {
-    cancelAll();
+    cancelAll(true);
     delete p;
 }
 
@@ -244,8 +599,32 @@ QFuture<AgeChart> ChartCalculatorService::calculateFiles(DirTree *tree)
     return p->calculateFiles(tree);
 }
 
-void ChartCalculatorService::cancelAll()
+QFuture<ChartStorePtr> ChartCalculatorService::prepare(DirTree *tree, size_t indexMinFiles,
+                                                       size_t memoryBudget, int metrics)
+{
+    return p->prepare(tree, indexMinFiles, memoryBudget, metrics);
+}
+
+QList<QFuture<ChartCalculatorService::Batch>> ChartCalculatorService::calculateMany(
+        std::span<const Request> requests, Executor::Priority priority)
+{
+    return p->calculateMany(requests, priority);
+}
+
+QFuture<ChartCalculatorService::Aggregate> ChartCalculatorService::aggregate(
+        std::span<const Request> requests)
+{
+    return p->aggregate(requests);
+}
+
+QFuture<ChartCalculatorService::Aggregate> ChartCalculatorService::aggregate(
+        DirTree *tree, const QString &pattern)
+{
+    return p->aggregate(tree, pattern);
+}
+
+void ChartCalculatorService::cancelAll(bool wait)
 {
-    p->cancelAll();
+    p->cancelAll(wait);
 }
 
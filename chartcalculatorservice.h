@@ -12,8 +12,13 @@
 
 #include <QObject>
 #include <QFuture>
+#include <QList>
+#include <span>
+#include <vector>
 #include "agechart.h"
+#include "chartstore.h"
 #include "dirtree.h"
+#include "executor.h"
 
 // A calculator service for the Controller.
 
@@ -25,12 +30,60 @@ public:
     ChartCalculatorService();
     ~ChartCalculatorService();
 
-    //! Run a calculation in a thread pool.
+    //! Run a calculation on the executor, as a chart of a visible row.
     QFuture<AgeChart> calculateSubtree(DirTree *tree);
     QFuture<AgeChart> calculateFiles(DirTree *tree);
 
-    //! Cancel all running futures, wait for them to finish.
-    void cancelAll();
+    //! Chart of a subtree, or of the files directly in it.
+    struct Request
+    {
+        DirTree*    tree;
+        bool        files;
+    };
+
+    //! Charts of the requests from first on, in order.
+    struct Batch
+    {
+        size_t                  first;
+        std::vector<AgeChart>   charts;
+    };
+
+    //! Run many calculations as a few tasks, each of which calculates consecutive requests
+    //! and delivers their charts at once. Cheaper than one future per chart when a directory
+    //! with many subdirectories is expanded.
+    QList<QFuture<Batch>> calculateMany(std::span<const Request> requests,
+                                        Executor::Priority priority = Executor::Priority::VISIBLE);
+
+    //! Chart and totals of the files of several requests together, as if they were in one
+    //! directory. Approximate if a part is summarized, see AgeChart::errorBound.
+    struct Aggregate
+    {
+        AgeChart            chart;
+        DirTree::Totals     totals;
+        size_t              requests;  // Counted, without those inside others.
+    };
+
+    //! Aggregate the requests at interactive priority. Subtrees and files inside a requested
+    //! subtree are counted once, as part of it.
+    QFuture<Aggregate> aggregate(std::span<const Request> requests);
+
+    //! Aggregate the subtrees below the tree whose paths relative to it, separated by '/',
+    //! match the wildcard pattern. * matches across '/', so "*/build" matches at any depth,
+    //! and matches inside a matching subtree are part of it.
+    QFuture<Aggregate> aggregate(DirTree *tree, const QString &pattern);
+
+    //! Sort and index a freshly scanned tree at low priority, then calculate the charts of
+    //! all its directories in one pass, see ChartStore. Charts requested meanwhile sort what
+    //! they need themselves and use indexes as soon as they are published. The metrics are
+    //! computed by the same pass. With a memory budget, indexes only take what the tree
+    //! leaves of it.
+    QFuture<ChartStorePtr> prepare(DirTree *tree, size_t indexMinFiles, size_t memoryBudget,
+                                   int metrics = 0);
+
+    //! Cancel all running futures. If wait, return when they have finished, which is needed
+    //! before the tree is changed in place. Without waiting, the tasks keep a replaced tree
+    //! alive until they notice, see TreeReclaimer.
+    void cancelAll(bool wait = true);
 
 private:
     ChartCalculatorServicePrivate *p;
@@ -0,0 +1,46 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <atomic>
+#include "chartpercentiles.h"
+
+static_assert(ChartPercentiles::P5::weights(1000) == std::array<qint64, 5>{50, 250, 500, 750, 950});
+static_assert(percentileWeight(99, 5) == 99 / 20 && percentileWeight(99, 95) == 99 - 99 / 20);
+
+static std::atomic<ChartPercentiles::Whiskers> s_whiskers{ChartPercentiles::Whiskers::P5};
+
+ChartPercentiles::Whiskers ChartPercentiles::whiskers()
+{
+    return s_whiskers.load(std::memory_order_relaxed);
+}
+
+void ChartPercentiles::setWhiskers(Whiskers whiskers)
+{
+    s_whiskers.store(whiskers, std::memory_order_relaxed);
+}
+
+std::array<int, ChartPercentiles::SIZE> ChartPercentiles::percents()
+{
+    return dispatch([]<class Set>(Set) { return Set::PERCENTS; });
+}
+
+std::array<qint64, ChartPercentiles::SIZE> ChartPercentiles::weights(qint64 total)
+{
+    return dispatch([total]<class Set>(Set) { return Set::weights(total); });
+}
+
+const char *ChartPercentiles::name(Whiskers whiskers)
+{
+    switch (whiskers) {
+    case Whiskers::P1: return "1st/99th percentile";
+    case Whiskers::P5: return "5th/95th percentile";
+    case Whiskers::P10: return "10th/90th percentile";
+    default: return "";
+    }
+}
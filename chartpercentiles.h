@@ -0,0 +1,82 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef CHARTPERCENTILES_H
+#define CHARTPERCENTILES_H
+
+#include <QtGlobal>
+#include <array>
+#include "agechart.h"
+
+//! Accumulated size at which a percentile of the total is reached. Upper percentiles are
+//! counted down from the total, so that a chart is symmetric, e.g. total - total / 4.
+constexpr qint64 percentileWeight(qint64 total, int percent)
+{
+    if (percent > 50)
+        return total - percentileWeight(total, 100 - percent);
+    // Equal to total * percent / 100 without the overflow.
+    return total / 100 * percent + total % 100 * percent / 100;
+}
+
+//! Ascending percentiles in percent, known at compile time.
+template <int... Percents>
+struct Percentiles
+{
+    static constexpr size_t SIZE = sizeof...(Percents);
+    static constexpr std::array<int, SIZE> PERCENTS = { Percents... };
+
+    static constexpr std::array<qint64, SIZE> weights(qint64 total)
+    { return { percentileWeight(total, Percents)... }; }
+};
+
+//! Percentiles drawn by an AgeChart. The quartiles and the median are fixed, the whiskers can
+//! be chosen among a few sets, each with calculations compiled for it.
+class ChartPercentiles
+{
+public:
+    enum class Whiskers { P1, P5, P10, SENTINEL };
+
+    using P1 = Percentiles<1, 25, 50, 75, 99>;
+    using P5 = Percentiles<5, 25, 50, 75, 95>;
+    using P10 = Percentiles<10, 25, 50, 75, 90>;
+
+    static constexpr size_t SIZE = 5;
+    //! Fields of the percentiles, ascending.
+    static constexpr std::array<qint64 AgeChart::*, SIZE> FIELDS = {
+        &AgeChart::lowerWhisker, &AgeChart::lowerQuartile, &AgeChart::median,
+        &AgeChart::upperQuartile, &AgeChart::upperWhisker
+    };
+
+    //! Whiskers of all charts calculated from now on. Charts calculated while they change may
+    //! mix both sets, so drop those started before.
+    static Whiskers whiskers();
+    static void setWhiskers(Whiskers whiskers);
+
+    //! Call the function with the percentile set of the whiskers, e.g. P5{}.
+    template <class F>
+    static decltype(auto) dispatch(F &&f)
+    {
+        switch (whiskers()) {
+        case Whiskers::P1: return f(P1{});
+        case Whiskers::P10: return f(P10{});
+        default: return f(P5{});
+        }
+    }
+
+    //! Percentiles of the current whiskers.
+    static std::array<int, SIZE> percents();
+
+    //! Weights of the percentiles of the current whiskers, for calculations not compiled for them.
+    static std::array<qint64, SIZE> weights(qint64 total);
+
+    //! "5th/95th percentile" and so on.
+    static const char *name(Whiskers whiskers);
+};
+
+#endif // CHARTPERCENTILES_H
@@ -0,0 +1,213 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <algorithm>
+#include "chartscheduler.h"
+
+// Rows per batch. Painted rows go in small batches, so that the first charts show up soon.
+constexpr int CHARTSCHEDULER_PAINTED_BATCH = 32;
+constexpr int CHARTSCHEDULER_REQUESTED_BATCH = 256;
+// Requests wait this long for the view to paint, so that rows on screen are known first.
+constexpr int CHARTSCHEDULER_DELAY_MS = 20;
+
+ChartScheduler::ChartScheduler(DirModel *model, ChartCalculatorService *calculator,
+                               QObject *parent):
+    QObject{parent},
+    m_model{model},
+    m_calculator{calculator},
+    m_nextId{0}
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(CHARTSCHEDULER_DELAY_MS);
+    connect(&m_timer, &QTimer::timeout, this, &ChartScheduler::dispatch);
+}
+
+void ChartScheduler::request(const QModelIndexList &indexes)
+{
+    for (const QModelIndex &index : indexes) {
+        if (m_queued.contains(index) || !wanted(index))
+            continue;
+        m_queued.insert(index);
+        m_requested.push_back(index);
+    }
+    schedule();
+}
+
+void ChartScheduler::painted(const QModelIndexList &indexes)
+{
+    bool added = false;
+    for (const QModelIndex &index : indexes) {
+        if (!wanted(index))
+            continue;
+        // A requested row is queued again here; the entry taken first wins.
+        m_queued.insert(index);
+        m_painted.push_back(index);
+        added = true;
+    }
+    if (added)
+        dispatch();
+}
+
+void ChartScheduler::viewportChanged()
+{
+    for (auto i = m_painted.rbegin(); i != m_painted.rend(); ++i) {
+        m_requested.push_front(*i);
+    }
+    m_painted.clear();
+}
+
+void ChartScheduler::collapsed(const QModelIndex &index)
+{
+    auto [tree, target] = m_model->indexToDirTree(index);
+    if (target != DirModel::IndexTarget::ITSELF)
+        return;
+    auto below = [this, tree](const QModelIndex &row) {
+        if (!isBelow(row, tree))
+            return false;
+        m_queued.remove(row);
+        return true;
+    };
+    std::erase_if(m_painted, below);
+    std::erase_if(m_requested, below);
+    for (Running &r : m_running) {
+        if (!std::all_of(r.rows.begin(), r.rows.end(),
+                         [this, tree](const QModelIndex &row) { return isBelow(row, tree); }))
+            continue;
+        for (QFuture<ChartCalculatorService::Batch> &fut : r.futures) {
+            fut.cancel();
+        }
+    }
+}
+
+void ChartScheduler::clear()
+{
+    m_timer.stop();
+    for (Running &r : m_running) {
+        for (QFuture<ChartCalculatorService::Batch> &fut : r.futures) {
+            fut.cancel();
+        }
+    }
+    m_running.clear();
+    m_painted.clear();
+    m_requested.clear();
+    m_queued.clear();
+    m_done.clear();
+}
+
+void ChartScheduler::schedule()
+{
+    if (!m_timer.isActive())
+        m_timer.start();
+}
+
+void ChartScheduler::dispatch()
+{
+    m_timer.stop();
+    // Batches in progress per queue. More would only wait in the executor, where rows
+    // painted later could not overtake them.
+    const int maxRunning = Executor::instance().threadCount();
+    int painted = 0;
+    int requested = 0;
+    for (const Running &r : std::as_const(m_running)) {
+        ++(r.priority == Executor::Priority::VISIBLE ? painted : requested);
+    }
+    for (; painted < maxRunning; ++painted) {
+        QModelIndexList rows = take(m_painted, CHARTSCHEDULER_PAINTED_BATCH);
+        if (rows.isEmpty())
+            break;
+        submit(rows, Executor::Priority::VISIBLE);
+    }
+    for (; requested < maxRunning; ++requested) {
+        QModelIndexList rows = take(m_requested, CHARTSCHEDULER_REQUESTED_BATCH);
+        if (rows.isEmpty())
+            break;
+        submit(rows, Executor::Priority::BACKGROUND);
+    }
+}
+
+QModelIndexList ChartScheduler::take(std::deque<QModelIndex> &queue, int count)
+{
+    QModelIndexList rows;
+    while (!queue.empty() && rows.size() < count) {
+        QModelIndex index = queue.front();
+        queue.pop_front();
+        // Taken from the other queue already, or dropped.
+        if (!m_queued.remove(index))
+            continue;
+        if (wanted(index))
+            rows.append(index);
+    }
+    return rows;
+}
+
+void ChartScheduler::submit(const QModelIndexList &rows, Executor::Priority priority)
+{
+    std::vector<ChartCalculatorService::Request> requests;
+    QModelIndexList targets;
+    requests.reserve(rows.size());
+    for (const QModelIndex &index : rows) {
+        auto [subtree, target] = m_model->indexToDirTree(index);
+        if (target == DirModel::IndexTarget::INVALID)
+            continue;
+        requests.push_back({subtree, target == DirModel::IndexTarget::FILES});
+        targets.append(index);
+        m_done.insert(index);
+    }
+    if (requests.empty())
+        return;
+    const quint64 id = m_nextId++;
+    QList<QFuture<ChartCalculatorService::Batch>> futures =
+            m_calculator->calculateMany(requests, priority);
+    // Continuations of finished futures may run right away and dispatch more.
+    m_running.insert(id, Running{futures, targets, int(futures.size()), priority});
+    for (QFuture<ChartCalculatorService::Batch> &fut : futures) {
+        fut.then(this, [this, id, targets, basis = m_model->timeBasis(),
+                         version = m_model->version()](ChartCalculatorService::Batch batch) {
+            // Finished after the indexes went away.
+            if (version == m_model->version()) {
+                m_model->calculated(std::span(targets.constData() + batch.first,
+                                              batch.charts.size()),
+                                    batch.charts, basis);
+            }
+            finished(id);
+        }).onCanceled(this, [this, id]() {
+            finished(id);
+        });
+    }
+}
+
+void ChartScheduler::finished(quint64 id)
+{
+    auto i = m_running.find(id);
+    if (i == m_running.end() || --i->remaining > 0)
+        return;
+    // Rows of canceled batches may be requested again.
+    for (const QModelIndex &index : std::as_const(i->rows)) {
+        if (!m_model->isChartCached(index))
+            m_done.remove(index);
+    }
+    m_running.erase(i);
+    dispatch();
+}
+
+bool ChartScheduler::wanted(const QModelIndex &index) const
+{
+    return index.isValid() && !m_done.contains(index) && !m_model->isChartCached(index);
+}
+
+bool ChartScheduler::isBelow(const QModelIndex &row, const DirTree *collapsed) const
+{
+    auto [tree, target] = m_model->indexToDirTree(row);
+    if (target == DirModel::IndexTarget::INVALID)
+        return true;
+    // The collapsed directory's own row stays, its [Files] row does not.
+    if (tree == collapsed)
+        return target == DirModel::IndexTarget::FILES;
+    return collapsed->contains(tree);
+}
@@ -0,0 +1,78 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef CHARTSCHEDULER_H
+#define CHARTSCHEDULER_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <deque>
+#include "chartcalculatorservice.h"
+#include "dirmodel.h"
+
+//! Orders the chart calculations of rows by what is on screen, for the Controller. Requested
+//! rows are queued and handed to the calculator a few batches at a time, so that rows painted
+//! without a chart can still go first. Rows painted before a scroll fall back behind those
+//! painted after it, and rows of collapsed directories are dropped, together with batches in
+//! progress only for them.
+class ChartScheduler final: public QObject
+{
+    Q_OBJECT
+public:
+    ChartScheduler(DirModel *model, ChartCalculatorService *calculator,
+                   QObject *parent = nullptr);
+
+    //! Calculate the charts of the rows, after those on screen.
+    void request(const QModelIndexList &indexes);
+
+    //! Rows painted without a chart, calculated before all others.
+    void painted(const QModelIndexList &indexes);
+
+    //! The rows on screen changed, so those painted before may be off screen now.
+    void viewportChanged();
+
+    //! Drop the rows below the directory, which are hidden now.
+    void collapsed(const QModelIndex &index);
+
+    //! Forget all rows and cancel the batches in progress, before the model changes.
+    void clear();
+
+private:
+    struct Running
+    {
+        QList<QFuture<ChartCalculatorService::Batch>>   futures;
+        QModelIndexList                                 rows;
+        int                                             remaining;
+        Executor::Priority                              priority;
+    };
+
+    //! Dispatch soon, after the view had a chance to paint new rows.
+    void schedule();
+    void dispatch();
+    //! Up to count queued rows that still need a chart.
+    QModelIndexList take(std::deque<QModelIndex> &queue, int count);
+    void submit(const QModelIndexList &rows, Executor::Priority priority);
+    void finished(quint64 id);
+    bool wanted(const QModelIndex &index) const;
+    bool isBelow(const QModelIndex &row, const DirTree *collapsed) const;
+
+    DirModel*                   m_model;
+    ChartCalculatorService*     m_calculator;
+    QTimer                      m_timer;
+    std::deque<QModelIndex>     m_painted;
+    std::deque<QModelIndex>     m_requested;
+    QSet<QModelIndex>           m_queued;  // In one of the queues.
+    QSet<QModelIndex>           m_done;  // Submitted, so not queued again.
+    QHash<quint64, Running>     m_running;
+    quint64                     m_nextId;
+};
+
+#endif // CHARTSCHEDULER_H
@@ -0,0 +1,541 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <QSemaphore>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <optional>
+#include <queue>
+#include "chartpercentiles.h"
+#include "chartstore.h"
+#include "executor.h"
+#include "quantilescan.h"
+
+// Subtrees streamed by one worker. The tree is cut into about this many per thread, but
+// none smaller than the minimum unless it is a leaf.
+constexpr size_t CHARTSTORE_SUBTREES_PER_THREAD = 4;
+constexpr size_t CHARTSTORE_MIN_SUBTREE_FILES = 1 << 16;
+// Files streamed between checks for cancellation.
+constexpr size_t CHARTSTORE_CANCEL_INTERVAL = 1 << 14;
+
+using FileInfo = DirTree::FileInfo;
+using file_size_t = DirTree::file_size_t;
+using file_time_t = DirTree::file_time_t;
+
+constexpr qint64 LOW = std::numeric_limits<qint64>::lowest();
+constexpr qint64 HIGH = std::numeric_limits<qint64>::max();
+
+using Entry = DirTree::Index::Entry;
+using CountPercentiles = Percentiles<25, 50, 75>;
+static_assert(CountPercentiles::SIZE == ChartStore::NUM_COUNT_PERCENTILES);
+
+//! Accumulated weight of the files of a subtree seen so far, oldest first. A percentile is the
+//! time of the file at which the accumulated weight reaches its share, as in the calculator.
+template <class Set>
+struct Progress
+{
+    qint64          total = 0;
+    qint64          accumulated = 0;
+    qint64          nextWeight = 0;
+    int             next = 0;
+
+    static qint64 weight(qint64 total, int percentile)
+    {
+        if (percentile >= int(Set::SIZE))
+            return HIGH;
+        return percentileWeight(total, Set::PERCENTS[percentile]);
+    }
+
+    void start(qint64 subtotal)
+    {
+        total = subtotal;
+        nextWeight = weight(total, 0);
+    }
+
+    //! Calls reached(percentile) for each percentile the weight reaches.
+    template <class F>
+    void add(qint64 w, F &&reached)
+    {
+        accumulated += w;
+        while (accumulated >= nextWeight) {
+            reached(next);
+            nextWeight = weight(total, ++next);
+        }
+    }
+};
+
+//! Progress of a subtree by size for the chart, and by count for the statistics.
+template <class Set>
+struct NodeProgress
+{
+    Progress<Set>               size;
+    Progress<CountPercentiles>  count;
+
+    void start(const DirTree *t)
+    {
+        size.start(t->subtreeSize());
+        count.start(t->numSubtreeFiles());
+    }
+
+    void add(AgeChart &chart, ChartStore::Stats *stats, const Entry &e)
+    {
+        if (chart.min == LOW)
+            chart.min = e.time;
+        size.add(e.size, [&](int i) { chart.*ChartPercentiles::FIELDS[i] = e.time; });
+        if (stats != nullptr)
+            count.add(e.count, [&](int i) { stats->countPercentiles[i] = e.time; });
+        chart.max = e.time;
+    }
+};
+
+void ChartStore::Stats::merge(const Stats &other)
+{
+    const quint64 total = count + other.count;
+    if (total > 0) {
+        // The moments of both parts, combined as by Chan et al.
+        double delta = other.meanTime - meanTime;
+        double share = static_cast<double>(other.count) / total;
+        squaredDeviations += other.squaredDeviations + delta * delta * count * share;
+        meanTime += delta * share;
+    }
+    count = total;
+    for (size_t i = 0; i < NUM_SMALL_FILE_SIZES; ++i) {
+        smallFiles[i] += other.smallFiles[i];
+    }
+}
+
+//! Statistics of a directory's files, sorted by time.
+static ChartStore::Stats filesStats(std::span<const FileInfo> files, int metrics)
+{
+    ChartStore::Stats ret;
+    ret.known = metrics;
+    ret.count = files.size();
+    if (files.empty()) {
+        ret.known &= ~ChartStore::M_COUNT_PERCENTILES;
+        return ret;
+    }
+    if (metrics & ChartStore::M_COUNT_PERCENTILES) {
+        std::array<qint64, CountPercentiles::SIZE> weights = CountPercentiles::weights(ret.count);
+        for (size_t i = 0; i < weights.size(); ++i) {
+            ret.countPercentiles[i] = files[std::max<qint64>(weights[i], 1) - 1].time;
+        }
+    }
+    if (metrics & (ChartStore::M_AGE_MOMENTS | ChartStore::M_SMALL_FILES)) {
+        double mean = 0.0;
+        double squaredDeviations = 0.0;
+        size_t n = 0;
+        for (const FileInfo &f : files) {
+            // Welford's update, stable for times far from zero.
+            double delta = f.time - mean;
+            mean += delta / ++n;
+            squaredDeviations += delta * (f.time - mean);
+            for (size_t i = 0; i < ChartStore::NUM_SMALL_FILE_SIZES; ++i) {
+                ret.smallFiles[i] += (f.size < ChartStore::SMALL_FILE_SIZES[i]);
+            }
+        }
+        ret.meanTime = mean;
+        ret.squaredDeviations = squaredDeviations;
+    }
+    return ret;
+}
+
+ChartStore::ChartStore(std::span<DirTree* const> nodes, DirTree::TimeBasis basis, int metrics):
+    m_nodes(nodes.begin(), nodes.end()),
+    m_subtree(nodes.size()),
+    m_files(nodes.size()),
+    m_subtreeStats((metrics != 0) ? nodes.size() : 0),
+    m_filesStats((metrics != 0) ? nodes.size() : 0),
+    m_timeBasis{basis},
+    m_metrics{metrics},
+    m_lowestWhisker{HIGH},
+    m_highestWhisker{LOW}
+{ }
+
+//! The pass behind ChartStore::compute(). Directories whose subtree has neither summaries nor
+//! sketches are exact: each of their files, in time order, advances the progress of every
+//! exact ancestor. The tree is cut into subtrees streamed in parallel, each of which also
+//! keeps its files merged with equal times coalesced while the memory allows. The
+//! directories above the cut are then fed by merging those runs, so that no file is read
+//! from its directory twice, and the subtrees without one again from their directories.
+//! Compiled for each set of percentiles.
+template <class Set>
+class ChartPass
+{
+public:
+    ChartPass(DirTree *root, const std::function<bool()> &isCanceled, size_t maxRunBytes,
+              ChartStore &store):
+        m_root{root},
+        m_isCanceled{isCanceled},
+        m_store{store},
+        m_nodes{root->subtreeNodes()},
+        m_runBytes{maxRunBytes},
+        m_nextJob{0},
+        m_canceled{false}
+    { }
+
+    bool run()
+    {
+        const quint32 n = m_nodes.size();
+        m_parents.resize(n);
+        m_exact.assign(n + 1, 0);  // The root's parent is n, which is not exact.
+        m_progress.resize(n);
+        for (quint32 i = 0; i < n; ++i) {
+            DirTree *t = m_nodes[i];
+            m_parents[i] = (t == m_root) ? n : t->parent()->preorder();
+            m_exact[i] = !t->hasCollapsed() && t->subtreeSketch() == nullptr;
+            m_progress[i].start(t);
+        }
+        cut();
+
+        // Workers take jobs until none are left. Helpers only run on idle workers of the
+        // executor, so that waiting for them cannot starve it.
+        int helpers = std::min<qsizetype>(Executor::instance().threadCount(), numJobs()) - 1;
+        QSemaphore done;
+        int started = 0;
+        for (; started < helpers; ++started) {
+            if (!Executor::instance().tryStart(Executor::Priority::BACKGROUND, [this, &done]() {
+                work();
+                done.release();
+            })) {
+                break;
+            }
+        }
+        work();
+        done.acquire(started);
+        if (m_canceled.load(std::memory_order_relaxed))
+            return false;
+
+        streamAbove();
+        if (m_canceled.load(std::memory_order_relaxed))
+            return false;
+        if (m_store.m_metrics != 0)
+            combineStats();
+
+        for (quint32 i = 0; i < n; ++i) {
+            AgeChart &chart = m_store.m_subtree[i];
+            if (m_nodes[i]->subtreeSize() == 0)
+                chart = AgeChart();
+            for (const AgeChart *c : {&chart, &m_store.m_files[i]}) {
+                if (c->valid()) {
+                    m_store.m_lowestWhisker = std::min(m_store.m_lowestWhisker, c->lowerWhisker);
+                    m_store.m_highestWhisker = std::max(m_store.m_highestWhisker,
+                                                        c->upperWhisker);
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    bool canceled()
+    {
+        if (m_canceled.load(std::memory_order_relaxed))
+            return true;
+        if (m_isCanceled && m_isCanceled()) {
+            m_canceled.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    //! Split into subtrees for the workers, largest first, and the directories above them.
+    void cut()
+    {
+        size_t numThreads = Executor::instance().threadCount();
+        size_t grain = std::max(CHARTSTORE_MIN_SUBTREE_FILES,
+                                m_root->numSubtreeFiles() /
+                                (numThreads * CHARTSTORE_SUBTREES_PER_THREAD));
+        std::vector<DirTree*> stack{m_root};
+        while (!stack.empty()) {
+            DirTree *t = stack.back();
+            stack.pop_back();
+            if (t->numSubtreeFiles() <= grain || t->numChildren() == 0) {
+                m_subtrees.push_back(t);
+                continue;
+            }
+            m_above.push_back(t);
+            for (size_t i = 0; i < t->numChildren(); ++i) {
+                stack.push_back(t->child(i));
+            }
+        }
+        std::sort(m_subtrees.begin(), m_subtrees.end(), [](DirTree *a, DirTree *b) {
+            return a->numSubtreeFiles() > b->numSubtreeFiles();
+        });
+        m_runs.resize(m_subtrees.size());
+        m_kept.assign(m_subtrees.size(), 0);
+    }
+
+    //! Take the memory of a run from what is left for them.
+    bool reserveRun(size_t bytes)
+    {
+        size_t left = m_runBytes.load(std::memory_order_relaxed);
+        do {
+            if (left < bytes)
+                return false;
+        } while (!m_runBytes.compare_exchange_weak(left, left - bytes,
+                                                   std::memory_order_relaxed));
+        return true;
+    }
+
+    size_t numJobs() const
+    { return m_subtrees.size() + m_above.size(); }
+
+    void work()
+    {
+        for (size_t job = m_nextJob++; job < numJobs(); job = m_nextJob++) {
+            if (canceled())
+                return;
+            if (job < m_subtrees.size())
+                streamSubtree(job);
+            else
+                summarize(m_above[job - m_subtrees.size()]);
+        }
+    }
+
+    //! Charts that do not come from the stream: files of the directory, and subtrees with
+    //! summaries or sketches. Statistics of the directory's files.
+    void summarize(DirTree *t)
+    {
+        AgeChart &files = m_store.m_files[t->preorder()];
+        if (t->filesSketch() != nullptr) {
+            files = t->filesSketch()->chart();
+        }
+        else {
+            files = QuantileScan::chart(t->files(), t->filesSize()).value();
+        }
+        if (m_store.m_metrics != 0 && t->filesSketch() == nullptr && !t->isCollapsed())
+            m_store.m_filesStats[t->preorder()] = filesStats(t->files(), m_store.m_metrics);
+
+        if (m_exact[t->preorder()] || t->subtreeSize() == 0)
+            return;
+        if (t->subtreeSketch() != nullptr) {
+            m_store.m_subtree[t->preorder()] = t->subtreeSketch()->chart();
+        }
+        else {
+            QuantileSketch summary;
+            t->summarizeInto(summary);
+            summary.finalize();
+            m_store.m_subtree[t->preorder()] = summary.chart();
+        }
+    }
+
+    void streamSubtree(size_t job)
+    {
+        DirTree *subtree = m_subtrees[job];
+        for (DirTree *t : subtree->subtreeNodes()) {
+            summarize(t);
+        }
+        const quint32 top = subtree->preorder();
+        if (!m_exact[top] && !hasExact(subtree))
+            return;
+        // Only needed if the parent is fed by the runs. Files of a subtree without one are
+        // merged again for the parent.
+        const size_t maxBytes = subtree->numSubtreeFiles() * sizeof(Entry);
+        const bool keepRun = m_exact[m_parents[top]] && reserveRun(maxBytes);
+        std::vector<Entry> &run = m_runs[job];
+        if (keepRun)
+            run.reserve(subtree->numSubtreeFiles());
+        size_t count = 0;
+        for (auto i = subtree->begin(); i != subtree->end(); ++i) {
+            if (++count % CHARTSTORE_CANCEL_INTERVAL == 0 && canceled())
+                return;
+            const Entry e{i->size, i->time, 1};
+            for (quint32 v = i.directory()->preorder(); m_exact[v]; v = m_parents[v]) {
+                m_progress[v].add(m_store.m_subtree[v], streamedStats(v), e);
+                if (v == top)
+                    break;
+            }
+            if (!keepRun)
+                continue;
+            if (!run.empty() && run.back().time == e.time) {
+                run.back().size += e.size;
+                run.back().count += 1;
+            }
+            else {
+                run.push_back(e);
+            }
+        }
+        if (!keepRun)
+            return;
+        // Equal times were coalesced.
+        m_runBytes.fetch_add(maxBytes - run.size() * sizeof(Entry), std::memory_order_relaxed);
+        run.shrink_to_fit();
+        m_kept[job] = 1;
+    }
+
+    //! Statistics advanced by the stream, if any.
+    ChartStore::Stats *streamedStats(quint32 v)
+    {
+        if (!(m_store.m_metrics & ChartStore::M_COUNT_PERCENTILES))
+            return nullptr;
+        return &m_store.m_subtreeStats[v];
+    }
+
+    //! Add up the statistics of the directories' files bottom-up. Only exact subtrees have
+    //! them; their percentiles by count came from the stream.
+    void combineStats()
+    {
+        std::vector<ChartStore::Stats> &subtree = m_store.m_subtreeStats;
+        const quint32 n = m_nodes.size();
+        // Descendants follow in pre-order, so each subtree is complete before its parent.
+        for (quint32 i = n; i-- > 0;) {
+            ChartStore::Stats &s = subtree[i];
+            s.merge(m_store.m_filesStats[i]);
+            s.known = m_exact[i] ? m_store.m_metrics : 0;
+            if (s.count == 0)
+                s.known &= ~ChartStore::M_COUNT_PERCENTILES;
+            if (m_parents[i] < n)
+                subtree[m_parents[i]].merge(s);
+        }
+    }
+
+    bool hasExact(DirTree *subtree) const
+    {
+        for (DirTree *t : subtree->subtreeNodes()) {
+            if (m_exact[t->preorder()])
+                return true;
+        }
+        return false;
+    }
+
+    //! One ordered input of streamAbove(): the run of a subtree, the files of a subtree
+    //! without one, or a directory's own files.
+    struct Source
+    {
+        const Entry*                    run;
+        const Entry*                    runEnd;
+        std::optional<DirTree::iterator> merged;
+        const FileInfo*                 files;
+        const FileInfo*                 filesEnd;
+        quint32                         from;  // Directory that the files go to first.
+
+        bool atEnd() const
+        {
+            if (run != nullptr)
+                return run == runEnd;
+            if (merged.has_value())
+                return *merged == DirTree::iterator(nullptr);
+            return files == filesEnd;
+        }
+
+        Entry current() const
+        {
+            if (run != nullptr)
+                return *run;
+            const FileInfo &f = merged.has_value() ? **merged : *files;
+            return Entry{f.size, f.time, 1};
+        }
+
+        file_time_t time() const
+        {
+            if (run != nullptr)
+                return run->time;
+            return merged.has_value() ? (*merged)->time : files->time;
+        }
+
+        void advance()
+        {
+            if (run != nullptr)
+                ++run;
+            else if (merged.has_value())
+                ++*merged;
+            else
+                ++files;
+        }
+    };
+
+    //! Feed the exact directories above the cut from the subtrees and their own files.
+    void streamAbove()
+    {
+        std::vector<Source> sources;
+        for (size_t i = 0; i < m_subtrees.size(); ++i) {
+            DirTree *subtree = m_subtrees[i];
+            const quint32 parent = m_parents[subtree->preorder()];
+            if (!m_exact[parent])
+                continue;
+            Source &s = sources.emplace_back(Source{nullptr, nullptr, std::nullopt,
+                                                    nullptr, nullptr, parent});
+            if (m_kept[i]) {
+                s.run = m_runs[i].data();
+                s.runEnd = m_runs[i].data() + m_runs[i].size();
+            }
+            else {
+                s.merged.emplace(subtree);
+            }
+        }
+        for (DirTree *t : m_above) {
+            std::span<const FileInfo> files = t->files();
+            if (m_exact[t->preorder()] && !files.empty()) {
+                sources.push_back(Source{nullptr, nullptr, std::nullopt,
+                                         files.data(), files.data() + files.size(),
+                                         t->preorder()});
+            }
+        }
+        auto later = [&sources](quint32 a, quint32 b) {
+            return sources[a].time() > sources[b].time();
+        };
+        std::priority_queue<quint32, std::vector<quint32>, decltype(later)> heap(later);
+        for (quint32 i = 0; i < sources.size(); ++i) {
+            if (!sources[i].atEnd())
+                heap.push(i);
+        }
+        size_t count = 0;
+        while (!heap.empty()) {
+            if (++count % CHARTSTORE_CANCEL_INTERVAL == 0 && canceled())
+                return;
+            quint32 i = heap.top();
+            heap.pop();
+            Source &s = sources[i];
+            const Entry e = s.current();
+            for (quint32 v = s.from; m_exact[v]; v = m_parents[v]) {
+                m_progress[v].add(m_store.m_subtree[v], streamedStats(v), e);
+            }
+            s.advance();
+            if (!s.atEnd())
+                heap.push(i);
+        }
+        m_runs.clear();
+    }
+
+    DirTree*                            m_root;
+    const std::function<bool()>&        m_isCanceled;
+    ChartStore&                         m_store;
+    std::span<DirTree* const>           m_nodes;
+    std::vector<quint32>                m_parents;  // By pre-order number.
+    std::vector<quint8>                 m_exact;
+    std::vector<NodeProgress<Set>>      m_progress;
+    std::vector<DirTree*>               m_subtrees;
+    std::vector<std::vector<Entry>>     m_runs;  // Of the subtrees, coalesced by time.
+    std::vector<quint8>                 m_kept;  // Whether the subtree's run was kept.
+    std::atomic<size_t>                 m_runBytes;  // Left for the runs.
+    std::vector<DirTree*>               m_above;
+    std::atomic<size_t>                 m_nextJob;
+    std::atomic<bool>                   m_canceled;
+};
+
+std::shared_ptr<const ChartStore> ChartStore::compute(DirTree *root, int metrics,
+                                                      const std::function<bool()> &isCanceled,
+                                                      size_t maxRunBytes)
+{
+    // Charts are kept by pre-order number of the whole tree.
+    if (root->parent() != nullptr || root->subtreeEnd() == 0)
+        return nullptr;
+    std::shared_ptr<ChartStore> store{new ChartStore(root->subtreeNodes(), root->timeBasis(),
+                                                     metrics)};
+    // The files of a spilled tree stay on disk, and so do the runs.
+    if (root->hasSpillFile())
+        maxRunBytes = 0;
+    bool done = ChartPercentiles::dispatch([&]<class Set>(Set) {
+        return ChartPass<Set>{root, isCanceled, maxRunBytes, *store}.run();
+    });
+    if (!done)
+        return nullptr;
+    return store;
+}
@@ -0,0 +1,124 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef CHARTSTORE_H
+#define CHARTSTORE_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "agechart.h"
+#include "dirtree.h"
+
+//! Charts of every directory of a numbered tree, of the subtree and of the directory's own
+//! files, indexed by the pre-order number, and optionally further statistics of the files.
+//! Built by one pass over the whole tree and read-only afterwards, so it can be shared between
+//! threads.
+class ChartStore
+{
+public:
+    //! Statistics computed along with the charts, combined as a mask.
+    enum Metric {
+        M_COUNT_PERCENTILES = 1 << 0,  // Quartiles and median of the times, weighted by count.
+        M_AGE_MOMENTS = 1 << 1,        // Mean and standard deviation of the times.
+        M_SMALL_FILES = 1 << 2,        // Files below each of SMALL_FILE_SIZES.
+        M_ALL = (1 << 3) - 1
+    };
+    static constexpr size_t NUM_COUNT_PERCENTILES = 3;
+    static constexpr size_t NUM_SMALL_FILE_SIZES = 3;
+    static constexpr std::array<DirTree::file_size_t, NUM_SMALL_FILE_SIZES> SMALL_FILE_SIZES = {
+        4 << 10, 64 << 10, 1 << 20
+    };
+
+    //! Statistics of files beyond the chart. Only the metrics in known were computed, which
+    //! excludes summaries and sketches.
+    struct Stats
+    {
+        int                                             known = 0;
+        quint64                                         count = 0;
+        //! Times at which a quarter, half and three quarters of the files are reached.
+        std::array<qint64, NUM_COUNT_PERCENTILES>       countPercentiles{};
+        double                                          meanTime = 0.0;
+        double                                          squaredDeviations = 0.0;
+        std::array<quint64, NUM_SMALL_FILE_SIZES>       smallFiles{};
+
+        double stddevTime() const
+        { return (count > 0) ? std::sqrt(squaredDeviations / count) : 0.0; }
+
+        //! Add the moments and size classes of other files. Percentiles do not add up.
+        void merge(const Stats &other);
+    };
+
+    //! Compute all charts of the tree with the time basis it has now, and the statistics of
+    //! the metrics. Sorts directories that are not sorted yet. Each file is visited once:
+    //! files stream by ascending time through the subtrees in parallel and update all their
+    //! ancestors. Summaries and sketches give the same estimates as single calculations. Null
+    //! if the tree is not numbered or if canceled. The merged files of the subtrees streamed in
+    //! parallel are kept in at most maxRunBytes, and those of others read twice; a spilled
+    //! tree keeps none.
+    static std::shared_ptr<const ChartStore> compute(DirTree *root, int metrics = 0,
+                                                     const std::function<bool()> &isCanceled = {},
+                                                     size_t maxRunBytes = SIZE_MAX);
+
+    DirTree::TimeBasis timeBasis() const
+    { return m_timeBasis; }
+
+    //! Number of directories covered.
+    size_t size() const
+    { return m_subtree.size(); }
+
+    //! Whether the directory belongs to the tree the store was computed for.
+    bool covers(const DirTree *tree) const
+    { return tree->preorder() < m_subtree.size() && m_nodes[tree->preorder()] == tree; }
+
+    //! Charts of a covered directory. Invalid if there are no files.
+    const AgeChart &subtree(const DirTree *tree) const
+    { return m_subtree[tree->preorder()]; }
+
+    const AgeChart &files(const DirTree *tree) const
+    { return m_files[tree->preorder()]; }
+
+    //! Metrics computed with the charts.
+    int metrics() const
+    { return m_metrics; }
+
+    //! Statistics of a covered directory, or null if no metrics were computed.
+    const Stats *subtreeStats(const DirTree *tree) const
+    { return m_metrics != 0 ? &m_subtreeStats[tree->preorder()] : nullptr; }
+
+    const Stats *filesStats(const DirTree *tree) const
+    { return m_metrics != 0 ? &m_filesStats[tree->preorder()] : nullptr; }
+
+    //! Lowest lower whisker and highest upper whisker of all charts.
+    qint64 lowestWhisker() const
+    { return m_lowestWhisker; }
+
+    qint64 highestWhisker() const
+    { return m_highestWhisker; }
+
+private:
+    ChartStore(std::span<DirTree* const> nodes, DirTree::TimeBasis basis, int metrics);
+    template <class Set> friend class ChartPass;
+
+    std::vector<const DirTree*> m_nodes;
+    std::vector<AgeChart>       m_subtree;
+    std::vector<AgeChart>       m_files;
+    std::vector<Stats>          m_subtreeStats;  // Empty without metrics.
+    std::vector<Stats>          m_filesStats;
+    DirTree::TimeBasis          m_timeBasis;
+    int                         m_metrics;
+    qint64                      m_lowestWhisker;
+    qint64                      m_highestWhisker;
+};
+
+using ChartStorePtr = std::shared_ptr<const ChartStore>;
+
+#endif // CHARTSTORE_H
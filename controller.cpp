@@ -13,10 +13,16 @@
 #include <QAbstractItemView>
 #include <QEventLoop>
 #include <QFileDialog>
+#include <QGuiApplication>
+#include <QInputDialog>
 #include <QProgressDialog>
 #include <QMessageBox>
 
+#include <algorithm>
+
 #include "controller.h"
+#include "executor.h"
+#include "treereclaimer.h"
 
 // Utility functions
 
@@ -32,9 +38,13 @@ static void fullPath(QString &path, DirTree *tree)
     }
 }
 
-static QModelIndex next(const QAbstractItemModel *model, QModelIndex index)
+using IndexPredicate = std::function<bool(const QModelIndex&)>;
+
+//! Next row in document order. Children are skipped unless descend() allows them.
+static QModelIndex next(const QAbstractItemModel *model, QModelIndex index,
+                        const IndexPredicate &descend)
 {
-    if (model->rowCount(index) > 0) {
+    if (model->rowCount(index) > 0 && descend(index)) {
         return model->index(0, 0, index);
     }
     else {
@@ -49,13 +59,14 @@ static QModelIndex next(const QAbstractItemModel *model, QModelIndex index)
     return QModelIndex{};
 }
 
-static QModelIndex previous(const QAbstractItemModel *model, QModelIndex index)
+static QModelIndex previous(const QAbstractItemModel *model, QModelIndex index,
+                            const IndexPredicate &descend)
 {
     if (index.isValid()) {
         if (index.row() > 0) {
             index = model->index(index.row() - 1, 0, model->parent(index));
             int numChildren = model->rowCount(index);
-            while (numChildren > 0) {
+            while (numChildren > 0 && descend(index)) {
                 index = model->index(numChildren - 1, 0, index);
                 numChildren = model->rowCount(index);
             }
@@ -94,7 +105,8 @@ static QModelIndex whileCond(const QModelIndex &from,
 
 Controller::Controller(DirModel *model, QObject *parent):
     QObject{parent},
-    m_model(model)
+    m_model(model),
+    m_chartScheduler(model, &m_chartCalculator)
 {
     m_proxyModel = nullptr;
 }
@@ -103,6 +115,7 @@ Controller::~Controller()
 {
     emit cancelReport();
     m_scanner.cancel();
+    m_groupBy.cancel();
     m_chartCalculator.cancelAll();
 }
 
@@ -120,16 +133,42 @@ void Controller::onRequestCalculation(QModelIndex index)
         else {
             return;
         }
-        fut.then(this, [this, index](AgeChart chart) {
-            m_model->calculated(index, chart);
+        fut.then(this, [this, index, basis = m_model->timeBasis(),
+                         version = m_model->version()](AgeChart chart) {
+            // Finished after the index went away.
+            if (version == m_model->version())
+                m_model->calculated(index, chart, basis);
         });
     }
 }
 
+void Controller::prepare(DirTree *tree)
+{
+    // Indexes are as large as the files they cover, which a spilled tree keeps on disk.
+    const size_t indexMinFiles = tree->hasSpillFile() ? 0 : m_scanOptions.indexMinFiles;
+    auto fut = m_chartCalculator.prepare(tree, indexMinFiles, m_scanOptions.memoryBudget,
+                                         m_metrics);
+    fut.then(this, [this, version = m_model->version()](ChartStorePtr store) {
+        if (version == m_model->version())
+            m_model->setChartStore(std::move(store));
+    });
+}
+
+void Controller::stopReaders(bool wait)
+{
+    emit cancelReport();
+    m_chartScheduler.clear();
+    m_chartCalculator.cancelAll(wait);
+    m_groupBy.cancel();
+    m_search.cancel();
+    clearSearchResults();
+}
+
 void Controller::clearSearchResults()
 {
     m_searchResultsSource.clear();
     m_searchResultsProxied.clear();
+    m_searchResultIds.clear();
 }
 
 QModelIndex Controller::findInSearchResults(const QModelIndex &from, bool backwards)
@@ -143,11 +182,26 @@ QModelIndex Controller::findInSearchResults(const QModelIndex &from, bool backwa
     auto pred = [results](const QModelIndex &_i) { return results->contains(_i); };
     auto isValid = [](const QModelIndex &_i) { return _i.isValid(); };
     auto isNotStarting = [from](const QModelIndex &_i) { return  _i.isValid() && _i != from; };
+    // Results are sorted by pre-order number, so whether a subtree has any below its root is a
+    // binary search. Others are stepped over instead of walked row by row.
+    IndexPredicate descend = [this](const QModelIndex &_i) {
+        QModelIndex source = (m_proxyModel != nullptr) ? m_proxyModel->mapToSource(_i) : _i;
+        auto [tree, target] = m_model->indexToDirTree(source);
+        if (target != DirModel::IndexTarget::ITSELF)
+            return false;
+        if (tree->subtreeEnd() == 0)
+            return true;
+        auto i = std::upper_bound(m_searchResultIds.cbegin(), m_searchResultIds.cend(),
+                                  tree->preorder());
+        return i != m_searchResultIds.cend() && *i < tree->subtreeEnd();
+    };
     std::function<QModelIndex(const QModelIndex&)> advance;
     if (backwards)
-        advance = [model](const QModelIndex &_i) { return previous(model, _i); };
+        advance = [model, &descend](const QModelIndex &_i) {
+            return previous(model, _i, descend);
+        };
     else
-        advance = [model](const QModelIndex &_i) { return next(model, _i); };
+        advance = [model, &descend](const QModelIndex &_i) { return next(model, _i, descend); };
 
     QModelIndex result = whileCond(advance(from), isValid, pred, advance);
     // If no result, then wrap search from start/end.
@@ -155,7 +209,7 @@ QModelIndex Controller::findInSearchResults(const QModelIndex &from, bool backwa
         QModelIndex wrapped = model->index(0, 0);
         if (backwards) {
             int numChildren = model->rowCount(wrapped);
-            while (numChildren > 0) {
+            while (numChildren > 0 && descend(wrapped)) {
                 wrapped = model->index(numChildren - 1, 0, wrapped);
                 numChildren = model->rowCount(wrapped);
             }
@@ -172,9 +226,9 @@ void Controller::onOpenDirAction()
         emit onDirChosen(dir);
 }
 
-void Controller::onDirChosen(QString dir)
+void Controller::scan(QString dir, std::function<void(DirTree*)> done)
 {
-    auto state = m_scanner.start(dir);
+    auto state = m_scanner.start(dir, m_scanOptions);
     QTimer *tmr =new QTimer(this);
     tmr->setInterval(1000);
     connect(tmr, &QTimer::timeout, this, [this, tmr, state]() {
@@ -184,6 +238,8 @@ void Controller::onDirChosen(QString dir)
                                       "%3 skipped and %4 errors.")
                                       .arg(s.numFiles).arg(s.numDirs)
                                       .arg(s.numSkipped).arg(s.numErrors);
+            if (s.numCollapsed > 0)
+                msg.append(QStringLiteral(" %1 summarized to save memory.").arg(s.numCollapsed));
             emit scanStatusMessage(msg);
         }
         else {
@@ -193,22 +249,29 @@ void Controller::onDirChosen(QString dir)
     tmr->start();
     emit scanStateChanged(true);
     auto fut = state.future();
-    fut.then(this, [this, dir](DirTree *tree) {
-        m_model->reset(tree);
+    fut.then(this, [this, done](DirTree *tree) {
+        done(tree);
+        emit scanStateChanged(false);
+    }).onCanceled(this, [this]() {
         emit scanStateChanged(false);
+    });
+}
+
+void Controller::onDirChosen(QString dir)
+{
+    scan(dir, [this, dir](DirTree *tree) {
+        // Readers of the old tree keep it pinned until they notice, so no need to wait.
+        stopReaders(false);
+        m_model->reset(tree);
         if (m_model->rowCount() > 0) {
-            emit cancelReport();
-            m_chartCalculator.cancelAll();
-            m_search.cancel();
-            clearSearchResults();
+            m_scanOptions.timeBasis = tree->timeBasis();
+            prepare(tree);
             onRequestCalculation(m_model->index(0, 0));
             m_currentRoot = dir;
         }
         else {
             m_currentRoot.reset();
         }
-    }).onCanceled(this, [this]() {
-        emit scanStateChanged(false);
     });
 }
 
@@ -227,11 +290,28 @@ void Controller::onRescanAction()
 
 void Controller::onTreeExpanded(QModelIndex index)
 {
+    QModelIndexList missing;
     for (int i = 0; i < m_model->rowCount(index); ++i) {
         QModelIndex child = m_model->index(i, index.column(), index);
         if (!m_model->isChartCached(child))
-            onRequestCalculation(child);
+            missing.append(child);
     }
+    m_chartScheduler.request(missing);
+}
+
+void Controller::onRowsPainted(QModelIndexList indexes)
+{
+    m_chartScheduler.painted(indexes);
+}
+
+void Controller::onViewportChanged()
+{
+    m_chartScheduler.viewportChanged();
+}
+
+void Controller::onTreeCollapsed(QModelIndex index)
+{
+    m_chartScheduler.collapsed(index);
 }
 
 void Controller::onOpenFromViewAction(QModelIndex index)
@@ -245,6 +325,52 @@ void Controller::onOpenFromViewAction(QModelIndex index)
     onDirChosen(newPath);
 }
 
+void Controller::onExpandSummaryAction(QModelIndex index)
+{
+    auto p = m_model->indexToDirTree(index);
+    if (p.second != DirModel::IndexTarget::ITSELF || !p.first->isCollapsed())
+        return;
+    DirTree *collapsed = p.first;
+    QString path;
+    fullPath(path, collapsed);
+    // A scan of another root cancels this one, so the summary is still in the model when done.
+    scan(path, [this, collapsed](DirTree *tree) {
+        if (tree == nullptr)
+            return;
+        // The ancestors change in place once the readers noticed.
+        stopReaders(false);
+        TreeReclaimer::whenUnpinned(this, [this, collapsed, tree]() {
+            // Another tree or graft may have come first. Only the address of the summary is
+            // compared, it may be gone.
+            DirTree *root = m_model->indexToDirTree(m_model->index(0, 0)).first;
+            std::span<DirTree* const> nodes;
+            if (root != nullptr)
+                nodes = root->subtreeNodes();
+            if (std::find(nodes.begin(), nodes.end(), collapsed) == nodes.end() ||
+                    !collapsed->isCollapsed()) {
+                delete tree;
+                return;
+            }
+            if (tree->timeBasis() != root->timeBasis() &&
+                    !tree->canSwitchTimeBasis(root->timeBasis())) {
+                // The rescan did not record the time of the tree.
+                delete tree;
+                onRescanAction();
+                return;
+            }
+            m_model->graft(collapsed, tree);
+            prepare(root);
+            QModelIndex index = m_model->dirTreeToIndex(tree);
+            QModelIndexList ancestors;
+            for (QModelIndex i = index; i.isValid(); i = i.parent()) {
+                ancestors.append(i);
+            }
+            m_chartScheduler.request(ancestors);
+            onTreeExpanded(index);
+        });
+    });
+}
+
 void Controller::onOpenFromViewInFMAction(QModelIndex index)
 {
     auto p = m_model->indexToDirTree(index);
@@ -278,11 +404,13 @@ void Controller::onSearch(QString string, SearchService::Mode mode)
             for (int i = 0; i < fut.resultCount(); ++i) {
                 QModelIndex sourceIndex = m_model->dirTreeToIndex(fut.resultAt(i));
                 m_searchResultsSource.insert(sourceIndex);
+                m_searchResultIds.push_back(fut.resultAt(i)->preorder());
                 if (m_proxyModel != nullptr) {
                     QModelIndex proxiedIndex = m_proxyModel->mapFromSource(sourceIndex);
                     m_searchResultsProxied.insert(proxiedIndex);
                 }
             }
+            std::sort(m_searchResultIds.begin(), m_searchResultIds.end());
             emit searchDone(fut.resultCount());
         });
     }
@@ -337,7 +465,7 @@ void Controller::onSaveReportAction()
         return;
     DirTree *tree = m_model->indexToDirTree(m_model->index(0, 0)).first;
     QFuture<T> fut;
-    fut = m_reportService.generateReport(&m_chartCalculator, tree);
+    fut = m_reportService.generateReport(tree, m_model->chartStore(), m_metrics);
     QProgressDialog progDlg("Generating report...", "Cancel", 0, 0);
     progDlg.setWindowModality(Qt::WindowModal);
     progDlg.setMinimumDuration(0);
@@ -356,3 +484,235 @@ void Controller::onSaveReportAction()
         }
     }
 }
+
+void Controller::onSketchModeToggled(bool enabled)
+{
+    // Takes effect on the next scan or rescan.
+    m_scanOptions.sketchMode = enabled;
+}
+
+void Controller::onSpillToDiskToggled(bool enabled)
+{
+    m_scanOptions.spillToDisk = enabled;
+}
+
+void Controller::onMemoryBudgetAction()
+{
+    bool ok = false;
+    int megabytes = QInputDialog::getInt(nullptr, "Memory Budget",
+                                         "Summarize directories to keep the tree under this many "
+                                         "MiB (0 for no limit):",
+                                         int(m_scanOptions.memoryBudget >> 20), 0, 1 << 30, 256,
+                                         &ok);
+    if (ok)
+        m_scanOptions.memoryBudget = size_t(megabytes) << 20;
+}
+
+void Controller::onIndexThresholdAction()
+{
+    bool ok = false;
+    int files = QInputDialog::getInt(nullptr, "Index Threshold",
+                                     "Index subtrees with at least this many files after a scan "
+                                     "(0 for no indexes):",
+                                     int(m_scanOptions.indexMinFiles), 0, 1 << 30, 1 << 16, &ok);
+    // Takes effect on the next scan or rescan.
+    if (ok)
+        m_scanOptions.indexMinFiles = size_t(files);
+}
+
+void Controller::onTaskStatsAction()
+{
+    Executor::Stats stats = Executor::instance().stats();
+    QString text = QStringLiteral("%1 workers, and one more kept for interactive tasks.\n")
+            .arg(Executor::instance().threadCount());
+    for (size_t i = 0; i < Executor::NUM_PRIORITIES; ++i) {
+        const Executor::ClassStats &c = stats[i];
+        text += QStringLiteral("\n%1: %2 queued, %3 running, %4 finished (%5 canceled), "
+                               "waited %6 ms on average and %7 ms at most")
+                .arg(Executor::priorityName(static_cast<Executor::Priority>(i)))
+                .arg(c.queued).arg(c.running).arg(c.finished).arg(c.canceled)
+                .arg(c.meanWaitMs, 0, 'f', 1).arg(c.maxWaitMs, 0, 'f', 1);
+    }
+    QMessageBox::information(nullptr, "Task Statistics", text);
+}
+
+void Controller::onTimeBasisChosen(DirTree::TimeBasis basis)
+{
+    m_scanOptions.timeBasis = basis;
+    if (m_model->rowCount() == 0 || basis == m_model->timeBasis())
+        return;
+    DirTree *tree = m_model->indexToDirTree(m_model->index(0, 0)).first;
+    if (!tree->canSwitchTimeBasis(basis)) {
+        // The time was not recorded.
+        onRescanAction();
+        return;
+    }
+    // Calculations, reports and a running search read the files that are about to be
+    // re-sorted. The switch waits for them to notice, and charts they finish meanwhile are kept
+    // for the old time. Results of a finished search stay valid.
+    emit cancelReport();
+    m_chartScheduler.clear();
+    m_chartCalculator.cancelAll(false);
+    m_groupBy.cancel();
+    m_search.cancel();
+    TreeReclaimer::whenUnpinned(this, [this, basis, tree]() {
+        // A new tree may have come first.
+        if (m_model->rowCount() == 0 || basis == m_model->timeBasis() ||
+                m_model->indexToDirTree(m_model->index(0, 0)).first != tree)
+            return;
+        QGuiApplication::setOverrideCursor(Qt::WaitCursor);
+        QModelIndexList missing = m_model->setTimeBasis(basis);
+        QGuiApplication::restoreOverrideCursor();
+        prepare(m_model->indexToDirTree(m_model->index(0, 0)).first);
+        m_chartScheduler.request(missing);
+    });
+}
+
+void Controller::onWhiskersChosen(ChartPercentiles::Whiskers whiskers)
+{
+    if (whiskers == ChartPercentiles::whiskers())
+        return;
+    // Charts calculated meanwhile may mix both percentiles. The tree does not change, so they
+    // are dropped by the version that resetCharts() advances instead of waited for.
+    emit cancelReport();
+    m_chartScheduler.clear();
+    m_chartCalculator.cancelAll(false);
+    ChartPercentiles::setWhiskers(whiskers);
+    if (m_model->rowCount() == 0)
+        return;
+    QModelIndexList missing = m_model->resetCharts();
+    prepare(m_model->indexToDirTree(m_model->index(0, 0)).first);
+    m_chartScheduler.request(missing);
+}
+
+void Controller::onMetricToggled(ChartStore::Metric metric, bool enabled)
+{
+    m_metrics = enabled ? (m_metrics | metric) : (m_metrics & ~metric);
+    if (!enabled || m_model->rowCount() == 0)
+        return;
+    ChartStorePtr store = m_model->chartStore();
+    if (store != nullptr && (store->metrics() & metric))
+        return;
+    // The charts are computed again with the statistics, and replace the store when done.
+    prepare(m_model->indexToDirTree(m_model->index(0, 0)).first);
+}
+
+void Controller::onRecordAllTimesToggled(bool enabled)
+{
+    // Takes effect on the next scan or rescan.
+    m_scanOptions.extraTimeBases = enabled ? (1 << DirTree::NUM_TIME_BASES) - 1 : 0;
+}
+
+void Controller::onRecordAttributeToggled(DirTree::Dimension dimension, bool enabled)
+{
+    // Takes effect on the next scan or rescan.
+    if (enabled)
+        m_scanOptions.dimensions |= 1 << dimension;
+    else
+        m_scanOptions.dimensions &= ~(1 << dimension);
+}
+
+void Controller::onBreakdownAction(QModelIndex index, DirTree::Dimension dimension)
+{
+    auto p = m_model->indexToDirTree(index);
+    if (p.second != DirModel::IndexTarget::ITSELF)
+        return;
+    QString path;
+    fullPath(path, p.first);
+    QString title = QStringLiteral("%1 by %2")
+            .arg(path, AttributeDictionary::dimensionName(dimension));
+    m_groupBy.start(p.first, dimension).then(this, [this, title](GroupByService::Result result) {
+        emit breakdownDone(title, result);
+    });
+}
+
+void Controller::onTrackTopFilesToggled(bool enabled)
+{
+    // Takes effect on the next scan or rescan.
+    m_scanOptions.topFiles = enabled;
+}
+
+void Controller::onHeatmapsToggled(bool enabled)
+{
+    // Takes effect on the next scan or rescan.
+    m_scanOptions.heatmaps = enabled;
+}
+
+void Controller::onTopFilesAction(QModelIndex index, DirTree::TopKind kind)
+{
+    auto p = m_model->indexToDirTree(index);
+    if (p.second != DirModel::IndexTarget::ITSELF)
+        return;
+    QString path;
+    fullPath(path, p.first);
+    QList<QPair<QString, DirTree::TopFile>> files;
+    // Each name costs a read of its directory, at most DirTree::TOP_FILES of them.
+    QGuiApplication::setOverrideCursor(Qt::WaitCursor);
+    for (const DirTree::TopFile &f : p.first->topFiles(kind)) {
+        QString dirPath;
+        fullPath(dirPath, f.dir);
+        QString name = ScannerService::entryName(dirPath, f.ordinal, f.size);
+        if (!name.isEmpty())
+            name = dirPath + QDir::separator() + name;
+        files.append(qMakePair(name, f));
+    }
+    QGuiApplication::restoreOverrideCursor();
+    QString title = QStringLiteral("%1 files in %2")
+            .arg(kind == DirTree::LARGEST ? "Largest" : "Oldest", path);
+    emit topFilesDone(title, files);
+}
+
+void Controller::onAggregateAction(QModelIndexList indexes)
+{
+    std::vector<ChartCalculatorService::Request> requests;
+    for (const QModelIndex &index : std::as_const(indexes)) {
+        auto [tree, target] = m_model->indexToDirTree(index);
+        if (target == DirModel::IndexTarget::INVALID)
+            continue;
+        requests.push_back({tree, target == DirModel::IndexTarget::FILES});
+    }
+    if (requests.empty())
+        return;
+    QString title;
+    if (requests.size() == 1) {
+        fullPath(title, requests.front().tree);
+        if (requests.front().files)
+            title = QStringLiteral("Files in %1").arg(title);
+    }
+    else {
+        title = QStringLiteral("%1 selected rows").arg(requests.size());
+    }
+    m_chartCalculator.aggregate(requests).then(this, [this, title](
+            ChartCalculatorService::Aggregate aggregate) {
+        emit aggregateDone(title, aggregate);
+    });
+}
+
+void Controller::onAggregatePatternAction()
+{
+    if (m_model->rowCount() == 0)
+        return;
+    bool ok = false;
+    QString pattern = QInputDialog::getText(nullptr, "Aggregate by Pattern",
+                                            "Directories whose paths below the root match, "
+                                            "with * also matching '/', e.g. */node_modules:",
+                                            QLineEdit::Normal, m_aggregatePattern, &ok);
+    if (!ok || pattern.isEmpty())
+        return;
+    m_aggregatePattern = pattern;
+    DirTree *root = m_model->indexToDirTree(m_model->index(0, 0)).first;
+    m_chartCalculator.aggregate(root, pattern).then(this, [this, pattern](
+            ChartCalculatorService::Aggregate aggregate) {
+        emit aggregateDone(QStringLiteral("Directories matching %1").arg(pattern), aggregate);
+    });
+}
+
+void Controller::onExcludeToggled(QModelIndexList indexes, bool excluded)
+{
+    m_model->setExcluded(indexes, excluded);
+}
+
+void Controller::onClearExclusionsAction()
+{
+    m_model->clearExcluded();
+}
@@ -14,9 +14,12 @@
 #include <functional>
 #include "dirmodel.h"
 #include "chartcalculatorservice.h"
+#include "chartpercentiles.h"
+#include "chartscheduler.h"
 #include "scannerservice.h"
 #include "searchservice.h"
 #include "savereportservice.h"
+#include "groupbyservice.h"
 
 class Controller final : public QObject
 {
@@ -33,6 +36,10 @@ signals:
     void searchDone(int numResults);
     void searchNeedsExpanding(QModelIndex index);
     void cancelReport();
+    void breakdownDone(QString title, GroupByService::Result result);
+    //! Full paths of the files, with an empty path for those not found any more.
+    void topFilesDone(QString title, QList<QPair<QString, DirTree::TopFile>> files);
+    void aggregateDone(QString title, ChartCalculatorService::Aggregate aggregate);
 
 public slots:
     void onOpenDirAction();
@@ -41,17 +48,49 @@ public slots:
     void onTreeExpanded(QModelIndex index);
     void onOpenFromViewAction(QModelIndex index);
     void onOpenFromViewInFMAction(QModelIndex index);
+    void onExpandSummaryAction(QModelIndex index);
     void onSearch(QString string, SearchService::Mode mode);
     void onProxyOrderChanged(QAbstractProxyModel *proxy);
     void onNextSearchResult(QModelIndex from, ModelIndexConsumer scrollFunc);
     void onPreviousSearchResult(QModelIndex from, ModelIndexConsumer scrollFunc);
     void onSaveReportAction();
+    void onSketchModeToggled(bool enabled);
+    void onSpillToDiskToggled(bool enabled);
+    void onMemoryBudgetAction();
+    void onIndexThresholdAction();
+    void onTaskStatsAction();
+    void onTimeBasisChosen(DirTree::TimeBasis basis);
+    void onWhiskersChosen(ChartPercentiles::Whiskers whiskers);
+    //! Compute the statistics of the metric along with the charts of the whole tree.
+    void onMetricToggled(ChartStore::Metric metric, bool enabled);
+    void onRecordAllTimesToggled(bool enabled);
+    void onRecordAttributeToggled(DirTree::Dimension dimension, bool enabled);
+    void onBreakdownAction(QModelIndex index, DirTree::Dimension dimension);
+    void onTrackTopFilesToggled(bool enabled);
+    void onTopFilesAction(QModelIndex index, DirTree::TopKind kind);
+    void onHeatmapsToggled(bool enabled);
+    //! Chart and totals of the selected rows together, each file counted once.
+    void onAggregateAction(QModelIndexList indexes);
+    //! Ask for a wildcard pattern and aggregate the directories whose paths match it.
+    void onAggregatePatternAction();
+    //! Mark the rows as to be deleted, or take the marks back, see DirModel::setExcluded().
+    void onExcludeToggled(QModelIndexList indexes, bool excluded);
+    void onClearExclusionsAction();
+    //! Rows painted without a chart, whose charts are calculated first.
+    void onRowsPainted(QModelIndexList indexes);
+    void onViewportChanged();
+    void onTreeCollapsed(QModelIndex index);
 
 private slots:
     void onDirChosen(QString dir);
     void onRequestCalculation(QModelIndex index);
 
 private:
+    void scan(QString dir, std::function<void(DirTree*)> done);
+    //! Sort and index the tree, and calculate all its charts for the model.
+    void prepare(DirTree *tree);
+    //! Cancel everything that reads the tree. Wait for the readers if it changes in place.
+    void stopReaders(bool wait);
     void clearSearchResults();
     QModelIndex findInSearchResults(const QModelIndex &from, bool backwards);
 
@@ -59,14 +98,20 @@ private:
     DirModel*               m_model;
     QAbstractProxyModel*    m_proxyModel;
     ChartCalculatorService  m_chartCalculator;
+    ChartScheduler          m_chartScheduler;
     ScannerService          m_scanner;
+    ScannerService::Options m_scanOptions;
+    int                     m_metrics = 0;  // Of ChartStore, computed by prepare().
     SaveReportService       m_reportService;
+    GroupByService          m_groupBy;
 
     SearchService           m_search;
     QSet<QModelIndex>       m_searchResultsProxied;
     QSet<QModelIndex>       m_searchResultsSource;
+    std::vector<quint32>    m_searchResultIds;  // Pre-order numbers, sorted.
     QFuture<void>           m_searchFuture;
     QString                 m_searchString;
+    QString                 m_aggregatePattern;
 };
 
 #endif // CONTROLLER_H
@@ -8,11 +8,15 @@
  */
 
 #include "dirmodel.h"
+#include "treereclaimer.h"
 #include <QDateTime>
+#include <QFont>
 #include <QPair>
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
-static QString displayFileSize(qint64 sizeInBytes)
+QString DirModel::displayFileSize(qint64 sizeInBytes)
 {
     static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
     constexpr int cntUnits = sizeof(units) / sizeof(units[0]);
@@ -25,7 +29,7 @@ static QString displayFileSize(qint64 sizeInBytes)
     return QStringLiteral("%1 %2").arg(size, 0, 'f', 1).arg(units[divisor]);
 }
 
-static QString fuzzyDuration(qint64 timestamp, const QDateTime &current)
+QString DirModel::fuzzyDuration(qint64 timestamp, const QDateTime &current)
 {
     QDateTime dt1 = QDateTime::fromSecsSinceEpoch(timestamp);
     qint64 seconds = dt1.secsTo(current);
@@ -64,14 +68,17 @@ DirModel::DirModel(QObject *parent)
     : QAbstractItemModel(parent)
 {
     m_tree = nullptr;
+    m_version = 0;
     m_chartsMin = HIGH;
     m_chartsMax = LOW;
     m_resetTime = QDateTime::currentDateTime();
+    m_whatIfReference = 0;
+    clearOtherCharts();
 }
 
 DirModel::~DirModel()
 {
-    delete m_tree;
+    TreeReclaimer::retire(m_tree);
 }
 
 static void dumptree(DirTree *d, int level=0)
@@ -88,32 +95,467 @@ void DirModel::reset(DirTree *newTree)
     beginResetModel();
     m_chartsMin = HIGH;
     m_chartsMax = LOW;
-    if (m_tree) delete m_tree;
+    // Calculations started on the old tree may still be reading it.
+    TreeReclaimer::retire(m_tree);
     m_tree = newTree;
+    ++m_version;
     //dumptree(m_tree);
     m_resetTime = QDateTime::currentDateTime();
     m_charts.clear();
-    m_charts.squeeze();
+    m_store.reset();
+    clearOtherCharts();
+    m_excludedSubtrees.clear();
+    m_excludedFiles.clear();
+    m_whatIf.clear();
+    if (m_tree != nullptr) {
+        // Scale to the approximate chart of the whole tree until exact charts arrive.
+        AgeChart approx = m_tree->approximateChart(false);
+        if (approx.valid()) {
+            m_chartsMin = approx.lowerWhisker;
+            m_chartsMax = approx.upperWhisker;
+        }
+    }
     endResetModel();
 }
 
-void DirModel::calculated(QModelIndex index, AgeChart chart)
+void DirModel::graft(DirTree *collapsed, DirTree *rescanned)
+{
+    emit layoutAboutToBeChanged();
+    // The charts of the files row and of the ancestors were estimated from the summary.
+    m_charts.remove(collapsed->preorder(), true);
+    for (DirTree *t = collapsed; t != nullptr; t = t->parent()) {
+        m_charts.remove(t->preorder(), false);
+    }
+    // Rows below the summary only had files, which move behind the new subdirectories.
+    collapsed->graft(rescanned);
+    // The directories after it are numbered anew, behind those grafted.
+    m_charts.insertNodes(rescanned->preorder(),
+                         rescanned->subtreeEnd() - rescanned->preorder() - 1);
+    ++m_version;
+    QModelIndexList persistent = persistentIndexList();
+    for (const QModelIndex &i : persistent) {
+        if (i.internalPointer() != collapsed)
+            continue;
+        if (rescanned->numFiles() > 0)
+            changePersistentIndex(i, createIndex(rescanned->numChildren(), i.column(),
+                                                 rescanned));
+        else
+            changePersistentIndex(i, QModelIndex());
+    }
+    if (m_excludedSubtrees.remove(collapsed))
+        m_excludedSubtrees.insert(rescanned);
+    if (m_excludedFiles.remove(collapsed))
+        m_excludedFiles.insert(rescanned);
+    // Readers of the summary hold it until they notice.
+    TreeReclaimer::retire(collapsed);
+    m_store.reset();
+    clearOtherCharts();
+    // Sizes and histograms of the ancestors changed.
+    rebuildWhatIf();
+    emit layoutChanged();
+}
+
+void DirModel::clearOtherCharts()
+{
+    for (ChartCache &c : m_otherCharts) {
+        c.min = HIGH;
+        c.max = LOW;
+        c.charts.clear();
+    }
+}
+
+QModelIndex DirModel::rowIndex(DirTree *tree, bool files) const
+{
+    return files ? createIndex(tree->numChildren(), 0, tree) : dirTreeToIndex(tree);
+}
+
+QModelIndexList DirModel::rowIndexes(const RowCharts &charts) const
+{
+    QModelIndexList ret;
+    if (m_tree == nullptr)
+        return ret;
+    std::span<DirTree* const> nodes = m_tree->subtreeNodes();
+    charts.forEach([&](quint32 node, bool files, const AgeChart&) {
+        ret.append(rowIndex(nodes[node], files));
+    });
+    return ret;
+}
+
+DirTree::TimeBasis DirModel::timeBasis() const
 {
-    if (chart.valid()) {
-        m_charts[index.siblingAtColumn(0)] = chart;
-        if (m_chartsMin > chart.lowerWhisker) {
-            m_chartsMin = chart.lowerWhisker;
+    return m_tree != nullptr ? m_tree->timeBasis() : DirTree::MTIME;
+}
+
+QModelIndexList DirModel::setTimeBasis(DirTree::TimeBasis basis)
+{
+    QModelIndexList missing;
+    DirTree::TimeBasis old = timeBasis();
+    if (m_tree == nullptr || basis == old)
+        return missing;
+    emit layoutAboutToBeChanged();
+    if (!m_tree->setTimeBasis(basis)) {
+        emit layoutChanged();
+        return missing;
+    }
+    m_store.reset();
+    ChartCache &stash = m_otherCharts[old];
+    ChartCache &restore = m_otherCharts[basis];
+    std::span<DirTree* const> nodes = m_tree->subtreeNodes();
+    m_charts.forEach([&](quint32 node, bool files, const AgeChart&) {
+        if (!restore.charts.contains(node, files))
+            missing.append(rowIndex(nodes[node], files));
+    });
+    stash.min = m_chartsMin;
+    stash.max = m_chartsMax;
+    stash.charts.swap(m_charts);
+    m_charts.swap(restore.charts);
+    m_chartsMin = restore.min;
+    m_chartsMax = restore.max;
+    restore.charts.clear();
+    if (m_charts.isEmpty()) {
+        AgeChart approx = m_tree->approximateChart(false);
+        if (approx.valid()) {
+            m_chartsMin = approx.lowerWhisker;
+            m_chartsMax = approx.upperWhisker;
         }
-        if (m_chartsMax < chart.upperWhisker) {
-            m_chartsMax = chart.upperWhisker;
+    }
+    rebuildWhatIf();
+    emit layoutChanged();
+    emit headerDataChanged(Qt::Horizontal, C_MEDIAN_AGE, C_AGE);
+    return missing;
+}
+
+QModelIndexList DirModel::resetCharts()
+{
+    QModelIndexList missing = rowIndexes(m_charts);
+    emit layoutAboutToBeChanged();
+    ++m_version;
+    m_chartsMin = HIGH;
+    m_chartsMax = LOW;
+    m_charts.clear();
+    m_store.reset();
+    clearOtherCharts();
+    if (m_tree != nullptr) {
+        AgeChart approx = m_tree->approximateChart(false);
+        if (approx.valid()) {
+            m_chartsMin = approx.lowerWhisker;
+            m_chartsMax = approx.upperWhisker;
         }
+    }
+    rebuildWhatIf();
+    emit layoutChanged();
+    emit headerDataChanged(Qt::Horizontal, C_MEDIAN_AGE, C_AGE);
+    return missing;
+}
+
+void DirModel::setExcluded(const QModelIndexList &indexes, bool excluded)
+{
+    if (m_tree == nullptr)
+        return;
+    if (m_whatIf.isEmpty()) {
+        // Stored histograms are only added whole if the reference is theirs.
+        const AgeHistogram *stored = m_tree->subtreeHistogram();
+        m_whatIfReference = (stored != nullptr) ? stored->reference()
+                                                : QDateTime::currentSecsSinceEpoch();
+    }
+    QSet<QModelIndex> changed;
+    for (const QModelIndex &index : indexes) {
+        auto [tree, target] = indexToDirTree(index);
+        if (target == IndexTarget::INVALID)
+            continue;
+        const bool files = (target == IndexTarget::FILES);
+        QSet<DirTree*> &marks = files ? m_excludedFiles : m_excludedSubtrees;
+        if (marks.contains(tree) == excluded)
+            continue;
+        if (excluded)
+            marks.insert(tree);
+        else
+            marks.remove(tree);
+        changed.insert(index.siblingAtColumn(0));
+        for (const QModelIndex &i : applyExclusion(tree, files, excluded)) {
+            changed.insert(i);
+        }
+    }
+    for (const QModelIndex &i : std::as_const(changed)) {
+        emit dataChanged(i, i.siblingAtColumn(C_SENTINEL - 1));
+    }
+}
+
+bool DirModel::isExcluded(const QModelIndex &index) const
+{
+    if (!hasExcluded())
+        return false;
+    auto [tree, target] = indexToDirTree(index);
+    switch (target) {
+    case IndexTarget::ITSELF:
+        return m_excludedSubtrees.contains(tree);
+    case IndexTarget::FILES:
+        return m_excludedFiles.contains(tree);
+    default:
+        return false;
+    }
+}
+
+void DirModel::clearExcluded()
+{
+    if (!hasExcluded())
+        return;
+    QModelIndexList indexes;
+    for (DirTree *tree : std::as_const(m_excludedSubtrees)) {
+        indexes.append(dirTreeToIndex(tree));
+    }
+    for (DirTree *tree : std::as_const(m_excludedFiles)) {
+        indexes.append(createIndex(tree->numChildren(), 0, tree));
+    }
+    setExcluded(indexes, false);
+    m_whatIf.clear();
+}
+
+qint64 DirModel::excludedSize() const
+{
+    auto i = m_whatIf.constFind(m_tree);
+    qint64 size = (i != m_whatIf.cend()) ? i->size : 0;
+    // The root's own row is not below it.
+    return m_excludedSubtrees.contains(m_tree) ? m_tree->subtreeSize() : size;
+}
+
+QModelIndexList DirModel::applyExclusion(DirTree *tree, bool files, bool excluded)
+{
+    // What the directories above miss: the files, or the subtree without what is missing
+    // from it already.
+    AgeHistogram delta(m_whatIfReference);
+    tree->addToHistogram(delta, files);
+    qint64 size = files ? tree->filesSize() : tree->subtreeSize();
+    if (!files) {
+        auto i = m_whatIf.constFind(tree);
+        if (i != m_whatIf.cend()) {
+            delta.subtract(i->histogram);
+            size -= i->size;
+        }
+    }
+    QModelIndexList changed;
+    for (DirTree *a = files ? tree : tree->parent(); a != nullptr; a = a->parent()) {
+        auto i = m_whatIf.find(a);
+        if (i == m_whatIf.end())
+            i = m_whatIf.insert(a, WhatIf{0, AgeHistogram(m_whatIfReference), AgeChart()});
+        if (excluded) {
+            i->histogram.add(delta);
+            i->size += size;
+        }
+        else {
+            i->histogram.subtract(delta);
+            i->size -= size;
+        }
+        if (i->size <= 0 && !excluded) {
+            m_whatIf.erase(i);
+        }
+        else if (i->size < a->subtreeSize()) {
+            AgeHistogram left(m_whatIfReference);
+            a->addToHistogram(left, false);
+            left.subtract(i->histogram);
+            i->chart = left.chart();
+        }
+        else {
+            i->chart = AgeChart();
+        }
+        changed.append(dirTreeToIndex(a));
+        if (m_excludedSubtrees.contains(a))
+            break;
+    }
+    return changed;
+}
+
+void DirModel::rebuildWhatIf()
+{
+    m_whatIf.clear();
+    if (m_tree == nullptr || !hasExcluded())
+        return;
+    const AgeHistogram *stored = m_tree->subtreeHistogram();
+    m_whatIfReference = (stored != nullptr) ? stored->reference()
+                                            : QDateTime::currentSecsSinceEpoch();
+    // Marked again one by one, since a mark applied before its subtree's counts above it.
+    QSet<DirTree*> subtrees;
+    QSet<DirTree*> files;
+    subtrees.swap(m_excludedSubtrees);
+    files.swap(m_excludedFiles);
+    for (DirTree *tree : std::as_const(subtrees)) {
+        m_excludedSubtrees.insert(tree);
+        applyExclusion(tree, false, true);
+    }
+    for (DirTree *tree : std::as_const(files)) {
+        m_excludedFiles.insert(tree);
+        applyExclusion(tree, true, true);
+    }
+}
+
+const DirModel::WhatIf *DirModel::whatIf(const QModelIndex &index) const
+{
+    if (m_whatIf.isEmpty())
+        return nullptr;
+    auto [tree, target] = indexToDirTree(index);
+    if (target != IndexTarget::ITSELF)
+        return nullptr;
+    auto i = m_whatIf.constFind(tree);
+    return (i != m_whatIf.cend()) ? &*i : nullptr;
+}
+
+void DirModel::calculated(QModelIndex index, AgeChart chart, DirTree::TimeBasis basis)
+{
+    if (keepChart(index, chart, basis))
         emit dataChanged(index.siblingAtColumn(0), index.siblingAtColumn(C_SENTINEL - 1));
+}
+
+void DirModel::calculated(std::span<const QModelIndex> indexes, std::span<const AgeChart> charts,
+                          DirTree::TimeBasis basis)
+{
+    Q_ASSERT(indexes.size() == charts.size());
+    // Rows from first to last of one parent, all changed or in between.
+    QModelIndex first;
+    QModelIndex last;
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        const QModelIndex &index = indexes[i];
+        if (!keepChart(index, charts[i], basis))
+            continue;
+        if (first.isValid() && index.parent() == first.parent()) {
+            if (index.row() < first.row())
+                first = index;
+            if (index.row() > last.row())
+                last = index;
+            continue;
+        }
+        if (first.isValid())
+            emit dataChanged(first.siblingAtColumn(0), last.siblingAtColumn(C_SENTINEL - 1));
+        first = index;
+        last = index;
+    }
+    if (first.isValid())
+        emit dataChanged(first.siblingAtColumn(0), last.siblingAtColumn(C_SENTINEL - 1));
+}
+
+bool DirModel::keepChart(const QModelIndex &index, const AgeChart &chart,
+                         DirTree::TimeBasis basis)
+{
+    if (!chart.valid())
+        return false;
+    auto [tree, target] = indexToDirTree(index);
+    if (target == IndexTarget::INVALID)
+        return false;
+    const bool files = (target == IndexTarget::FILES);
+    if (basis != timeBasis()) {
+        // Finished after a switch; keep it for switching back.
+        ChartCache &c = m_otherCharts[basis];
+        c.charts.insert(tree->preorder(), files, chart);
+        c.min = std::min(c.min, chart.lowerWhisker);
+        c.max = std::max(c.max, chart.upperWhisker);
+        return false;
+    }
+    m_charts.insert(tree->preorder(), files, chart);
+    if (m_chartsMin > chart.lowerWhisker) {
+        m_chartsMin = chart.lowerWhisker;
+    }
+    if (m_chartsMax < chart.upperWhisker) {
+        m_chartsMax = chart.upperWhisker;
     }
+    return true;
 }
 
 bool DirModel::isChartCached(QModelIndex index)
 {
-    return m_charts.contains(index);
+    auto [tree, target] = indexToDirTree(index);
+    if (target == IndexTarget::INVALID)
+        return false;
+    if (m_store != nullptr && m_store->covers(tree))
+        return true;
+    return m_charts.contains(tree->preorder(), target == IndexTarget::FILES);
+}
+
+void DirModel::setChartStore(ChartStorePtr store)
+{
+    if (store == nullptr || m_tree == nullptr || store->timeBasis() != timeBasis() ||
+            !store->covers(m_tree))
+        return;
+    emit layoutAboutToBeChanged();
+    m_store = std::move(store);
+    m_charts.clear();
+    m_chartsMin = std::min(m_chartsMin, m_store->lowestWhisker());
+    m_chartsMax = std::max(m_chartsMax, m_store->highestWhisker());
+    // Sorting by age changes with the exact charts.
+    emit layoutChanged();
+}
+
+const AgeChart *DirModel::cachedChart(const QModelIndex &index) const
+{
+    auto [tree, target] = indexToDirTree(index);
+    if (target == IndexTarget::INVALID)
+        return nullptr;
+    if (m_store != nullptr && m_store->covers(tree)) {
+        const AgeChart &chart = (target == IndexTarget::FILES) ? m_store->files(tree)
+                                                              : m_store->subtree(tree);
+        return chart.valid() ? &chart : nullptr;
+    }
+    return m_charts.find(tree->preorder(), target == IndexTarget::FILES);
+}
+
+const ChartStore::Stats *DirModel::cachedStats(const QModelIndex &index,
+                                               ChartStore::Metric metric) const
+{
+    if (m_store == nullptr)
+        return nullptr;
+    auto [tree, target] = indexToDirTree(index);
+    if (target == IndexTarget::INVALID || !m_store->covers(tree))
+        return nullptr;
+    const ChartStore::Stats *stats = (target == IndexTarget::FILES) ? m_store->filesStats(tree)
+                                                                    : m_store->subtreeStats(tree);
+    return (stats != nullptr && (stats->known & metric)) ? stats : nullptr;
+}
+
+QVariant DirModel::statsData(const QModelIndex &index, bool forSorting) const
+{
+    switch (index.column()) {
+    case C_COUNT_MEDIAN_AGE: {
+        const ChartStore::Stats *stats = cachedStats(index, ChartStore::M_COUNT_PERCENTILES);
+        if (stats == nullptr)
+            return forSorting ? QVariant(HIGH) : QVariant();
+        qint64 median = stats->countPercentiles[1];
+        return forSorting ? QVariant(median) : QVariant(fuzzyDuration(median, m_resetTime));
+    }
+    case C_MEAN_AGE: {
+        const ChartStore::Stats *stats = cachedStats(index, ChartStore::M_AGE_MOMENTS);
+        if (stats == nullptr || stats->count == 0)
+            return forSorting ? QVariant(HIGH) : QVariant();
+        qint64 mean = std::llround(stats->meanTime);
+        return forSorting ? QVariant(mean) : QVariant(fuzzyDuration(mean, m_resetTime));
+    }
+    case C_AGE_STDDEV: {
+        const ChartStore::Stats *stats = cachedStats(index, ChartStore::M_AGE_MOMENTS);
+        if (stats == nullptr || stats->count == 0)
+            return forSorting ? QVariant(-1.0) : QVariant();
+        if (forSorting)
+            return QVariant(stats->stddevTime());
+        // As the age of a file that much older than now.
+        qint64 spread = std::llround(stats->stddevTime());
+        return QVariant(fuzzyDuration(m_resetTime.toSecsSinceEpoch() - spread, m_resetTime));
+    }
+    case C_SMALL_FILES: {
+        const ChartStore::Stats *stats = cachedStats(index, ChartStore::M_SMALL_FILES);
+        if (stats == nullptr)
+            return forSorting ? QVariant(qint64(-1)) : QVariant();
+        if (forSorting)
+            return QVariant(static_cast<qint64>(stats->smallFiles[0]));
+        QStringList counts;
+        for (quint64 count : stats->smallFiles) {
+            counts.append(QString::number(count));
+        }
+        return QVariant(counts.join(QStringLiteral(" / ")));
+    }
+    default:
+        return QVariant();
+    }
+}
+
+QVariant DirModel::heatmapData(const std::optional<SizeAgeHeatmap> &heatmap)
+{
+    return heatmap.has_value() ? QVariant::fromValue(*heatmap) : QVariant();
 }
 
 //! Returns pointer to the struct in the tree. The logic is such that the internal pointer
@@ -162,9 +604,45 @@ QVariant DirModel::headerData(int section, Qt::Orientation orientation, int role
         case C_SIZE:
             return QVariant("Size");
         case C_MEDIAN_AGE:
-            return QVariant("Median Age");
         case C_AGE:
-            return QVariant("Age");
+        case C_COUNT_MEDIAN_AGE:
+        case C_MEAN_AGE: {
+            QString title;
+            switch (section) {
+            case C_AGE: title = QStringLiteral("Age"); break;
+            case C_COUNT_MEDIAN_AGE: title = QStringLiteral("Median Age by Count"); break;
+            case C_MEAN_AGE: title = QStringLiteral("Mean Age"); break;
+            default: title = QStringLiteral("Median Age"); break;
+            }
+            if (timeBasis() != DirTree::MTIME)
+                title += QStringLiteral(" (%1)").arg(DirTree::timeBasisName(timeBasis()));
+            return QVariant(title);
+        }
+        case C_AGE_STDDEV:
+            return QVariant("Age Deviation");
+        case C_SMALL_FILES:
+            return QVariant("Small Files");
+        case C_HEATMAP:
+            return QStringLiteral("Size \u00d7 Age");
+        }
+    }
+    else if (role == Qt::ToolTipRole && orientation == Qt::Horizontal) {
+        switch (section) {
+        case C_COUNT_MEDIAN_AGE:
+            return QStringLiteral("Age of the file in the middle by time, counting files "
+                                  "instead of bytes.");
+        case C_AGE_STDDEV:
+            return QStringLiteral("Standard deviation of the ages of the files.");
+        case C_SMALL_FILES:
+            return QStringLiteral("Files smaller than %1, %2 and %3.")
+                    .arg(displayFileSize(ChartStore::SMALL_FILE_SIZES[0]),
+                         displayFileSize(ChartStore::SMALL_FILE_SIZES[1]),
+                         displayFileSize(ChartStore::SMALL_FILE_SIZES[2]));
+        case C_HEATMAP:
+            return QStringLiteral("Number of files by size, larger upwards, and by age, older "
+                                  "to the left, on log scales. Darker means more files.");
+        default:
+            return QVariant();
         }
     }
     return QVariant();
@@ -287,8 +765,10 @@ QVariant DirModel::data(const QModelIndex &index, int role) const
             default:
             case IndexTarget::INVALID:
                 return QVariant();
-            case IndexTarget::ITSELF:
-                return QVariant(p.first->subtreeSize());
+            case IndexTarget::ITSELF: {
+                const WhatIf *w = whatIf(index);
+                return QVariant(p.first->subtreeSize() - (w != nullptr ? w->size : 0));
+            }
             case IndexTarget::FILES:
                 return QVariant(p.first->filesSize());
             }
@@ -304,21 +784,74 @@ QVariant DirModel::data(const QModelIndex &index, int role) const
                 return data(index, R_SIZE);
             case C_MEDIAN_AGE:
             case C_AGE: {
-                auto i = m_charts.find(index.siblingAtColumn(0));
-                return i != m_charts.end() ? QVariant(i->median) : QVariant(HIGH);
+                const WhatIf *w = whatIf(index);
+                const AgeChart *chart = (w != nullptr) ? &w->chart : cachedChart(index);
+                return chart != nullptr && chart->valid() ? QVariant(chart->median)
+                                                          : QVariant(HIGH);
             }
+            case C_COUNT_MEDIAN_AGE:
+            case C_MEAN_AGE:
+            case C_AGE_STDDEV:
+            case C_SMALL_FILES:
+                return statsData(index, true);
             default:
                 return QVariant();
             }
         }
+        case R_COLLAPSED: {
+            auto p = indexToDirTree(index);
+            return QVariant(p.second == IndexTarget::ITSELF && p.first->isCollapsed());
+        }
+        case R_ERRORBOUND: {
+            const AgeChart *chart = cachedChart(index);
+            return chart != nullptr ? QVariant(chart->errorBound) : QVariant();
+        }
+        default:
+            return QVariant();
+        }
+    }
+    else if (role == Qt::ToolTipRole) {
+        switch (index.column()) {
+        case C_NAME:
+            if (data(index, R_COLLAPSED).toBool())
+                return QStringLiteral("Summarized to stay within the memory budget. "
+                                      "Use Expand Summary to scan its contents.");
+            if (isExcluded(index))
+                return QStringLiteral("Excluded from the sizes and ages above, to see what "
+                                      "deleting it would leave.");
+            return QVariant();
+        case C_MEDIAN_AGE:
+        case C_AGE: {
+            double errorBound = data(index, R_ERRORBOUND).toDouble();
+            if (errorBound > 0.0)
+                return QStringLiteral("Percentiles are within \u00b1%1% of the total size.")
+                        .arg(errorBound * 100.0, 0, 'f', 2);
+            return QVariant();
+        }
         default:
             return QVariant();
         }
     }
+    else if (role == Qt::FontRole) {
+        if (index.column() != C_NAME)
+            return QVariant();
+        const bool collapsed = data(index, R_COLLAPSED).toBool();
+        const bool excluded = isExcluded(index);
+        if (!collapsed && !excluded)
+            return QVariant();
+        QFont font;
+        font.setItalic(collapsed);
+        font.setStrikeOut(excluded);
+        return font;
+    }
     else if (role == Qt::TextAlignmentRole) {
         switch (index.column()) {
         case C_SIZE:
         case C_MEDIAN_AGE:
+        case C_COUNT_MEDIAN_AGE:
+        case C_MEAN_AGE:
+        case C_AGE_STDDEV:
+        case C_SMALL_FILES:
             return QVariant(int(Qt::AlignRight | Qt::AlignVCenter));
         default:
             return QVariant();
@@ -326,17 +859,29 @@ QVariant DirModel::data(const QModelIndex &index, int role) const
     }
     else if (role == Qt::DisplayRole) {
         auto p = indexToDirTree(index);
-        auto chartsLookupFuzzy = [this](const QModelIndex &index) {
-            auto i = m_charts.find(index.siblingAtColumn(0));
-            if (i != m_charts.end())
-                return QVariant(fuzzyDuration(i->median, m_resetTime));
+        // Until the exact chart is calculated, show the one estimated from histograms.
+        auto chartsLookup = [this, p](const QModelIndex &index) {
+            // What would be left after the exclusion, see setExcluded().
+            const WhatIf *w = whatIf(index);
+            if (w != nullptr)
+                return w->chart;
+            const AgeChart *chart = cachedChart(index);
+            if (chart != nullptr)
+                return *chart;
             else
+                return p.first->approximateChart(p.second == IndexTarget::FILES);
+        };
+        auto chartsLookupFuzzy = [this, chartsLookup](const QModelIndex &index) {
+            AgeChart chart = chartsLookup(index);
+            if (!chart.valid())
                 return QVariant();
+            QString fuzzy = fuzzyDuration(chart.median, m_resetTime);
+            return QVariant(chart.approximate ? QStringLiteral("~") + fuzzy : fuzzy);
         };
-        auto chartsLookupChart = [this](const QModelIndex &index) {
-            auto i = m_charts.find(index.siblingAtColumn(0));
-            if (i != m_charts.end())
-                return QVariant::fromValue(*i);
+        auto chartsLookupChart = [chartsLookup](const QModelIndex &index) {
+            AgeChart chart = chartsLookup(index);
+            if (chart.valid())
+                return QVariant::fromValue(chart);
             else
                 return QVariant();
         };
@@ -349,11 +894,18 @@ QVariant DirModel::data(const QModelIndex &index, int role) const
             case C_TYPE:
                 return QVariant(T_SUBDIR);
             case C_SIZE:
-                return QVariant(displayFileSize(p.first->subtreeSize()));
+                return QVariant(displayFileSize(data(index, R_SIZE).toLongLong()));
             case C_MEDIAN_AGE:
                 return chartsLookupFuzzy(index);
             case C_AGE:
                 return chartsLookupChart(index);
+            case C_COUNT_MEDIAN_AGE:
+            case C_MEAN_AGE:
+            case C_AGE_STDDEV:
+            case C_SMALL_FILES:
+                return statsData(index, false);
+            case C_HEATMAP:
+                return heatmapData(p.first->subtreeHeatmap());
             }
         }
         else if (p.second == IndexTarget::FILES) {
@@ -370,6 +922,13 @@ QVariant DirModel::data(const QModelIndex &index, int role) const
                 return chartsLookupFuzzy(index);
             case C_AGE:
                 return chartsLookupChart(index);
+            case C_COUNT_MEDIAN_AGE:
+            case C_MEAN_AGE:
+            case C_AGE_STDDEV:
+            case C_SMALL_FILES:
+                return statsData(index, false);
+            case C_HEATMAP:
+                return heatmapData(p.first->filesHeatmap());
             }
         }
         else {
@@ -12,25 +12,69 @@
 
 #include "dirtree.h"
 #include "agechart.h"
+#include "chartstore.h"
+#include "rowcharts.h"
 
 #include <QAbstractItemModel>
 #include <QFutureWatcher>
 #include <QHash>
+#include <QSet>
+#include <array>
+#include <span>
 
 class DirModel final : public QAbstractItemModel
 {
     Q_OBJECT
 
 public:
-    enum Columns { C_NAME, C_TYPE, C_SIZE, C_MEDIAN_AGE, C_AGE, C_SENTINEL };
+    //! Columns from C_COUNT_MEDIAN_AGE on show the statistics of the chart store, if computed,
+    //! and C_HEATMAP the SizeAgeHeatmap of the row, if the scan built them.
+    enum Columns { C_NAME, C_TYPE, C_SIZE, C_MEDIAN_AGE, C_AGE, C_COUNT_MEDIAN_AGE, C_MEAN_AGE,
+                   C_AGE_STDDEV, C_SMALL_FILES, C_HEATMAP, C_SENTINEL };
     enum Types { T_SUBDIR, T_FILE, T_SENTINEL };
-    enum UserRoles { R_TOTALSIZE = Qt::UserRole+1, R_MINAGE, R_MAXAGE, R_SIZE, R_SORT, R_SENTINEL };
+    enum UserRoles { R_TOTALSIZE = Qt::UserRole+1, R_MINAGE, R_MAXAGE, R_SIZE, R_SORT, R_ERRORBOUND,
+                     R_COLLAPSED, R_SENTINEL };
 
     explicit DirModel(QObject *parent = nullptr);
     ~DirModel();
     void reset(DirTree *newTree);
-    void calculated(QModelIndex index, AgeChart chart);
+    //! Replace the collapsed directory with its rescan and retire the summary. The ancestors
+    //! change in place, so no reader may hold the tree, see TreeReclaimer::whenUnpinned().
+    void graft(DirTree *collapsed, DirTree *rescanned);
+    void calculated(QModelIndex index, AgeChart chart, DirTree::TimeBasis basis);
+    //! Charts calculated together, usually for siblings. Each run of siblings is announced as
+    //! one change instead of one per row.
+    void calculated(std::span<const QModelIndex> indexes, std::span<const AgeChart> charts,
+                    DirTree::TimeBasis basis);
+    //! Changes whenever indexes of the previous tree stop being valid, on reset() and graft(),
+    //! and when charts calculated before do, on resetCharts().
+    quint64 version() const
+    { return m_version; }
     bool isChartCached(QModelIndex index);
+    //! Use the charts of the whole tree. Ignored if they are of another time basis.
+    void setChartStore(ChartStorePtr store);
+    ChartStorePtr chartStore() const
+    { return m_store; }
+    DirTree::TimeBasis timeBasis() const;
+    //! Switch the tree to another recorded time, see DirTree::setTimeBasis(). Charts of the
+    //! previous time are kept for switching back. Returns the indexes that had a chart before
+    //! but have none for the new time.
+    QModelIndexList setTimeBasis(DirTree::TimeBasis basis);
+    //! Drop all charts, of every time, after the percentiles changed. Returns the indexes
+    //! that had a chart.
+    QModelIndexList resetCharts();
+
+    //! What-if exclusion: mark rows as to be deleted. Sizes and charts of the directories above
+    //! show what would be left, estimated from histograms. Only the directories on the path
+    //! to the root are updated, from their stored histograms. Marks are kept across time
+    //! switches and grafts, and dropped on reset().
+    void setExcluded(const QModelIndexList &indexes, bool excluded);
+    bool isExcluded(const QModelIndex &index) const;
+    bool hasExcluded() const
+    { return !m_excludedSubtrees.isEmpty() || !m_excludedFiles.isEmpty(); }
+    void clearExcluded();
+    //! Size of the files marked, each counted once.
+    qint64 excludedSize() const;
 
     enum class IndexTarget { INVALID, ITSELF, FILES };
     QPair<DirTree*, IndexTarget> indexToDirTree(QModelIndex index) const;
@@ -46,12 +90,63 @@ public:
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
+    static QString displayFileSize(qint64 sizeInBytes);
+    //! Age of the timestamp, in the largest units that fit.
+    static QString fuzzyDuration(qint64 timestamp, const QDateTime &current);
+
 private:
+    struct ChartCache
+    {
+        qint64                          min;
+        qint64                          max;
+        RowCharts                       charts;
+    };
+
     DirTree*                        m_tree;
+    quint64                         m_version;
     qint64                          m_chartsMin;
     qint64                          m_chartsMax;
     QDateTime                       m_resetTime;
-    QHash<QModelIndex, AgeChart>    m_charts;
+    RowCharts                       m_charts;
+    ChartStorePtr                   m_store;  // Preferred over m_charts.
+    //! Charts of the time bases that are not shown.
+    std::array<ChartCache, DirTree::NUM_TIME_BASES> m_otherCharts;
+
+    //! Files excluded from a subtree, and what is left of its chart.
+    struct WhatIf
+    {
+        qint64          size = 0;
+        AgeHistogram    histogram{0};
+        AgeChart        chart;
+    };
+
+    QSet<DirTree*>                  m_excludedSubtrees;
+    QSet<DirTree*>                  m_excludedFiles;  // Of the [Files] rows.
+    QHash<DirTree*, WhatIf>         m_whatIf;  // Of the directories with files excluded below.
+    qint64                          m_whatIfReference;  // Of the histograms in m_whatIf.
+
+    void clearOtherCharts();
+    //! Row of the directory, or of its [Files] row.
+    QModelIndex rowIndex(DirTree *tree, bool files) const;
+    //! Rows of the charts, by the pre-order numbers of the directories.
+    QModelIndexList rowIndexes(const RowCharts &charts) const;
+    //! Keep a calculated chart. Returns whether it is of the time shown.
+    bool keepChart(const QModelIndex &index, const AgeChart &chart, DirTree::TimeBasis basis);
+    //! Exact or estimated chart calculated for the row, or null.
+    const AgeChart *cachedChart(const QModelIndex &index) const;
+    //! Statistics of the row with the metric, or null.
+    const ChartStore::Stats *cachedStats(const QModelIndex &index, ChartStore::Metric metric) const;
+    //! Value of a statistics column, for display or sorting.
+    QVariant statsData(const QModelIndex &index, bool forSorting) const;
+    //! Copy of the heatmap for the delegate, or nothing if the scan built none.
+    static QVariant heatmapData(const std::optional<SizeAgeHeatmap> &heatmap);
+    //! Add or take back a mark, on the directories from the row up to the first subtree marked.
+    //! Those above it already miss the whole subtree. Returns the rows changed.
+    QModelIndexList applyExclusion(DirTree *tree, bool files, bool excluded);
+    //! Apply all marks anew, after the histograms or percentiles changed.
+    void rebuildWhatIf();
+    //! Files excluded from the row's subtree, or null.
+    const WhatIf *whatIf(const QModelIndex &index) const;
 };
 
 
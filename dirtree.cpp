@@ -9,30 +9,43 @@
 
 #include "dirtree.h"
 #include <algorithm>
-#include <mutex>
-#include <boost/pool/pool_alloc.hpp>
+#include <bit>
+#include <limits>
 
 constexpr size_t DIRTREE_INITIAL_FILE_VECTOR = 1024;
 constexpr size_t DIRTREE_INITIAL_SUBS_VECTOR = 1024;
+constexpr size_t DIRTREE_RADIX_SORT_MIN = 4096;
+constexpr size_t DIRTREE_PREFIX_SUMS_MIN = 64;
+// Directories with fewer files beside subdirectories count their files' heatmap when asked.
+constexpr size_t DIRTREE_FILES_HEATMAP_MIN = 1024;
+// Spilled runs at least this large are prefetched before a merge reads them.
+constexpr size_t DIRTREE_PREFETCH_MIN_BYTES = 16384;
 
-boost::pool_allocator<DirTree::iterator> g_iterAllocator;
-
-static DirTree::iterator *allocateIterators(size_t n)
-{
-    return g_iterAllocator.allocate(n);
-}
-
-static void freeIterators(DirTree::iterator *iterators, size_t n)
-{
-    return g_iterAllocator.deallocate(iterators, n);
-}
+// Merge buffers are recycled per thread, so concurrent calculations never share an allocator.
+static thread_local std::vector<DirTree::iterator::Run> t_spareRuns;
+static thread_local std::vector<quint32> t_spareLosers;
 
 DirTree::DirTree() noexcept
 {
     m_parent = nullptr;
     m_parentPos = 0;
+    m_preorder = 0;
+    m_subtreeEnd = 0;
+    m_heatmapReference = 0;
     m_subtreeSize = 0;
     m_filesSize = 0;
+    m_subtreeFiles = 0;
+    m_spilled = nullptr;
+    m_numSpilled = 0;
+    m_collapsed = false;
+    m_hasCollapsed = false;
+    m_timeBasis = MTIME;
+    m_timeBases = 1 << MTIME;
+    m_dimensions = 0;
+    m_sortState = SORTED;
+    m_index = nullptr;
+    m_prefixSums = nullptr;
+    m_indexedFiles = 0;
 }
 
 DirTree::~DirTree()
@@ -40,25 +53,46 @@ DirTree::~DirTree()
     for (DirTree *ch : m_subdirs) {
         delete ch;
     }
+    delete m_index.load();
+    delete m_prefixSums.load();
 }
 
 void DirTree::append(file_size_t size, file_time_t time)
 {
-    if (m_files.size() == 0)
-        m_files.reserve(DIRTREE_INITIAL_FILE_VECTOR);
-    if (m_files.size() > 0 && m_files.back().time == time)
-        m_files.back().size += size;
-    else
+    if (m_filesSketch != nullptr) {
+        m_filesSketch->add(time, size);
+    }
+    else {
+        // One entry per file, so that queries can count them.
+        if (m_files.size() == 0)
+            m_files.reserve(DIRTREE_INITIAL_FILE_VECTOR);
         m_files.push_back(FileInfo{.size = size, .time = time});
+    }
 
     DirTree* p = this;
     p->m_filesSize += size;
     while (p != nullptr) {
         p->m_subtreeSize += size;
+        p->m_subtreeFiles += 1;
         p = p->m_parent;
     }
 }
 
+void DirTree::append(file_size_t size, const FileTimes &times, const Attributes &attributes)
+{
+    if (m_columns != nullptr && m_filesSketch == nullptr) {
+        for (int b = 0; b < NUM_TIME_BASES; ++b) {
+            if (b != m_timeBasis && (m_timeBases & (1 << b)) != 0)
+                m_columns->times[b].push_back(times[b]);
+        }
+        for (int d = 0; d < Columns::NUM_DIMENSIONS; ++d) {
+            if ((m_dimensions & (1 << d)) != 0)
+                m_columns->attributes[d].push_back(attributes[d]);
+        }
+    }
+    append(size, times[m_timeBasis]);
+}
+
 void DirTree::append(DirTree *subdir)
 {
     if (m_subdirs.size() == 0) {
@@ -72,61 +106,1344 @@ void DirTree::append(DirTree *subdir)
     DirTree *p = this;
     while (p != nullptr) {
         p->m_subtreeSize += b->subtreeSize();
+        p->m_subtreeFiles += b->numSubtreeFiles();
+        p->m_hasCollapsed |= b->hasCollapsed();
         p = p->m_parent;
     }
 }
 
-void DirTree::finalize()
+void DirTree::finalize(SpillFile *spill)
 {
-    std::sort(m_files.begin(), m_files.end(),
-              [](const FileInfo &a, const FileInfo &b) { return a.time < b.time; });
+    if (m_filesSketch != nullptr)
+        m_filesSketch->finalize();
     m_subdirs.shrink_to_fit();
+    if (spill != nullptr && !m_files.empty()) {
+        // Sort while the files are still hot, so that the spilled run is never written again.
+        _sort();
+        void *p = spill->append(m_files.data(), m_files.size() * sizeof(FileInfo));
+        if (p != nullptr && m_columns != nullptr) {
+            auto spillColumns = [spill, &p](auto &vectors, auto &spilled) {
+                for (size_t i = 0; i < vectors.size() && p != nullptr; ++i) {
+                    if (vectors[i].empty())
+                        continue;
+                    using T = std::remove_reference_t<decltype(vectors[i])>::value_type;
+                    void *c = spill->append(vectors[i].data(), vectors[i].size() * sizeof(T));
+                    if (c == nullptr)
+                        p = nullptr;
+                    spilled[i] = static_cast<T*>(c);
+                }
+            };
+            spillColumns(m_columns->times, m_columns->spilledTimes);
+            spillColumns(m_columns->attributes, m_columns->spilledAttributes);
+            if (p != nullptr) {
+                for (std::vector<file_time_t> &column : m_columns->times) {
+                    std::vector<file_time_t>().swap(column);
+                }
+                for (std::vector<attribute_t> &column : m_columns->attributes) {
+                    std::vector<attribute_t>().swap(column);
+                }
+            }
+            else {
+                m_columns->spilledTimes.fill(nullptr);
+                m_columns->spilledAttributes.fill(nullptr);
+            }
+        }
+        if (p != nullptr) {
+            m_spilled = static_cast<FileInfo*>(p);
+            m_numSpilled = m_files.size();
+            std::vector<FileInfo>().swap(m_files);
+            m_sortState = SORTED;
+            return;
+        }
+        // Keep the files in memory if the spill file cannot grow.
+    }
+    // Sorting is deferred to the first access, see sortFiles().
     m_files.shrink_to_fit();
+    if (m_columns != nullptr) {
+        for (std::vector<file_time_t> &column : m_columns->times) {
+            column.shrink_to_fit();
+        }
+        for (std::vector<attribute_t> &column : m_columns->attributes) {
+            column.shrink_to_fit();
+        }
+    }
+    m_sortState = (m_files.size() > 1) ? UNSORTED : SORTED;
 }
 
-DirTree *DirTree::child(size_t i)
+const char *DirTree::timeBasisName(TimeBasis basis)
 {
-    Q_ASSERT(i < m_subdirs.size());
-    return m_subdirs[i];
+    static const char *names[] = { "mtime", "atime", "ctime", "btime" };
+    static_assert(sizeof(names) / sizeof(names[0]) == NUM_TIME_BASES);
+    return names[basis];
 }
 
-static bool heap_comp_asc_time(const DirTree::iterator &a, const DirTree::iterator &b)
+void DirTree::useTimeColumns(quint8 bases, TimeBasis active)
 {
-    return a->time > b->time;
+    Q_ASSERT(_files().empty());
+    m_timeBasis = active;
+    m_timeBases = bases | (1 << active);
+    if (m_timeBases != (1 << active) && m_columns == nullptr)
+        m_columns = std::make_unique<Columns>();
 }
 
-void DirTree::iterator::_init(DirTree *tree)
+void DirTree::useAttributes(quint8 dimensions)
+{
+    Q_ASSERT(_files().empty());
+    m_dimensions = dimensions;
+    if (m_dimensions != 0 && m_columns == nullptr)
+        m_columns = std::make_unique<Columns>();
+}
+
+std::span<const DirTree::attribute_t> DirTree::attributes(Dimension dimension) const
+{
+    if (!hasAttribute(dimension) || m_columns == nullptr)
+        return {};
+    sortFiles();
+    return std::span(m_columns->attribute(dimension), _files().size());
+}
+
+const AttributeDictionary *DirTree::dictionary() const
+{
+    return _root()->m_dictionary.get();
+}
+
+bool DirTree::canSwitchTimeBasis(TimeBasis basis) const
+{
+    if ((m_timeBases & (1 << basis)) == 0 || m_collapsed || m_filesSketch != nullptr)
+        return false;
+    return std::all_of(m_subdirs.begin(), m_subdirs.end(),
+                       [basis](const DirTree *ch) { return ch->canSwitchTimeBasis(basis); });
+}
+
+bool DirTree::setTimeBasis(TimeBasis basis)
+{
+    if (basis == m_timeBasis)
+        return true;
+    if (!canSwitchTimeBasis(basis))
+        return false;
+    const bool heatmaps = m_subtreeHeatmap != nullptr;
+    _switchTimeBasis(basis);
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    buildHistograms(now, HISTOGRAM_MIN_FILES);
+    if (heatmaps)
+        buildHeatmaps(now);
+    // The oldest files were only kept for the basis of the scan.
+    buildTopFiles();
+    return true;
+}
+
+void DirTree::_switchTimeBasis(TimeBasis basis)
+{
+    if (m_columns != nullptr) {
+        std::span<FileInfo> files = _files();
+        file_time_t *column = m_columns->time(basis);
+        for (size_t i = 0; i < files.size(); ++i) {
+            std::swap(files[i].time, column[i]);
+        }
+        // The column now holds the times of the previous basis.
+        m_columns->moveTime(basis, m_timeBasis);
+        m_sortState = (files.size() > 1) ? UNSORTED : SORTED;
+    }
+    m_timeBasis = basis;
+    delete m_prefixSums.exchange(nullptr);
+    delete m_index.exchange(nullptr);
+    m_indexedFiles = 0;
+    m_subtreeHistogram.reset();
+    m_filesHistogram.reset();
+    m_subtreeHeatmap.reset();
+    m_filesHeatmap.reset();
+    for (DirTree *ch : m_subdirs) {
+        ch->_switchTimeBasis(basis);
+    }
+}
+
+void DirTree::_translateAttributes(const AttributeMap &map)
 {
-    if (tree != nullptr && tree->numChildren() > 0) {
-        m_subsCapacity = tree->numChildren();
-        m_subs = allocateIterators(m_subsCapacity);
-        // Allocate iterators of subdirs and put them on a heap, by time.
-        for (auto i = m_tree->m_subdirs.begin(); i != m_tree->m_subdirs.end(); i++) {
-            DirTree *j = *i;
-            DirTree::iterator begin = j->begin();
-            if (begin != j->end()) {
-                // Construct in place at the back and push into the heap.
-                new(m_subs + m_subsSize) DirTree::iterator(std::move(begin));
-                m_subsSize++;
-                std::push_heap(m_subs, m_subs + m_subsSize, &heap_comp_asc_time);
+    if (m_columns != nullptr) {
+        size_t n = _files().size();
+        for (int d = 0; d < AttributeDictionary::NUM_DIMENSIONS; ++d) {
+            if ((m_dimensions & (1 << d)) == 0)
+                continue;
+            attribute_t *column = m_columns->attribute(d);
+            for (size_t i = 0; i < n; ++i) {
+                if (column[i] != AttributeDictionary::OTHER)
+                    column[i] = map[d][column[i]];
             }
         }
-        // Get the first iterator.
-        operator++();
     }
-    else if (tree != nullptr) {
-        // No subdirs, just advance.
-        operator++();
+    for (DirTree *ch : m_subdirs) {
+        ch->_translateAttributes(map);
+    }
+}
+
+DirTree *DirTree::_root() const
+{
+    const DirTree *root = this;
+    while (root->m_parent != nullptr)
+        root = root->m_parent;
+    return const_cast<DirTree*>(root);
+}
+
+void DirTree::numberNodes()
+{
+    Q_ASSERT(m_parent == nullptr);
+    m_nodes.clear();
+    _number(0, m_nodes);
+    m_nodes.shrink_to_fit();
+}
+
+//! Returns one past the last number used in the subtree.
+quint32 DirTree::_number(quint32 next, std::vector<DirTree*> &nodes)
+{
+    m_preorder = next++;
+    nodes.push_back(this);
+    for (DirTree *ch : m_subdirs) {
+        next = ch->_number(next, nodes);
+    }
+    m_subtreeEnd = next;
+    return next;
+}
+
+bool DirTree::contains(const DirTree *other) const
+{
+    if (m_subtreeEnd != 0 && other->m_subtreeEnd != 0)
+        return other->m_preorder >= m_preorder && other->m_preorder < m_subtreeEnd;
+    for (; other != nullptr; other = other->m_parent) {
+        if (other == this)
+            return true;
+    }
+    return false;
+}
+
+std::span<DirTree* const> DirTree::subtreeNodes() const
+{
+    const DirTree *root = _root();
+    if (root->m_nodes.empty())
+        return {};
+    return std::span(root->m_nodes).subspan(m_preorder, m_subtreeEnd - m_preorder);
+}
+
+void DirTree::useSketch()
+{
+    Q_ASSERT(m_files.empty());
+    m_filesSketch = std::make_unique<QuantileSketch>();
+}
+
+void DirTree::buildSketches()
+{
+    if (m_collapsed)
+        return;
+    for (DirTree *ch : m_subdirs) {
+        ch->buildSketches();
+    }
+    if (m_subdirs.empty())
+        return;
+    m_subtreeSketch = std::make_unique<QuantileSketch>();
+    if (m_filesSketch != nullptr)
+        m_subtreeSketch->add(*m_filesSketch);
+    for (DirTree *ch : m_subdirs) {
+        const QuantileSketch *sketch = ch->subtreeSketch();
+        if (sketch != nullptr)
+            m_subtreeSketch->add(*sketch);
+    }
+    m_subtreeSketch->finalize();
+}
+
+void DirTree::summarizeInto(QuantileSketch &sketch) const
+{
+    if (m_collapsed) {
+        sketch.add(*m_subtreeSketch);
+        return;
+    }
+    if (m_filesSketch != nullptr) {
+        sketch.add(*m_filesSketch);
     }
     else {
-        // Nothing. Return end iterator.
-        m_current = nullptr;
+        for (const FileInfo &f : _files()) {
+            sketch.add(f.time, f.size);
+        }
+    }
+    for (const DirTree *ch : m_subdirs) {
+        ch->summarizeInto(sketch);
     }
 }
 
-void DirTree::iterator::_deinit()
+size_t DirTree::collapse()
+{
+    if (m_collapsed)
+        return 0;
+    size_t before = subtreeMemoryUsage();
+    auto subtree = std::make_unique<QuantileSketch>();
+    summarizeInto(*subtree);
+    subtree->finalize();
+    if (m_filesSketch == nullptr) {
+        m_filesSketch = std::make_unique<QuantileSketch>();
+        for (const FileInfo &f : _files()) {
+            m_filesSketch->add(f.time, f.size);
+        }
+        m_filesSketch->finalize();
+    }
+    m_subtreeSketch = std::move(subtree);
+    // The files are gone after this, so their heatmap is kept whatever their number.
+    if (m_subtreeHeatmap != nullptr && m_filesHeatmap == nullptr && !m_subdirs.empty())
+        m_filesHeatmap = std::make_unique<SizeAgeHeatmap::Levels>(
+                    _countFiles(_root()->m_heatmapReference));
+
+    for (DirTree *ch : m_subdirs) {
+        delete ch;
+    }
+    std::vector<DirTree*>().swap(m_subdirs);
+    std::vector<FileInfo>().swap(m_files);
+    delete m_prefixSums.exchange(nullptr);
+    m_columns.reset();
+    m_spilled = nullptr;
+    m_numSpilled = 0;
+    m_sortState = SORTED;
+    m_subtreeHistogram.reset();
+    m_filesHistogram.reset();
+    delete m_index.exchange(nullptr);
+    const size_t indexed = m_indexedFiles.exchange(0);
+    m_collapsed = true;
+    m_hasCollapsed = false;
+    // The own top entries stay valid; kept lists may point into the freed subtree.
+    _updateTopFiles();
+    for (DirTree *p = m_parent; p != nullptr; p = p->m_parent) {
+        p->m_hasCollapsed = true;
+        p->m_indexedFiles -= indexed;
+        if (p->m_topFiles != nullptr && !p->m_topFiles->subtree[LARGEST].empty())
+            p->_updateTopFiles();
+    }
+    DirTree *root = _root();
+    if (!root->m_nodes.empty())
+        root->numberNodes();
+    size_t after = memoryUsage();
+    return (before > after) ? before - after : 0;
+}
+
+void DirTree::_updateHasCollapsed()
+{
+    m_hasCollapsed = std::any_of(m_subdirs.begin(), m_subdirs.end(),
+                                 [](const DirTree *ch) { return ch->hasCollapsed(); });
+}
+
+void DirTree::graft(DirTree *rescanned)
+{
+    Q_ASSERT(m_collapsed && m_parent != nullptr && rescanned->m_parent == nullptr);
+    // The rescan may have used other scan options. The caller checked that it recorded the time.
+    if (rescanned->m_timeBasis != m_timeBasis) {
+        [[maybe_unused]] const bool switched = rescanned->setTimeBasis(m_timeBasis);
+        Q_ASSERT(switched);
+    }
+
+    // Ancestors' histograms counted the summary. Swap it for the new contents. The rescan
+    // counted at its own time, so its histograms are rebuilt at theirs, or charts of the
+    // ancestors would walk all of its files.
+    std::unique_ptr<AgeHistogram> removed, added;
+    for (DirTree *p = m_parent; p != nullptr; p = p->m_parent) {
+        if (p->m_subtreeHistogram == nullptr)
+            continue;
+        qint64 reference = p->m_subtreeHistogram->reference();
+        if (removed == nullptr || removed->reference() != reference) {
+            removed = std::make_unique<AgeHistogram>(reference);
+            m_subtreeSketch->forEachItem([&removed](qint64 time, qint64 weight) {
+                removed->add(time, weight);
+            });
+            const bool rebuild = (added == nullptr);
+            added = std::make_unique<AgeHistogram>(reference);
+            if (rebuild)
+                rescanned->_buildHistograms(HISTOGRAM_MIN_FILES, *added);
+            else
+                rescanned->_addSubtreeTo(*added);
+        }
+        p->m_subtreeHistogram->subtract(*removed);
+        p->m_subtreeHistogram->add(*added);
+    }
+    for (DirTree *p = m_parent; p != nullptr; p = p->m_parent) {
+        p->m_subtreeSize = p->m_subtreeSize - m_subtreeSize + rescanned->m_subtreeSize;
+        p->m_subtreeFiles = p->m_subtreeFiles - m_subtreeFiles + rescanned->m_subtreeFiles;
+        p->m_indexedFiles += rescanned->m_indexedFiles - m_indexedFiles;
+    }
+
+    // Ids of the rescan are numbered in its own dictionary.
+    DirTree *root = _root();
+    if (rescanned->m_dictionary != nullptr && root->m_dictionary != nullptr) {
+        AttributeMap map;
+        for (int d = 0; d < AttributeDictionary::NUM_DIMENSIONS; ++d) {
+            auto dimension = static_cast<Dimension>(d);
+            for (size_t id = 0; id < rescanned->m_dictionary->size(dimension); ++id) {
+                map[d].push_back(root->m_dictionary->translate(*rescanned->m_dictionary,
+                                                               dimension, attribute_t(id)));
+            }
+        }
+        rescanned->_translateAttributes(map);
+        rescanned->m_dictionary.reset();
+    }
+    else if (rescanned->m_dictionary != nullptr) {
+        root->m_dictionary = std::move(rescanned->m_dictionary);
+    }
+    // The rescan takes the place of the summary, which readers may still hold. It keeps its
+    // parent, so that they can walk up, and is retired by the caller.
+    rescanned->m_name = m_name;
+    rescanned->m_parent = m_parent;
+    rescanned->m_parentPos = m_parentPos;
+    std::vector<DirTree*>().swap(rescanned->m_nodes);
+    m_parent->m_subdirs[m_parentPos] = rescanned;
+    for (DirTree *p = m_parent; p != nullptr; p = p->m_parent) {
+        p->_updateHasCollapsed();
+    }
+    // Kept lists of the rescan point to its root for the files it had, which it still is.
+    for (DirTree *p = rescanned; p != nullptr; p = p->m_parent) {
+        p->_updateTopFiles();
+    }
+    // The rescan may have counted without heatmaps, or at another time. Exact counts go up
+    // the path, so that the rounding of the heatmaps does not add up with the depth.
+    if (m_parent->m_subtreeHeatmap != nullptr) {
+        const qint64 reference = root->m_heatmapReference;
+        SizeAgeHeatmap::Counts counts{};
+        rescanned->_buildHeatmaps(reference, counts);
+        for (DirTree *ch = rescanned, *p = m_parent; p != nullptr; ch = p, p = p->m_parent) {
+            p->_updateHeatmap(ch, reference, counts);
+        }
+    }
+    if (!root->m_nodes.empty())
+        root->numberNodes();
+}
+
+size_t DirTree::memoryUsage() const
+{
+    size_t n = sizeof(DirTree) + m_name.capacity() * sizeof(char16_t)
+            + m_files.capacity() * sizeof(FileInfo)
+            + (m_subdirs.capacity() + m_nodes.capacity()) * sizeof(DirTree*);
+    if (m_columns != nullptr) {
+        n += sizeof(Columns);
+        for (const std::vector<file_time_t> &column : m_columns->times) {
+            n += column.capacity() * sizeof(file_time_t);
+        }
+        for (const std::vector<attribute_t> &column : m_columns->attributes) {
+            n += column.capacity() * sizeof(attribute_t);
+        }
+    }
+    if (m_topFiles != nullptr) {
+        n += sizeof(TopFiles) + m_topFiles->entries.capacity() * sizeof(TopEntry);
+        for (const std::vector<TopFile> &list : m_topFiles->subtree) {
+            n += list.capacity() * sizeof(TopFile);
+        }
+    }
+    if (m_filesSketch != nullptr)
+        n += m_filesSketch->memoryUsage();
+    if (m_subtreeSketch != nullptr)
+        n += m_subtreeSketch->memoryUsage();
+    if (m_filesHistogram != nullptr)
+        n += sizeof(AgeHistogram);
+    if (m_subtreeHistogram != nullptr)
+        n += sizeof(AgeHistogram);
+    if (m_filesHeatmap != nullptr)
+        n += sizeof(SizeAgeHeatmap::Levels);
+    if (m_subtreeHeatmap != nullptr)
+        n += sizeof(SizeAgeHeatmap::Levels);
+    const Index *idx = index();
+    if (idx != nullptr)
+        n += sizeof(Index) + idx->size() * Index::ENTRY_BYTES;
+    const std::vector<file_size_t> *sums = m_prefixSums.load(std::memory_order_acquire);
+    if (sums != nullptr)
+        n += sizeof(*sums) + sums->capacity() * sizeof(file_size_t);
+    return n;
+}
+
+size_t DirTree::subtreeMemoryUsage() const
+{
+    size_t n = memoryUsage();
+    for (const DirTree *ch : m_subdirs) {
+        n += ch->subtreeMemoryUsage();
+    }
+    return n;
+}
+
+// LSD radix sort on the time relative to the oldest file, 11 bits per pass. Only as many passes
+// as the span of the times needs are made, typically three for real timestamps.
+static void radixSortByTime(std::span<DirTree::FileInfo> files)
+{
+    using FileInfo = DirTree::FileInfo;
+    constexpr int digitBits = 11;
+    constexpr size_t numBuckets = size_t(1) << digitBits;
+    const size_t n = files.size();
+    auto [minIt, maxIt] = std::minmax_element(files.begin(), files.end(),
+            [](const FileInfo &a, const FileInfo &b) { return a.time < b.time; });
+    const quint64 base = static_cast<quint64>(minIt->time);
+    const quint64 span = static_cast<quint64>(maxIt->time) - base;
+    const int numPasses = (std::bit_width(span) + digitBits - 1) / digitBits;
+
+    std::vector<FileInfo> buffer(n);
+    std::vector<size_t> offsets(numBuckets);
+    FileInfo *src = files.data();
+    FileInfo *dst = buffer.data();
+    for (int pass = 0; pass < numPasses; ++pass) {
+        const int shift = pass * digitBits;
+        auto digit = [base, shift](const FileInfo &f) {
+            return ((static_cast<quint64>(f.time) - base) >> shift) & (numBuckets - 1);
+        };
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            ++offsets[digit(src[i])];
+        }
+        size_t sum = 0;
+        for (size_t &c : offsets) {
+            size_t tmp = c;
+            c = sum;
+            sum += tmp;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst[offsets[digit(src[i])]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+    if (src != files.data())
+        std::copy(src, src + n, files.data());
+}
+
+void DirTree::sortFiles() const
+{
+    quint8 state = m_sortState.load(std::memory_order_acquire);
+    if (state == SORTED)
+        return;
+    if (state == UNSORTED &&
+            m_sortState.compare_exchange_strong(state, SORTING, std::memory_order_acq_rel)) {
+        _sort();
+        m_sortState.store(SORTED, std::memory_order_release);
+        m_sortState.notify_all();
+        return;
+    }
+    // Another thread is sorting this directory.
+    while ((state = m_sortState.load(std::memory_order_acquire)) != SORTED) {
+        m_sortState.wait(state, std::memory_order_acquire);
+    }
+}
+
+static void sortByTime(std::span<DirTree::FileInfo> files)
+{
+    using FileInfo = DirTree::FileInfo;
+    if (files.size() >= DIRTREE_RADIX_SORT_MIN)
+        radixSortByTime(files);
+    else
+        std::sort(files.begin(), files.end(),
+                  [](const FileInfo &a, const FileInfo &b) { return a.time < b.time; });
+}
+
+void DirTree::_sort() const
+{
+    std::span<FileInfo> files = _files();
+    if (m_columns == nullptr) {
+        sortByTime(files);
+        return;
+    }
+    // Sort the positions by time, then gather the files and every column in that order.
+    const size_t n = files.size();
+    std::vector<FileInfo> order(n);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = FileInfo{.size = static_cast<file_size_t>(i), .time = files[i].time};
+    }
+    sortByTime(order);
+    std::vector<FileInfo> sortedFiles(n);
+    for (size_t i = 0; i < n; ++i) {
+        sortedFiles[i] = files[order[i].size];
+    }
+    std::copy(sortedFiles.begin(), sortedFiles.end(), files.begin());
+    std::vector<file_time_t> sortedColumn(m_timeBases != (1 << m_timeBasis) ? n : 0);
+    for (int b = 0; b < NUM_TIME_BASES; ++b) {
+        if (b == m_timeBasis || (m_timeBases & (1 << b)) == 0)
+            continue;
+        file_time_t *column = m_columns->time(b);
+        for (size_t i = 0; i < n; ++i) {
+            sortedColumn[i] = column[order[i].size];
+        }
+        std::copy(sortedColumn.begin(), sortedColumn.end(), column);
+    }
+    std::vector<attribute_t> sortedAttributes(m_dimensions != 0 ? n : 0);
+    for (int d = 0; d < Columns::NUM_DIMENSIONS; ++d) {
+        if ((m_dimensions & (1 << d)) == 0)
+            continue;
+        attribute_t *column = m_columns->attribute(d);
+        for (size_t i = 0; i < n; ++i) {
+            sortedAttributes[i] = column[order[i].size];
+        }
+        std::copy(sortedAttributes.begin(), sortedAttributes.end(), column);
+    }
+}
+
+bool DirTree::sortAll(const std::function<bool()> &isCanceled)
+{
+    if (isCanceled && isCanceled())
+        return false;
+    sortFiles();
+    for (DirTree *ch : m_subdirs) {
+        if (!ch->sortAll(isCanceled))
+            return false;
+    }
+    return true;
+}
+
+void DirTree::buildHistograms(qint64 reference, size_t minFiles)
+{
+    AgeHistogram subtree(reference);
+    _buildHistograms(minFiles, subtree);
+}
+
+//! Adds this subtree to the histogram and returns the number of file entries in it.
+size_t DirTree::_buildHistograms(size_t minFiles, AgeHistogram &subtree)
+{
+    if (m_collapsed) {
+        m_subtreeSketch->forEachItem([&subtree](qint64 time, qint64 weight) {
+            subtree.add(time, weight);
+        });
+        return m_subtreeFiles;
+    }
+    if (m_filesSketch != nullptr) {
+        m_filesSketch->forEachItem([&subtree](qint64 time, qint64 weight) {
+            subtree.add(time, weight);
+        });
+    }
+    for (const FileInfo &f : _files()) {
+        subtree.add(f.time, f.size);
+    }
+    size_t numFiles = this->numFiles();
+    if (numFiles >= minFiles)
+        m_filesHistogram = std::make_unique<AgeHistogram>(subtree);
+    for (DirTree *ch : m_subdirs) {
+        AgeHistogram child(subtree.reference());
+        numFiles += ch->_buildHistograms(minFiles, child);
+        subtree.add(child);
+    }
+    if (numFiles >= minFiles)
+        m_subtreeHistogram = std::make_unique<AgeHistogram>(subtree);
+    return numFiles;
+}
+
+void DirTree::buildHeatmaps(qint64 reference)
+{
+    _root()->m_heatmapReference = reference;
+    SizeAgeHeatmap::Counts subtree{};
+    _buildHeatmaps(reference, subtree);
+}
+
+//! Adds the counts of this subtree. Children add theirs directly, so that the recursion keeps
+//! a single array of counts per level.
+void DirTree::_buildHeatmaps(qint64 reference, SizeAgeHeatmap::Counts &subtree)
+{
+    if (m_collapsed) {
+        if (m_subtreeHeatmap != nullptr)
+            SizeAgeHeatmap::addTo(*m_subtreeHeatmap, subtree);
+        return;
+    }
+    SizeAgeHeatmap::Counts counts{};
+    for (const FileInfo &f : _files()) {
+        SizeAgeHeatmap::add(counts, reference, f.time, f.size);
+    }
+    if (!m_subdirs.empty() && _files().size() >= DIRTREE_FILES_HEATMAP_MIN)
+        m_filesHeatmap = std::make_unique<SizeAgeHeatmap::Levels>(SizeAgeHeatmap::levels(counts));
+    else
+        m_filesHeatmap.reset();
+    for (DirTree *ch : m_subdirs) {
+        ch->_buildHeatmaps(reference, counts);
+    }
+    m_subtreeHeatmap = std::make_unique<SizeAgeHeatmap::Levels>(SizeAgeHeatmap::levels(counts));
+    for (int i = 0; i < SizeAgeHeatmap::NUM_CELLS; ++i) {
+        subtree[i] += counts[i];
+    }
+}
+
+//! Counts the subtree again after a graft below, given the exact counts of the child that
+//! changed. Adds the rest of the subtree to them.
+void DirTree::_updateHeatmap(const DirTree *changed, qint64 reference,
+                             SizeAgeHeatmap::Counts &counts)
+{
+    for (const FileInfo &f : _files()) {
+        SizeAgeHeatmap::add(counts, reference, f.time, f.size);
+    }
+    for (const DirTree *ch : m_subdirs) {
+        if (ch != changed && ch->m_subtreeHeatmap != nullptr)
+            SizeAgeHeatmap::addTo(*ch->m_subtreeHeatmap, counts);
+    }
+    m_subtreeHeatmap = std::make_unique<SizeAgeHeatmap::Levels>(SizeAgeHeatmap::levels(counts));
+}
+
+SizeAgeHeatmap::Levels DirTree::_countFiles(qint64 reference) const
+{
+    SizeAgeHeatmap::Counts counts{};
+    for (const FileInfo &f : files()) {
+        SizeAgeHeatmap::add(counts, reference, f.time, f.size);
+    }
+    return SizeAgeHeatmap::levels(counts);
+}
+
+std::optional<SizeAgeHeatmap> DirTree::subtreeHeatmap() const
+{
+    if (m_subtreeHeatmap == nullptr)
+        return std::nullopt;
+    return SizeAgeHeatmap(*m_subtreeHeatmap, _root()->m_heatmapReference);
+}
+
+std::optional<SizeAgeHeatmap> DirTree::filesHeatmap() const
+{
+    if (m_subtreeHeatmap == nullptr)
+        return std::nullopt;
+    const qint64 reference = _root()->m_heatmapReference;
+    if (m_filesHeatmap != nullptr)
+        return SizeAgeHeatmap(*m_filesHeatmap, reference);
+    if (numFiles() == m_subtreeFiles)
+        return SizeAgeHeatmap(*m_subtreeHeatmap, reference);
+    return SizeAgeHeatmap(_countFiles(reference), reference);
+}
+
+// Largest first, or oldest first. Ties are broken by the other key, so that merged lists do not
+// depend on the order of the directories.
+static bool topBefore(DirTree::TopKind kind, const DirTree::TopFile &a, const DirTree::TopFile &b)
 {
-    if (m_subs != nullptr) freeIterators(m_subs, m_subsCapacity);
+    if (kind == DirTree::LARGEST)
+        return (a.size != b.size) ? a.size > b.size : a.time < b.time;
+    return (a.time != b.time) ? a.time < b.time : a.size > b.size;
+}
+
+static void truncateTop(DirTree::TopKind kind, std::vector<DirTree::TopFile> &files)
+{
+    auto before = [kind](const DirTree::TopFile &a, const DirTree::TopFile &b) {
+        return topBefore(kind, a, b);
+    };
+    size_t n = std::min(files.size(), DirTree::TOP_FILES);
+    std::partial_sort(files.begin(), files.begin() + n, files.end(), before);
+    files.resize(n);
+}
+
+void DirTree::setTopEntries(std::vector<TopEntry> &&entries)
+{
+    if (entries.empty()) {
+        m_topFiles.reset();
+        return;
+    }
+    m_topFiles = std::make_unique<TopFiles>();
+    m_topFiles->basis = m_timeBasis;
+    m_topFiles->entries = std::move(entries);
+    m_topFiles->entries.shrink_to_fit();
+}
+
+void DirTree::buildTopFiles()
+{
+    for (DirTree *ch : m_subdirs) {
+        ch->buildTopFiles();
+    }
+    _updateTopFiles();
+}
+
+//! Recollect the kept lists of this subtree from its own entries and the children.
+void DirTree::_updateTopFiles()
+{
+    if (m_topFiles != nullptr) {
+        for (std::vector<TopFile> &list : m_topFiles->subtree) {
+            std::vector<TopFile>().swap(list);
+        }
+    }
+    if (m_collapsed || m_subtreeFiles < TOP_FILES_MIN_FILES) {
+        if (m_topFiles != nullptr && m_topFiles->entries.empty())
+            m_topFiles.reset();
+        return;
+    }
+    for (int k = 0; k < NUM_TOP_KINDS; ++k) {
+        auto kind = static_cast<TopKind>(k);
+        std::vector<TopFile> list;
+        _collectTopFiles(kind, list);
+        truncateTop(kind, list);
+        if (list.empty())
+            continue;
+        if (m_topFiles == nullptr) {
+            m_topFiles = std::make_unique<TopFiles>();
+            m_topFiles->basis = m_timeBasis;
+        }
+        m_topFiles->subtree[kind] = std::move(list);
+    }
+}
+
+void DirTree::_collectTopFiles(TopKind kind, std::vector<TopFile> &out) const
+{
+    if (m_topFiles != nullptr && !m_topFiles->subtree[kind].empty()) {
+        out.insert(out.end(), m_topFiles->subtree[kind].begin(), m_topFiles->subtree[kind].end());
+        return;
+    }
+    // Times of the entries are of the scan's basis.
+    if (m_topFiles != nullptr && (kind == LARGEST || m_topFiles->basis == m_timeBasis)) {
+        for (const TopEntry &e : m_topFiles->entries) {
+            out.push_back(TopFile{.size = e.size, .time = e.time, .ordinal = e.ordinal,
+                                  .dir = const_cast<DirTree*>(this)});
+        }
+    }
+    for (const DirTree *ch : m_subdirs) {
+        ch->_collectTopFiles(kind, out);
+        if (out.size() > 4 * TOP_FILES)
+            truncateTop(kind, out);
+    }
+}
+
+std::vector<DirTree::TopFile> DirTree::topFiles(TopKind kind) const
+{
+    std::vector<TopFile> files;
+    _collectTopFiles(kind, files);
+    truncateTop(kind, files);
+    return files;
+}
+
+void DirTree::_addSubtreeTo(AgeHistogram &histogram) const
+{
+    if (m_subtreeHistogram != nullptr && m_subtreeHistogram->reference() == histogram.reference()) {
+        histogram.add(*m_subtreeHistogram);
+        return;
+    }
+    if (m_collapsed) {
+        m_subtreeSketch->forEachItem([&histogram](qint64 time, qint64 weight) {
+            histogram.add(time, weight);
+        });
+        return;
+    }
+    addToHistogram(histogram, true);
+    for (const DirTree *ch : m_subdirs) {
+        ch->_addSubtreeTo(histogram);
+    }
+}
+
+void DirTree::addToHistogram(AgeHistogram &histogram, bool filesOnly) const
+{
+    if (!filesOnly) {
+        _addSubtreeTo(histogram);
+        return;
+    }
+    if (m_filesHistogram != nullptr && m_filesHistogram->reference() == histogram.reference()) {
+        histogram.add(*m_filesHistogram);
+        return;
+    }
+    if (m_filesSketch != nullptr) {
+        m_filesSketch->forEachItem([&histogram](qint64 time, qint64 weight) {
+            histogram.add(time, weight);
+        });
+        return;
+    }
+    for (const FileInfo &f : files()) {
+        histogram.add(f.time, f.size);
+    }
+}
+
+AgeChart DirTree::approximateChart(bool filesOnly) const
+{
+    const QuantileSketch *sketch = filesOnly ? filesSketch() : subtreeSketch();
+    if (sketch != nullptr) {
+        AgeChart ret = sketch->chart();
+        ret.approximate = true;
+        return ret;
+    }
+    const AgeHistogram *stored = filesOnly ? filesHistogram() : subtreeHistogram();
+    if (stored != nullptr)
+        return stored->chart();
+    // Below the threshold, so summarizing the files directly is cheap.
+    AgeHistogram tmp(QDateTime::currentSecsSinceEpoch());
+    if (filesOnly) {
+        for (const FileInfo &f : files()) {
+            tmp.add(f.time, f.size);
+        }
+    }
+    else {
+        _addSubtreeTo(tmp);
+    }
+    return tmp.chart();
+}
+
+// Append the sorted runs of a subtree, reusing the merged run of indexed subdirs.
+static void collectRuns(DirTree *tree, std::vector<DirTree::Index::Entry> &out,
+                        std::vector<size_t> &bounds)
+{
+    std::span<const DirTree::FileInfo> files = tree->files();
+    if (!files.empty()) {
+        for (const DirTree::FileInfo &f : files) {
+            out.push_back(DirTree::Index::Entry{.size = f.size, .time = f.time, .count = 1});
+        }
+        bounds.push_back(out.size());
+    }
+    for (size_t i = 0; i < tree->numChildren(); ++i) {
+        DirTree *ch = tree->child(i);
+        const DirTree::Index *index = ch->index();
+        if (index != nullptr) {
+            index->appendTo(out);
+            bounds.push_back(out.size());
+        }
+        else {
+            collectRuns(ch, out, bounds);
+        }
+    }
+}
+
+bool DirTree::buildIndex(size_t minFiles, size_t maxBytes,
+                         const std::function<bool()> &isCanceled)
+{
+    if (minFiles == 0)
+        return true;
+    if (_buildIndex(minFiles, maxBytes, isCanceled) == std::numeric_limits<size_t>::max())
+        return false;
+    return _buildPrefixSums(maxBytes, isCanceled);
+}
+
+//! Returns the number of file entries in the subtree that no index covers, or the maximum of
+//! size_t if canceled. maxBytes is what is left of the budget.
+size_t DirTree::_buildIndex(size_t minFiles, size_t &maxBytes,
+                            const std::function<bool()> &isCanceled)
+{
+    constexpr size_t canceled = std::numeric_limits<size_t>::max();
+    if (index() != nullptr)
+        return 0;
+    size_t unindexed = _files().size();
+    size_t indexed = 0;
+    for (DirTree *ch : m_subdirs) {
+        size_t n = ch->_buildIndex(minFiles, maxBytes, isCanceled);
+        if (n == canceled)
+            return canceled;
+        unindexed += n;
+        indexed += ch->numIndexedFiles();
+    }
+    m_indexedFiles.store(indexed, std::memory_order_release);
+    // Summaries cannot be merged exactly. Few files besides the indexes below are cheap to
+    // search directly. An index repeats those below it, so it is only built if it adds at
+    // least as many entries, which keeps all of them within twice the number of files.
+    if (unindexed < minFiles || unindexed < indexed || hasCollapsed())
+        return unindexed;
+    const size_t numFiles = unindexed + indexed;
+    if (numFiles * Index::ENTRY_BYTES > maxBytes)
+        return unindexed;
+    if (isCanceled && isCanceled())
+        return canceled;
+
+    std::vector<Index::Entry> merged;
+    std::vector<size_t> bounds{0};
+    merged.reserve(numFiles);
+    collectRuns(this, merged, bounds);
+
+    // Merge neighbouring runs pairwise until one is left.
+    auto byTime = [](const Index::Entry &a, const Index::Entry &b) { return a.time < b.time; };
+    while (bounds.size() > 2) {
+        std::vector<size_t> next{0};
+        for (size_t i = 0; i + 2 < bounds.size(); i += 2) {
+            std::inplace_merge(merged.begin() + bounds[i], merged.begin() + bounds[i + 1],
+                               merged.begin() + bounds[i + 2], byTime);
+            next.push_back(bounds[i + 2]);
+        }
+        if (bounds.size() % 2 == 0)
+            next.push_back(bounds.back());
+        bounds.swap(next);
+    }
+
+    Index *index = new Index;
+    file_size_t accumulated = 0;
+    size_t count = 0;
+    for (const Index::Entry &e : merged) {
+        accumulated += e.size;
+        count += e.count;
+        if (!index->m_times.empty() && index->m_times.back() == e.time) {
+            index->m_cumulative.back() = accumulated;
+            index->m_counts.back() = count;
+        }
+        else {
+            index->m_times.push_back(e.time);
+            index->m_cumulative.push_back(accumulated);
+            index->m_counts.push_back(count);
+        }
+    }
+    index->m_times.shrink_to_fit();
+    index->m_cumulative.shrink_to_fit();
+    index->m_counts.shrink_to_fit();
+    maxBytes -= std::min(maxBytes, index->size() * Index::ENTRY_BYTES);
+    m_index.store(index, std::memory_order_release);
+    m_indexedFiles.store(numFiles, std::memory_order_release);
+    return 0;
+}
+
+//! Prefix sums of the own files of directories that no index covers, while maxBytes lasts.
+//! Returns false if canceled.
+bool DirTree::_buildPrefixSums(size_t &maxBytes, const std::function<bool()> &isCanceled)
+{
+    if (index() != nullptr || m_collapsed)
+        return true;
+    const size_t n = m_files.size();
+    const size_t bytes = n * sizeof(file_size_t);
+    if (n >= DIRTREE_PREFIX_SUMS_MIN && bytes <= maxBytes
+            && m_prefixSums.load(std::memory_order_acquire) == nullptr) {
+        if (isCanceled && isCanceled())
+            return false;
+        sortFiles();
+        auto *sums = new std::vector<file_size_t>(n);
+        file_size_t accumulated = 0;
+        for (size_t i = 0; i < n; ++i) {
+            accumulated += m_files[i].size;
+            (*sums)[i] = accumulated;
+        }
+        maxBytes -= bytes;
+        m_prefixSums.store(sums, std::memory_order_release);
+    }
+    for (DirTree *ch : m_subdirs) {
+        if (!ch->_buildPrefixSums(maxBytes, isCanceled))
+            return false;
+    }
+    return true;
+}
+
+DirTree::file_time_t DirTree::Index::quantile(file_size_t weight) const
+{
+    auto i = std::lower_bound(m_cumulative.begin(), m_cumulative.end(), weight);
+    if (i == m_cumulative.end())
+        return m_times.back();
+    return m_times[i - m_cumulative.begin()];
+}
+
+DirTree::Totals DirTree::Index::before(file_time_t time) const
+{
+    size_t n = std::lower_bound(m_times.begin(), m_times.end(), time) - m_times.begin();
+    if (n == 0)
+        return Totals{.size = 0, .count = 0};
+    return Totals{.size = m_cumulative[n - 1], .count = m_counts[n - 1]};
+}
+
+void DirTree::Index::appendTo(std::vector<Entry> &out) const
+{
+    file_size_t previousSize = 0;
+    size_t previousCount = 0;
+    for (size_t i = 0; i < m_times.size(); ++i) {
+        out.push_back(Entry{.size = m_cumulative[i] - previousSize, .time = m_times[i],
+                            .count = m_counts[i] - previousCount});
+        previousSize = m_cumulative[i];
+        previousCount = m_counts[i];
+    }
+}
+
+// Totals estimated from a sketch. The count is scaled from the size.
+static DirTree::Totals sketchTotalsBefore(const QuantileSketch &sketch, DirTree::file_time_t time)
+{
+    DirTree::file_size_t size = sketch.weightBefore(time);
+    size_t count = (sketch.totalWeight() > 0) ?
+                qRound64(double(sketch.count()) * size / sketch.totalWeight()) : 0;
+    return DirTree::Totals{.size = size, .count = count};
+}
+
+void DirTree::_addBefore(file_time_t time, Totals &totals) const
+{
+    if (m_collapsed) {
+        Totals t = sketchTotalsBefore(*m_subtreeSketch, time);
+        totals.size += t.size;
+        totals.count += t.count;
+        return;
+    }
+    const Index *idx = index();
+    if (idx != nullptr) {
+        Totals t = idx->before(time);
+        totals.size += t.size;
+        totals.count += t.count;
+        return;
+    }
+    std::span<const FileInfo> sorted = files();
+    auto pos = std::lower_bound(sorted.begin(), sorted.end(), time,
+                                [](const FileInfo &f, file_time_t t) { return f.time < t; });
+    size_t n = pos - sorted.begin();
+    totals.count += n;
+    const std::vector<file_size_t> *sums = m_prefixSums.load(std::memory_order_acquire);
+    if (sums != nullptr) {
+        totals.size += (n > 0) ? (*sums)[n - 1] : 0;
+    }
+    else {
+        for (auto i = sorted.begin(); i != pos; ++i) {
+            totals.size += i->size;
+        }
+    }
+    for (const DirTree *ch : m_subdirs) {
+        ch->_addBefore(time, totals);
+    }
+}
+
+void DirTree::_timeRange(file_time_t &min, file_time_t &max) const
+{
+    if (m_collapsed) {
+        if (m_subtreeSketch->count() > 0) {
+            min = std::min(min, m_subtreeSketch->min());
+            max = std::max(max, m_subtreeSketch->max());
+        }
+        return;
+    }
+    const Index *idx = index();
+    if (idx != nullptr) {
+        if (idx->size() > 0) {
+            min = std::min(min, idx->min());
+            max = std::max(max, idx->max());
+        }
+        return;
+    }
+    std::span<const FileInfo> sorted = files();
+    if (!sorted.empty()) {
+        min = std::min(min, sorted.front().time);
+        max = std::max(max, sorted.back().time);
+    }
+    for (const DirTree *ch : m_subdirs) {
+        ch->_timeRange(min, max);
+    }
+}
+
+bool DirTree::timeRange(file_time_t &min, file_time_t &max) const
+{
+    min = std::numeric_limits<file_time_t>::max();
+    max = std::numeric_limits<file_time_t>::min();
+    _timeRange(min, max);
+    return min <= max;
+}
+
+DirTree::Totals DirTree::olderThan(file_time_t time) const
+{
+    const QuantileSketch *sketch = subtreeSketch();
+    if (sketch != nullptr)
+        return sketchTotalsBefore(*sketch, time);
+    Totals totals{.size = 0, .count = 0};
+    _addBefore(time, totals);
+    return totals;
+}
+
+DirTree::Totals DirTree::newerThan(file_time_t time) const
+{
+    if (time == std::numeric_limits<file_time_t>::max())
+        return Totals{.size = 0, .count = 0};
+    Totals notNewer = olderThan(time + 1);
+    return Totals{.size = subtreeSize() - notNewer.size,
+                  .count = numSubtreeFiles() - notNewer.count};
+}
+
+DirTree::file_size_t DirTree::sizeBetween(file_time_t from, file_time_t to) const
+{
+    if (to <= from)
+        return 0;
+    return olderThan(to).size - olderThan(from).size;
+}
+
+DirTree::file_time_t DirTree::quantile(file_size_t weight,
+                                       const std::function<bool()> &isCanceled) const
+{
+    const QuantileSketch *sketch = subtreeSketch();
+    if (sketch != nullptr)
+        return sketch->quantile(weight);
+    const Index *idx = index();
+    if (idx != nullptr && idx->size() > 0)
+        return idx->quantile(weight);
+
+    // Summaries only estimate the size before a time, so search for the oldest time at which
+    // the size of files not newer than it reaches the weight.
+    if (hasCollapsed()) {
+        file_time_t lo, hi;
+        if (!timeRange(lo, hi))
+            return std::numeric_limits<file_time_t>::lowest();
+        while (lo < hi) {
+            if (isCanceled && isCanceled())
+                return lo;
+            file_time_t mid = lo + (hi - lo) / 2;
+            Totals totals{.size = 0, .count = 0};
+            _addBefore(mid + 1, totals);
+            if (totals.size >= weight)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        return lo;
+    }
+
+    // Otherwise select among the sorted runs of the subtree, the indexes and the files beside
+    // them, gathered once. A pivot time splits every run with a binary search, and the side
+    // that cannot hold the answer is dropped, until no entry is left. That is the time a merge
+    // of the subtree reaches the weight at.
+    struct Run
+    {
+        const file_time_t*  times;  // Of an index, else the files are used.
+        const file_size_t*  cumulative;  // Of an index or of prefix sums, if any.
+        const FileInfo*     files;
+        size_t              lo;
+        size_t              hi;
+
+        file_time_t time(size_t i) const
+        { return (times != nullptr) ? times[i] : files[i].time; }
+
+        //! First entry of the run left that is newer than the time, or not older.
+        size_t split(file_time_t t, bool newer) const
+        {
+            size_t a = lo, b = hi;
+            while (a < b) {
+                size_t mid = a + (b - a) / 2;
+                if (newer ? time(mid) <= t : time(mid) < t)
+                    a = mid + 1;
+                else
+                    b = mid;
+            }
+            return a;
+        }
+
+        file_size_t weight(size_t from, size_t to) const
+        {
+            if (cumulative != nullptr) {
+                const file_size_t below = (from > 0) ? cumulative[from - 1] : 0;
+                return ((to > 0) ? cumulative[to - 1] : 0) - below;
+            }
+            file_size_t w = 0;
+            for (size_t i = from; i < to; ++i) {
+                w += files[i].size;
+            }
+            return w;
+        }
+    };
+    std::vector<Run> runs;
+    auto collect = [&runs](auto &self, const DirTree *tree) -> void {
+        const Index *index = tree->index();
+        if (index != nullptr) {
+            if (index->size() > 0) {
+                runs.push_back(Run{index->m_times.data(), index->m_cumulative.data(), nullptr,
+                                   0, index->size()});
+            }
+            return;
+        }
+        std::span<const FileInfo> files = tree->files();
+        if (!files.empty()) {
+            const std::vector<file_size_t> *sums =
+                    tree->m_prefixSums.load(std::memory_order_acquire);
+            runs.push_back(Run{nullptr, (sums != nullptr) ? sums->data() : nullptr,
+                               files.data(), 0, files.size()});
+        }
+        for (const DirTree *ch : tree->m_subdirs) {
+            self(self, ch);
+        }
+    };
+    collect(collect, this);
+    if (runs.empty())
+        return std::numeric_limits<file_time_t>::lowest();
+
+    // Not reached by all files: the newest time, as a merge would end.
+    file_time_t answer = std::numeric_limits<file_time_t>::lowest();
+    for (const Run &r : runs) {
+        answer = std::max(answer, r.time(r.hi - 1));
+    }
+    file_size_t older = 0;  // Of the entries dropped as older than the answer.
+    std::vector<std::pair<file_time_t, size_t>> middles;
+    std::vector<size_t> splits;
+    while (!runs.empty()) {
+        if (isCanceled && isCanceled())
+            return answer;
+        // The median of the middle entries by the entries left, so that a quarter goes.
+        middles.clear();
+        size_t left = 0;
+        for (const Run &r : runs) {
+            middles.emplace_back(r.time(r.lo + (r.hi - r.lo) / 2), r.hi - r.lo);
+            left += r.hi - r.lo;
+        }
+        std::sort(middles.begin(), middles.end());
+        file_time_t pivot = middles.back().first;
+        size_t passed = 0;
+        for (const auto &[time, entries] : middles) {
+            passed += entries;
+            if (2 * passed >= left) {
+                pivot = time;
+                break;
+            }
+        }
+        splits.clear();
+        file_size_t notNewer = older;
+        for (const Run &r : runs) {
+            splits.push_back(r.split(pivot, true));
+            notNewer += r.weight(r.lo, splits.back());
+        }
+        if (notNewer >= weight) {
+            answer = pivot;
+            for (Run &r : runs) {
+                r.hi = r.split(pivot, false);
+            }
+        }
+        else {
+            older = notNewer;
+            for (size_t i = 0; i < runs.size(); ++i) {
+                runs[i].lo = splits[i];
+            }
+        }
+        std::erase_if(runs, [](const Run &r) { return r.lo == r.hi; });
+    }
+    return answer;
+}
+
+DirTree *DirTree::child(size_t i)
+{
+    Q_ASSERT(i < m_subdirs.size());
+    return m_subdirs[i];
+}
+
+void DirTree::iterator::_init(DirTree *tree)
+{
+    m_runs.swap(t_spareRuns);
+    m_losers.swap(t_spareLosers);
+    m_runs.clear();
+    _collect(tree);
+    if (m_runs.empty())
+        return;
+
+    // Play the initial tournament. Leaf i sits at position k + i.
+    m_losers.assign(m_runs.size(), 0);
+    m_losers[0] = _build(1);
+    m_current = const_cast<FileInfo*>(m_runs[m_losers[0]].pos);
+}
+
+void DirTree::iterator::_collect(DirTree *tree)
+{
+    std::span<const FileInfo> files = tree->files();
+    if (!files.empty()) {
+        if (tree->m_spilled != nullptr && files.size_bytes() >= DIRTREE_PREFETCH_MIN_BYTES)
+            SpillFile::willRead(files.data(), files.size_bytes());
+        m_runs.push_back(Run{.pos = files.data(), .end = files.data() + files.size(),
+                             .dir = tree});
+    }
+    for (DirTree *ch : tree->m_subdirs) {
+        _collect(ch);
+    }
+}
+
+quint32 DirTree::iterator::_build(quint32 node)
+{
+    const quint32 k = m_runs.size();
+    if (node >= k)
+        return node - k;
+    quint32 a = _build(2 * node);
+    quint32 b = _build(2 * node + 1);
+    if (_less(b, a))
+        std::swap(a, b);
+    m_losers[node] = b;
+    return a;
+}
+
+bool DirTree::iterator::_less(quint32 a, quint32 b) const
+{
+    const Run &ra = m_runs[a];
+    const Run &rb = m_runs[b];
+    if (ra.pos == ra.end)
+        return false;
+    if (rb.pos == rb.end)
+        return true;
+    return ra.pos->time < rb.pos->time;
+}
+
+void DirTree::iterator::_replay(quint32 leaf)
+{
+    const quint32 k = m_runs.size();
+    quint32 winner = leaf;
+    for (quint32 node = (k + leaf) / 2; node > 0; node /= 2) {
+        if (_less(m_losers[node], winner))
+            std::swap(m_losers[node], winner);
+    }
+    m_losers[0] = winner;
+}
+
+DirTree::iterator::~iterator()
+{
+    if (m_runs.capacity() > t_spareRuns.capacity())
+        m_runs.swap(t_spareRuns);
+    if (m_losers.capacity() > t_spareLosers.capacity())
+        m_losers.swap(t_spareLosers);
 }
 
 DirTree::iterator::iterator(iterator &&other): iterator(nullptr)
@@ -146,10 +1463,8 @@ void DirTree::iterator::swap(iterator &&other)
 {
     std::swap(m_tree, other.m_tree);
     std::swap(m_current, other.m_current);
-    std::swap(m_pos, other.m_pos);
-    std::swap(m_subs, other.m_subs);
-    std::swap(m_subsSize, other.m_subsSize);
-    std::swap(m_subsCapacity, other.m_subsCapacity);
+    m_runs.swap(other.m_runs);
+    m_losers.swap(other.m_losers);
 }
 
 DirTree::iterator::reference DirTree::iterator::operator*() const
@@ -164,42 +1479,14 @@ DirTree::iterator::pointer DirTree::iterator::operator->() const
 
 DirTree::iterator &DirTree::iterator::operator++()
 {
-    // Go to next file in this dir, or subdirs, by ascending order, by time.
-    if (m_subsSize > 0) {
-        // Check if the next lowest time is a file or a subdir. Subdirs are in a heap.
-        const iterator &best = (*m_subs);
-        if (m_tree->m_files.size() > m_pos && m_tree->m_files[m_pos].time < best->time) {
-            // Advance files pointer.
-            m_current = &m_tree->m_files[m_pos];
-            m_pos++;
-        }
-        else {
-            // In a subdir.
-            m_current = best.m_current;
-            // Move the current item to the back of the vector.
-            std::pop_heap(m_subs, m_subs + m_subsSize, &heap_comp_asc_time);
-            // Advance that iterator.
-            iterator &back = *(m_subs + m_subsSize - 1);
-            ++back;
-            // Move it back into the heap or delete if there's no more items.
-            if (back != iterator(nullptr)) {
-                std::push_heap(m_subs, m_subs + m_subsSize, &heap_comp_asc_time);
-            }
-            else {
-                back.~iterator();
-                m_subsSize--;
-            }
-        }
-    }
-    else {
-        if (m_tree->m_files.size() > m_pos) {
-            m_current = &m_tree->m_files[m_pos];
-            m_pos++;
-        }
-        else {
-            m_current = nullptr;
-        }
-    }
+    if (m_current == nullptr)
+        return *this;
+    // Advance the winning run and let it play its way back up to the root.
+    quint32 leaf = m_losers[0];
+    ++m_runs[leaf].pos;
+    _replay(leaf);
+    const Run &best = m_runs[m_losers[0]];
+    m_current = (best.pos != best.end) ? const_cast<FileInfo*>(best.pos) : nullptr;
     return *this;
 }
 
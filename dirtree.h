@@ -11,9 +11,19 @@
 #define DIRTREE_H
 
 #include <QtCore>
+#include <array>
+#include <atomic>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <optional>
+#include <span>
 #include <vector>
+#include "agehistogram.h"
+#include "attributedictionary.h"
+#include "quantilesketch.h"
+#include "sizeageheatmap.h"
+#include "spillfile.h"
 
 class DirTree
 {
@@ -23,16 +33,205 @@ public:
     using file_time_t = qint64;
     typedef struct { file_size_t size; file_time_t time; } FileInfo;
 
+    //! Total size and number of files matching a query.
+    struct Totals { file_size_t size; size_t count; };
+
+    //! Which timestamp of the files FileInfo::time holds.
+    enum TimeBasis: quint8 { MTIME, ATIME, CTIME, BTIME, NUM_TIME_BASES };
+    using FileTimes = std::array<file_time_t, NUM_TIME_BASES>;
+    static const char *timeBasisName(TimeBasis basis);
+
+    //! Interned attributes of a file, see AttributeDictionary.
+    using Dimension = AttributeDictionary::Dimension;
+    using attribute_t = AttributeDictionary::id_t;
+    using Attributes = std::array<attribute_t, AttributeDictionary::NUM_DIMENSIONS>;
+
+    //! Directories and subtrees with at least this many files keep an age histogram.
+    static constexpr size_t HISTOGRAM_MIN_FILES = 256;
+
+    //! Largest or oldest files of a subtree, see topFiles().
+    enum TopKind: quint8 { LARGEST, OLDEST, NUM_TOP_KINDS };
+    static constexpr size_t TOP_FILES = 10;
+    //! Subtrees with at least this many files keep their merged top files.
+    static constexpr size_t TOP_FILES_MIN_FILES = 256;
+    //! A file of a directory by its position in readdir() order. Names are not kept; see
+    //! ScannerService::entryName().
+    struct TopEntry { file_size_t size; file_time_t time; quint32 ordinal; };
+    struct TopFile { file_size_t size; file_time_t time; quint32 ordinal; DirTree *dir; };
+
     DirTree() noexcept;
     ~DirTree();
 
     void append(file_size_t size, file_time_t time);
+    //! Append a file with every timestamp. Those recorded besides the active one go to columns,
+    //! as do the attributes of the recorded dimensions.
+    void append(file_size_t size, const FileTimes &times, const Attributes &attributes = {});
     void append(DirTree *subdir);
-    void finalize();
+
+    //! Record the timestamps in the bit mask of (1 << TimeBasis) and make one of them the time
+    //! of the files. Call before appending files. Only the additional ones take memory.
+    void useTimeColumns(quint8 bases, TimeBasis active);
+
+    //! Record the attributes in the bit mask of (1 << Dimension), two bytes per file each.
+    //! Call before appending files.
+    void useAttributes(quint8 dimensions);
+
+    //! Whether this directory recorded the attribute of its files.
+    bool hasAttribute(Dimension dimension) const
+    { return (m_dimensions & (1 << dimension)) != 0; }
+
+    //! Attribute ids of files(), in the same order. Empty if not recorded.
+    std::span<const attribute_t> attributes(Dimension dimension) const;
+
+    //! Keep the dictionary of the attribute ids. Called on the root of a scan.
+    void adoptDictionary(std::unique_ptr<AttributeDictionary> dictionary)
+    { m_dictionary = std::move(dictionary); }
+
+    //! Dictionary of the root, or null if no attributes were recorded.
+    const AttributeDictionary *dictionary() const;
+
+    TimeBasis timeBasis() const
+    { return m_timeBasis; }
+
+    //! Whether setTimeBasis() can switch to the basis: every directory of the subtree recorded
+    //! it and none is summarized in a sketch.
+    bool canSwitchTimeBasis(TimeBasis basis) const;
+
+    //! Make another recorded timestamp the time of the files in the whole subtree. Directories
+    //! are sorted again on first use, indexes are dropped and histograms rebuilt. Calculations
+    //! must not run meanwhile. Returns false if the switch is not possible.
+    bool setTimeBasis(TimeBasis basis);
+
+    //! Done appending files. With a spill file, they are sorted and moved into it.
+    void finalize(SpillFile *spill = nullptr);
+
+    //! Keep the spill file holding the files of this tree alive until the tree is deleted.
+    //! Called on the root of a scan.
+    void adoptSpillFile(std::unique_ptr<SpillFile> spill)
+    { m_spillFile = std::move(spill); }
+
+    //! Whether files of this tree live in a spill file. Called on the root.
+    bool hasSpillFile() const
+    { return m_spillFile != nullptr; }
+
+    //! Summarize files in a quantile sketch instead of keeping them. Call before appending files.
+    void useSketch();
+
+    //! Merge sketches bottom-up after the scan of a tree whose directories use sketches.
+    void buildSketches();
+
+    //! Replace the subtree by a summary: sketches of this directory's files and of the whole
+    //! subtree. Children and files are freed. Returns the estimated number of bytes freed.
+    size_t collapse();
+
+    //! Whether this directory is a summary, see collapse().
+    bool isCollapsed() const
+    { return m_collapsed; }
+
+    //! Whether this directory or any below it is a summary.
+    bool hasCollapsed() const
+    { return m_collapsed || m_hasCollapsed; }
+
+    //! Put a fresh scan of this collapsed directory in its place in the parent. Sizes and
+    //! histograms of the ancestors are updated. The rescan must have the time basis of this
+    //! tree or be able to switch to it. This summary is left detached for the caller to
+    //! retire, see TreeReclaimer.
+    void graft(DirTree *rescanned);
+
+    //! Add the files of the subtree to the sketch, using the summaries of collapsed directories.
+    void summarizeInto(QuantileSketch &sketch) const;
+
+    //! Approximate heap usage in bytes of this directory alone, and of the subtree.
+    size_t memoryUsage() const;
+    size_t subtreeMemoryUsage() const;
+
+    //! Build age histograms bottom-up. Subtrees and directories with at least minFiles entries
+    //! keep theirs; smaller ones are cheap enough to summarize on demand.
+    void buildHistograms(qint64 reference, size_t minFiles);
+
+    //! Approximate chart from the histograms, of the subtree or only of this directory's files.
+    AgeChart approximateChart(bool filesOnly) const;
+
+    //! Add the subtree, or only this directory's files, to the histogram. Stored histograms of
+    //! the same reference are added whole, the rest file by file or from the summaries.
+    void addToHistogram(AgeHistogram &histogram, bool filesOnly) const;
+
+    //! Count the files of every directory and subtree by size and age, bottom-up. Collapsed
+    //! directories have no sizes left and keep the heatmaps built before the collapse.
+    void buildHeatmaps(qint64 reference);
+
+    //! Keep the candidates of this directory's own files, at most TOP_FILES of each kind, with
+    //! times of the active basis. Called by the scanner when the directory is complete.
+    void setTopEntries(std::vector<TopEntry> &&entries);
+
+    //! Merge top files bottom-up. Subtrees with at least TOP_FILES_MIN_FILES entries keep their
+    //! lists, so that topFiles() takes O(TOP_FILES); smaller ones are merged on demand.
+    void buildTopFiles();
+
+    //! Up to TOP_FILES files of the subtree, largest or oldest first. Empty if the scan did not
+    //! track them, and oldest files are only known for the time basis of the scan.
+    std::vector<TopFile> topFiles(TopKind kind) const;
+
+    //! Sort the files of this directory by time, unless that already happened. Files are
+    //! left unsorted by finalize() and sorted on first access; concurrent callers wait.
+    void sortFiles() const;
+
+    //! Sort all directories of the subtree. Returns false if canceled.
+    bool sortAll(const std::function<bool()> &isCanceled = {});
+
+    //! Build cumulative indexes bottom-up for subtrees with at least minFiles entries that no
+    //! index below covers yet, and at least as many as those below cover. A directory above
+    //! a large indexed subtree is answered from that index and its other files, so a chain of
+    //! directories keeps a single copy. Directories that no index covers then get prefix sums
+    //! of their own files if they have many. Both stop once they would take more than
+    //! maxBytes. Zero minFiles disables them. They are published atomically and may be built
+    //! while calculations run. Returns false if canceled.
+    bool buildIndex(size_t minFiles, size_t maxBytes,
+                    const std::function<bool()> &isCanceled = {});
+
+    //! Files of the subtree that queries answer from indexes, its own or those below.
+    size_t numIndexedFiles() const
+    { return m_indexedFiles.load(std::memory_order_acquire); }
+
+    //! Oldest and newest times of the subtree's files. False if it has none.
+    bool timeRange(file_time_t &min, file_time_t &max) const;
+
+    // Order-statistics queries over the subtree. Indexed subtrees are answered with binary
+    // searches in logarithmic time. Others descend to their directories, which after the prepare
+    // pass only happens below the indexing threshold. With sketches the sizes are estimates and
+    // the counts are scaled from them.
+
+    //! Files modified before the time.
+    Totals olderThan(file_time_t time) const;
+    //! Files modified after the time.
+    Totals newerThan(file_time_t time) const;
+    //! Total size of files modified in [from, to).
+    file_size_t sizeBetween(file_time_t from, file_time_t to) const;
+    //! Time of the first file, oldest first, at which the accumulated size reaches the weight.
+    //! The lowest time if the subtree has no files, and meaningless if canceled.
+    file_time_t quantile(file_size_t weight, const std::function<bool()> &isCanceled = {}) const;
 
     //! This should be const but since QModelIndex needs non-const void*, this is not const either.
     DirTree *child(size_t i);
 
+    //! Number the directories in pre-order and keep them in that order. Called on the root
+    //! after the scan; collapse() and graft() renumber a numbered tree.
+    void numberNodes();
+
+    //! Position of this directory in pre-order, and one past its last descendant. Valid once
+    //! the root is numbered.
+    quint32 preorder() const
+    { return m_preorder; }
+
+    quint32 subtreeEnd() const
+    { return m_subtreeEnd; }
+
+    //! Whether the other directory is this one or below it. Constant time once numbered.
+    bool contains(const DirTree *other) const;
+
+    //! Directories of the subtree in pre-order, starting with this one. Empty unless numbered.
+    std::span<DirTree* const> subtreeNodes() const;
+
     void name(const QString& name)
     { m_name = name; }
 
@@ -43,7 +242,10 @@ public:
     { return m_subdirs.size(); }
 
     size_t numFiles() const
-    { return m_files.size(); }
+    { return (m_filesSketch != nullptr) ? m_filesSketch->count() : _files().size(); }
+
+    size_t numSubtreeFiles() const
+    { return m_subtreeFiles; }
 
     //! This should be const but since QModelIndex needs non-const void*, this is not const either.
     DirTree *parent()
@@ -58,21 +260,87 @@ public:
     file_size_t subtreeSize() const
     { return m_subtreeSize; }
 
-    const std::vector<FileInfo> &files() const
-    { return m_files; }
+    std::span<const FileInfo> files() const
+    { sortFiles(); return _files(); }
+
+    //! Subtree files merged by time with cumulative sizes and counts. Equal times are coalesced.
+    class Index
+    {
+    public:
+        //! Bytes per distinct time.
+        static constexpr size_t ENTRY_BYTES = sizeof(file_time_t) + sizeof(file_size_t)
+                + sizeof(size_t);
+
+        size_t size() const
+        { return m_times.size(); }
+
+        file_time_t min() const
+        { return m_times.front(); }
+
+        file_time_t max() const
+        { return m_times.back(); }
+
+        //! Time of the first file at which the accumulated size reaches the weight.
+        file_time_t quantile(file_size_t weight) const;
+
+        //! Files older than the time.
+        Totals before(file_time_t time) const;
+
+        //! Files with equal times, as merged by the index.
+        struct Entry { file_size_t size; file_time_t time; size_t count; };
+
+        //! Expand back to entries, one per distinct time.
+        void appendTo(std::vector<Entry> &out) const;
+
+    private:
+        std::vector<file_time_t>    m_times;
+        std::vector<file_size_t>    m_cumulative;
+        std::vector<size_t>         m_counts;  // Cumulative.
+        friend class DirTree;
+    };
+
+    //! Null unless the tree was scanned with sketches.
+    const QuantileSketch *filesSketch() const
+    { return m_filesSketch.get(); }
 
+    const QuantileSketch *subtreeSketch() const
+    { return (m_subtreeSketch != nullptr) ? m_subtreeSketch.get() : m_filesSketch.get(); }
+
+    //! Null if below the histogram threshold.
+    const AgeHistogram *subtreeHistogram() const
+    { return m_subtreeHistogram.get(); }
+
+    const AgeHistogram *filesHistogram() const
+    { return m_filesHistogram.get(); }
+
+    //! Empty unless heatmaps were built.
+    std::optional<SizeAgeHeatmap> subtreeHeatmap() const;
+
+    //! The files of a directory without files below its own share the subtree's heatmap. Those
+    //! of other directories with few files are counted when asked for.
+    std::optional<SizeAgeHeatmap> filesHeatmap() const;
+
+    //! Null if this subtree was below the indexing threshold.
+    const Index *index() const
+    { return m_index.load(std::memory_order_acquire); }
+
+    //! Merges the files of a whole subtree by ascending time. The runs of all descendants are
+    //! flattened into a single loser tree, so advancing costs one pass from a leaf to the root.
     class iterator
     {
+    public:
+        struct Run { const FileInfo *pos; const FileInfo *end; const DirTree *dir; };
+
     private:
         DirTree*                m_tree;
         FileInfo*               m_current;
-        iterator*               m_subs;
-        size_t                  m_subsSize;
-        size_t                  m_subsCapacity;
-        int                     m_pos;
+        std::vector<Run>        m_runs;
+        std::vector<quint32>    m_losers;  // m_losers[0] holds the winner.
         void _init(DirTree*);
-        void _deinit();
-
+        void _collect(DirTree*);
+        quint32 _build(quint32 node);
+        void _replay(quint32 leaf);
+        bool _less(quint32 a, quint32 b) const;
 
     public:
         using iterator_category = std::forward_iterator_tag;
@@ -80,12 +348,8 @@ public:
         using pointer = FileInfo*;
         using reference = FileInfo&;
 
-        constexpr iterator(DirTree *tree):
+        iterator(DirTree *tree):
             m_tree{tree},
-            m_pos{0},
-            m_subs{nullptr},
-            m_subsSize{0},
-            m_subsCapacity{0},
             m_current{nullptr}
         { if (tree != nullptr) _init(tree); }
 
@@ -95,11 +359,13 @@ public:
         iterator &operator=(iterator&&);
         void swap(iterator&&);
 
-        constexpr ~iterator()
-        { if (m_subs != nullptr) _deinit(); }
+        ~iterator();
 
         reference operator*() const;
         pointer operator->() const;
+        //! Directory of the current file.
+        const DirTree *directory() const
+        { return m_runs[m_losers[0]].dir; }
         iterator& operator++();
         iterator& operator+=(int);
         bool operator==(const iterator&) const;
@@ -113,13 +379,98 @@ public:
     { return iterator(nullptr); }
 
 private:
+    enum SortState: quint8 { UNSORTED, SORTING, SORTED };
+    std::span<FileInfo> _files() const
+    { return (m_spilled != nullptr) ? std::span(m_spilled, m_numSpilled) : std::span(m_files); }
+    void _sort() const;
+    size_t _buildIndex(size_t minFiles, size_t &maxBytes,
+                       const std::function<bool()> &isCanceled);
+    bool _buildPrefixSums(size_t &maxBytes, const std::function<bool()> &isCanceled);
+    size_t _buildHistograms(size_t minFiles, AgeHistogram &subtree);
+    void _addSubtreeTo(AgeHistogram &histogram) const;
+    void _buildHeatmaps(qint64 reference, SizeAgeHeatmap::Counts &subtree);
+    void _updateHeatmap(const DirTree *changed, qint64 reference,
+                        SizeAgeHeatmap::Counts &counts);
+    SizeAgeHeatmap::Levels _countFiles(qint64 reference) const;
+    void _addBefore(file_time_t time, Totals &totals) const;
+    void _timeRange(file_time_t &min, file_time_t &max) const;
+    void _updateHasCollapsed();
+    void _switchTimeBasis(TimeBasis basis);
+    void _updateTopFiles();
+    DirTree *_root() const;
+    quint32 _number(quint32 next, std::vector<DirTree*> &nodes);
+    void _collectTopFiles(TopKind kind, std::vector<TopFile> &out) const;
+    using AttributeMap = std::array<std::vector<attribute_t>, AttributeDictionary::NUM_DIMENSIONS>;
+    void _translateAttributes(const AttributeMap &map);
+
+    //! Recorded times other than the active one and attributes, in the order of the files.
+    //! Spilled columns replace the vectors.
+    struct Columns
+    {
+        static constexpr int NUM_DIMENSIONS = AttributeDictionary::NUM_DIMENSIONS;
+        std::array<std::vector<file_time_t>, NUM_TIME_BASES>    times;
+        std::array<file_time_t*, NUM_TIME_BASES>                spilledTimes{};
+        std::array<std::vector<attribute_t>, NUM_DIMENSIONS>    attributes;
+        std::array<attribute_t*, NUM_DIMENSIONS>                spilledAttributes{};
+
+        file_time_t *time(int basis)
+        { return (spilledTimes[basis] != nullptr) ? spilledTimes[basis] : times[basis].data(); }
+
+        attribute_t *attribute(int dimension)
+        {
+            return (spilledAttributes[dimension] != nullptr) ? spilledAttributes[dimension]
+                                                             : attributes[dimension].data();
+        }
+
+        void moveTime(int from, int to)
+        {
+            times[to] = std::move(times[from]);
+            times[from] = std::vector<file_time_t>();
+            spilledTimes[to] = spilledTimes[from];
+            spilledTimes[from] = nullptr;
+        }
+    };
+
     QString                 m_name;
-    std::vector<FileInfo>   m_files;
+    mutable std::vector<FileInfo>   m_files;  // Empty once spilled.
+    FileInfo*               m_spilled;  // Sorted files in the spill file.
+    size_t                  m_numSpilled;
+    mutable std::atomic<quint8>     m_sortState;
     std::vector<DirTree*>   m_subdirs;
     DirTree*                m_parent;
     size_t                  m_parentPos;
+    quint32                 m_preorder;
+    quint32                 m_subtreeEnd;  // Zero until numbered.
+    std::vector<DirTree*>   m_nodes;  // Only on the root, in pre-order.
+    qint64                  m_heatmapReference;  // Only on the root, of all heatmaps.
     file_size_t             m_filesSize;
     file_size_t             m_subtreeSize;
+    size_t                  m_subtreeFiles;
+    std::atomic<Index*>     m_index;
+    std::atomic<std::vector<file_size_t>*>  m_prefixSums;  // Of many own files, if not indexed.
+    std::atomic<size_t>     m_indexedFiles;
+    std::unique_ptr<AgeHistogram>   m_subtreeHistogram;
+    std::unique_ptr<AgeHistogram>   m_filesHistogram;
+    std::unique_ptr<SizeAgeHeatmap::Levels> m_subtreeHeatmap;
+    std::unique_ptr<SizeAgeHeatmap::Levels> m_filesHeatmap;  // Of many files beside subdirs.
+    std::unique_ptr<QuantileSketch> m_filesSketch;
+    std::unique_ptr<QuantileSketch> m_subtreeSketch;  // Null if equal to the files sketch.
+    std::unique_ptr<SpillFile>      m_spillFile;  // Only on the root of a scan.
+    bool                    m_collapsed;
+    bool                    m_hasCollapsed;  // Some descendant is collapsed.
+    TimeBasis               m_timeBasis;
+    quint8                  m_timeBases;  // Recorded, including the active one.
+    quint8                  m_dimensions;  // Recorded attributes.
+    std::unique_ptr<Columns>        m_columns;  // Null unless more than one time or attributes.
+    std::unique_ptr<AttributeDictionary>    m_dictionary;  // Only on the root of a scan.
+
+    struct TopFiles
+    {
+        TimeBasis                       basis;  // Of the times in the entries.
+        std::vector<TopEntry>           entries;  // Own files, largest and oldest.
+        std::array<std::vector<TopFile>, NUM_TOP_KINDS>     subtree;  // Empty below minFiles.
+    };
+    std::unique_ptr<TopFiles>       m_topFiles;  // Null if there is nothing to keep.
 };
 
 #endif // DIRTREE_H
@@ -0,0 +1,352 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QWaitCondition>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <vector>
+#include "executor.h"
+
+using Clock = std::chrono::steady_clock;
+using Priority = Executor::Priority;
+
+// CancelToken
+
+CancelToken::CancelToken():
+    m_state{std::make_shared<State>()}
+{ }
+
+CancelToken CancelToken::child() const
+{
+    CancelToken token;
+    token.m_state->parent = m_state;
+    return token;
+}
+
+void CancelToken::cancel()
+{
+    m_state->canceled.store(true, std::memory_order_release);
+}
+
+bool CancelToken::isCanceled() const
+{
+    for (const State *s = m_state.get(); s != nullptr; s = s->parent.get()) {
+        if (s->canceled.load(std::memory_order_acquire))
+            return true;
+    }
+    return false;
+}
+
+// Executor
+
+namespace {
+
+struct Task
+{
+    std::function<void()>   run;
+    CancelToken             token;
+    Priority                priority;
+    Clock::time_point       queued;
+};
+
+struct Worker
+{
+    QMutex                                              lock;
+    std::array<std::deque<Task>, Executor::NUM_PRIORITIES>  queues;
+    QThread*                                            thread = nullptr;
+};
+
+struct Counters
+{
+    std::atomic<size_t>     queued{0};
+    std::atomic<size_t>     running{0};
+    std::atomic<quint64>    started{0};
+    std::atomic<quint64>    finished{0};
+    std::atomic<quint64>    canceled{0};
+    std::atomic<quint64>    waitNs{0};
+    std::atomic<quint64>    maxWaitNs{0};
+};
+
+// Index of the worker running on this thread, or -1.
+thread_local int t_worker = -1;
+
+}
+
+class Executor::Private
+{
+public:
+    Private():
+        m_limit{std::max(1, QThread::idealThreadCount())},
+        m_nonInteractive{0},
+        m_nextWorker{0},
+        m_idle{0},
+        m_generation{0},
+        m_stopping{false}
+    {
+        // One more worker than cores, kept for interactive tasks.
+        for (int i = 0; i <= m_limit; ++i) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+        for (int i = 0; i <= m_limit; ++i) {
+            m_workers[i]->thread = QThread::create([this, i]() { work(i); });
+            m_workers[i]->thread->start();
+        }
+    }
+
+    ~Private()
+    {
+        {
+            QMutexLocker l{&m_sleepLock};
+            m_stopping = true;
+            ++m_generation;
+            m_wake.wakeAll();
+        }
+        for (std::unique_ptr<Worker> &w : m_workers) {
+            w->thread->wait();
+            delete w->thread;
+        }
+    }
+
+    int threadCount() const
+    { return m_limit; }
+
+    void start(Priority priority, std::function<void()> &&run, CancelToken &&token)
+    {
+        size_t w = (t_worker >= 0) ? t_worker : m_nextWorker++ % m_workers.size();
+        counters(priority).queued++;
+        {
+            QMutexLocker l{&m_workers[w]->lock};
+            m_workers[w]->queues[index(priority)].push_back(
+                        Task{std::move(run), std::move(token), priority, Clock::now()});
+        }
+        QMutexLocker l{&m_sleepLock};
+        ++m_generation;
+        m_wake.wakeOne();
+    }
+
+    bool tryStart(Priority priority, std::function<void()> &&run)
+    {
+        QMutexLocker l{&m_sleepLock};
+        if (m_stopping || m_idle <= m_helpers.size())
+            return false;
+        // Helpers of other classes hold their share of the cores from now on.
+        if (priority != Priority::INTERACTIVE && !reserve())
+            return false;
+        counters(priority).queued++;
+        m_helpers.push_back(Task{std::move(run), CancelToken(), priority, Clock::now()});
+        ++m_generation;
+        m_wake.wakeAll();
+        return true;
+    }
+
+    Stats stats() const
+    {
+        Stats ret;
+        for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+            const Counters &c = m_counters[i];
+            quint64 started = c.started.load();
+            ret[i] = ClassStats{
+                .queued = c.queued.load(),
+                .running = c.running.load(),
+                .finished = c.finished.load(),
+                .canceled = c.canceled.load(),
+                .meanWaitMs = (started > 0) ? c.waitNs.load() / 1e6 / started : 0.0,
+                .maxWaitMs = c.maxWaitNs.load() / 1e6
+            };
+        }
+        return ret;
+    }
+
+private:
+    static size_t index(Priority priority)
+    { return static_cast<size_t>(priority); }
+
+    Counters &counters(Priority priority)
+    { return m_counters[index(priority)]; }
+
+    //! Take one of the cores for a task that is not interactive.
+    bool reserve()
+    {
+        if (m_nonInteractive.fetch_add(1) < m_limit)
+            return true;
+        m_nonInteractive.fetch_sub(1);
+        return false;
+    }
+
+    void work(int self)
+    {
+        t_worker = self;
+        for (;;) {
+            quint64 generation;
+            std::optional<Task> task;
+            {
+                QMutexLocker l{&m_sleepLock};
+                generation = m_generation;
+                if (!m_helpers.empty()) {
+                    task = std::move(m_helpers.front());
+                    m_helpers.pop_front();
+                }
+            }
+            if (!task.has_value())
+                task = take(self);
+            if (task.has_value()) {
+                run(*task);
+                continue;
+            }
+            QMutexLocker l{&m_sleepLock};
+            if (m_stopping)
+                return;
+            if (generation != m_generation)
+                continue;
+            ++m_idle;
+            m_wake.wait(&m_sleepLock);
+            --m_idle;
+        }
+    }
+
+    //! Highest class first: the newest own task, or else the oldest task of another worker.
+    //! Tasks that are not interactive are only taken while there are cores for them.
+    std::optional<Task> take(int self)
+    {
+        for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+            if (i != index(Priority::INTERACTIVE) && !reserve())
+                return std::nullopt;
+            for (size_t k = 0; k < m_workers.size(); ++k) {
+                Worker &w = *m_workers[(self + k) % m_workers.size()];
+                QMutexLocker l{&w.lock};
+                std::deque<Task> &queue = w.queues[i];
+                if (queue.empty())
+                    continue;
+                Task task = std::move((k == 0) ? queue.back() : queue.front());
+                if (k == 0)
+                    queue.pop_back();
+                else
+                    queue.pop_front();
+                return task;
+            }
+            if (i != index(Priority::INTERACTIVE))
+                m_nonInteractive.fetch_sub(1);
+        }
+        return std::nullopt;
+    }
+
+    void run(Task &task)
+    {
+        Counters &c = counters(task.priority);
+        quint64 wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - task.queued).count();
+        c.queued--;
+        c.running++;
+        c.started++;
+        c.waitNs += wait;
+        quint64 max = c.maxWaitNs.load();
+        while (max < wait && !c.maxWaitNs.compare_exchange_weak(max, wait)) { }
+        bool canceled = task.token.isCanceled();
+
+        task.run();
+        // Captures such as tree pins go before the task counts as finished.
+        task.run = nullptr;
+
+        c.running--;
+        c.finished++;
+        if (canceled)
+            c.canceled++;
+        if (task.priority != Priority::INTERACTIVE) {
+            m_nonInteractive.fetch_sub(1);
+            // A task held back for lack of cores may start now.
+            QMutexLocker l{&m_sleepLock};
+            ++m_generation;
+            m_wake.wakeOne();
+        }
+    }
+
+    const int                               m_limit;  // Cores for tasks that are not interactive.
+    std::atomic<int>                        m_nonInteractive;  // Running or reserved.
+    std::vector<std::unique_ptr<Worker>>    m_workers;
+    std::atomic<size_t>                     m_nextWorker;
+    std::array<Counters, NUM_PRIORITIES>    m_counters;
+
+    QMutex                                  m_sleepLock;
+    QWaitCondition                          m_wake;
+    std::deque<Task>                        m_helpers;
+    size_t                                  m_idle;
+    // Changes whenever work may be available.
+    quint64                                 m_generation;
+    bool                                    m_stopping;
+};
+
+Executor::Executor():
+    p{std::make_unique<Private>()}
+{ }
+
+Executor::~Executor()
+{ }
+
+Executor &Executor::instance()
+{
+    static Executor executor;
+    return executor;
+}
+
+int Executor::threadCount() const
+{
+    return p->threadCount();
+}
+
+void Executor::start(Priority priority, std::function<void()> task, CancelToken token)
+{
+    p->start(priority, std::move(task), std::move(token));
+}
+
+void Executor::start(Priority priority, QRunnable *task, CancelToken token)
+{
+    p->start(priority, [task]() {
+        // An owner that keeps the task may delete it as soon as it finished running.
+        const bool autoDelete = task->autoDelete();
+        task->run();
+        if (autoDelete)
+            delete task;
+    }, std::move(token));
+}
+
+bool Executor::tryStart(Priority priority, std::function<void()> task)
+{
+    return p->tryStart(priority, std::move(task));
+}
+
+bool Executor::tryStart(Priority priority, QRunnable *task)
+{
+    return p->tryStart(priority, [task]() {
+        // An owner that keeps the task may delete it as soon as it finished running.
+        const bool autoDelete = task->autoDelete();
+        task->run();
+        if (autoDelete)
+            delete task;
+    });
+}
+
+Executor::Stats Executor::stats() const
+{
+    return p->stats();
+}
+
+const char *Executor::priorityName(Priority priority)
+{
+    switch (priority) {
+    case Priority::INTERACTIVE: return "Interactive";
+    case Priority::VISIBLE: return "Visible rows";
+    case Priority::BACKGROUND: return "Background";
+    case Priority::REPORT: return "Reports";
+    default: return "";
+    }
+}
@@ -0,0 +1,109 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+class QRunnable;
+
+//! Cancellation shared by a group of tasks. Canceling a token cancels all tokens derived from
+//! it with child(), but not its parent. Copies share the state.
+class CancelToken
+{
+public:
+    CancelToken();
+
+    //! New token that is also canceled with this one.
+    CancelToken child() const;
+
+    void cancel();
+
+    bool isCanceled() const;
+
+private:
+    struct State
+    {
+        std::atomic<bool>       canceled{false};
+        std::shared_ptr<State>  parent;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+//! Worker threads shared by all services. Tasks are queued by priority class and started
+//! highest class first. Each worker has its own queues: tasks started from a worker go to
+//! its queues and are taken newest first, and idle workers steal the oldest tasks of others.
+//! One worker is kept for interactive tasks, so that a search or group-by never waits for
+//! long background work to finish. Scans are long, so they are not interactive.
+class Executor
+{
+public:
+    enum class Priority {
+        INTERACTIVE,  // The user waits for it briefly: searches, group-by.
+        VISIBLE,      // Charts of rows on screen, and scans.
+        BACKGROUND,   // Precomputing and cleaning up.
+        REPORT,
+        SENTINEL
+    };
+    static constexpr size_t NUM_PRIORITIES = static_cast<size_t>(Priority::SENTINEL);
+
+    struct ClassStats
+    {
+        size_t  queued;
+        size_t  running;
+        quint64 finished;
+        //! Finished tasks whose token was canceled before they started.
+        quint64 canceled;
+        //! Time from start() until a worker took the task.
+        double  meanWaitMs;
+        double  maxWaitMs;
+    };
+    using Stats = std::array<ClassStats, NUM_PRIORITIES>;
+
+    static Executor &instance();
+
+    //! Number of workers that run tasks other than interactive ones.
+    int threadCount() const;
+
+    //! Queue the task. It runs even if the token is canceled by then, so that it can finish
+    //! its promise, but should return right away.
+    void start(Priority priority, std::function<void()> task, CancelToken token = CancelToken());
+
+    //! Queue the runnable like QThreadPool::start(). It is deleted after it ran if autoDelete()
+    //! is set.
+    void start(Priority priority, QRunnable *task, CancelToken token = CancelToken());
+
+    //! Start the task on an idle worker right away, or not at all. For helpers that share the
+    //! work of a running task, which may wait for them.
+    bool tryStart(Priority priority, std::function<void()> task);
+
+    //! Start the runnable on an idle worker right away, or not at all. It is deleted after it
+    //! ran if autoDelete() is set, and not if it did not start.
+    bool tryStart(Priority priority, QRunnable *task);
+
+    Stats stats() const;
+
+    static const char *priorityName(Priority priority);
+
+private:
+    Executor();
+    ~Executor();
+    Q_DISABLE_COPY(Executor)
+
+    class Private;
+    std::unique_ptr<Private> p;
+};
+
+#endif // EXECUTOR_H
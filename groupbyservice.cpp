@@ -0,0 +1,237 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <QPromise>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "executor.h"
+#include "groupbyservice.h"
+#include "treereclaimer.h"
+
+// Directories taken from the shared list at a time, to keep the counter cold.
+constexpr size_t GROUPBY_BATCH = 16;
+
+//! Per-group accumulator of one worker. Sketches are only allocated for groups that occur.
+struct GroupAccumulator
+{
+    DirTree::Totals                 totals{0, 0};
+    std::unique_ptr<QuantileSketch> sketch;
+};
+
+struct GroupByRun
+{
+    GroupByRun(DirTree *tree, DirTree::Dimension dimension, int numWorkers):
+        tree{tree},
+        dimension{dimension},
+        locals(numWorkers),
+        remaining{numWorkers}
+    {
+        promise.start();
+    }
+
+    DirTree*                            tree;
+    TreeReclaimer::Pin                  pin{TreeReclaimer::pin()};
+    DirTree::Dimension                  dimension;
+    QPromise<GroupByService::Result>    promise;
+    std::once_flag                      collected;
+    std::span<DirTree* const>           dirs;  // Pre-order.
+    std::vector<DirTree*>               ownDirs;  // If the tree is not numbered.
+    std::atomic<size_t>                 next{0};
+    std::vector<std::vector<GroupAccumulator>>  locals;
+    std::vector<DirTree::Totals>        unattributed;
+    std::atomic<int>                    remaining;
+
+    void collect()
+    {
+        unattributed.assign(locals.size(), DirTree::Totals{0, 0});
+        dirs = tree->subtreeNodes();
+        if (!dirs.empty())
+            return;
+        std::vector<DirTree*> stack{tree};
+        while (!stack.empty()) {
+            DirTree *t = stack.back();
+            stack.pop_back();
+            ownDirs.push_back(t);
+            for (size_t i = t->numChildren(); i > 0; --i) {
+                stack.push_back(t->child(i - 1));
+            }
+        }
+        dirs = ownDirs;
+    }
+};
+
+//! Each worker aggregates whole directories into its own accumulators, with ids as indexes.
+//! The last one to finish merges them, so no locks are taken while aggregating.
+class GroupByWorker: public QRunnable
+{
+public:
+    GroupByWorker(std::shared_ptr<GroupByRun> run, int num):
+        m_run{std::move(run)},
+        m_num{num}
+    { }
+
+    virtual void run() override
+    {
+        GroupByRun &r = *m_run;
+        std::call_once(r.collected, [&r]() { r.collect(); });
+        const AttributeDictionary *dictionary = r.tree->dictionary();
+        // The last slot is for AttributeDictionary::OTHER.
+        size_t numIds = (dictionary != nullptr) ? dictionary->size(r.dimension) + 1 : 0;
+        std::vector<GroupAccumulator> &local = r.locals[m_num];
+        local.resize(numIds);
+        DirTree::Totals &unattributed = r.unattributed[m_num];
+        while (!r.promise.isCanceled()) {
+            size_t begin = r.next.fetch_add(GROUPBY_BATCH, std::memory_order_relaxed);
+            if (begin >= r.dirs.size())
+                break;
+            size_t end = std::min(begin + GROUPBY_BATCH, r.dirs.size());
+            for (size_t i = begin; i < end; ++i) {
+                process(r.dirs[i], local, unattributed);
+            }
+        }
+        if (r.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            finish(dictionary);
+    }
+
+private:
+    void process(const DirTree *t, std::vector<GroupAccumulator> &local,
+                 DirTree::Totals &unattributed)
+    {
+        if (t->isCollapsed()) {
+            unattributed.size += t->subtreeSize();
+            unattributed.count += t->numSubtreeFiles();
+            return;
+        }
+        std::span<const DirTree::attribute_t> ids = t->attributes(m_run->dimension);
+        if (ids.empty() || local.empty()) {
+            unattributed.size += t->filesSize();
+            unattributed.count += t->numFiles();
+            return;
+        }
+        std::span<const DirTree::FileInfo> files = t->files();
+        const size_t other = local.size() - 1;
+        for (size_t i = 0; i < files.size(); ++i) {
+            size_t id = (ids[i] == AttributeDictionary::OTHER) ? other : ids[i];
+            GroupAccumulator &acc = local[id];
+            acc.totals.size += files[i].size;
+            acc.totals.count += 1;
+            if (acc.sketch == nullptr)
+                acc.sketch = std::make_unique<QuantileSketch>();
+            acc.sketch->add(files[i].time, files[i].size);
+        }
+    }
+
+    void finish(const AttributeDictionary *dictionary)
+    {
+        GroupByRun &r = *m_run;
+        if (r.promise.isCanceled()) {
+            r.promise.finish();
+            return;
+        }
+        GroupByService::Result result;
+        result.dimension = r.dimension;
+        result.unattributed = DirTree::Totals{0, 0};
+        for (const DirTree::Totals &u : r.unattributed) {
+            result.unattributed.size += u.size;
+            result.unattributed.count += u.count;
+        }
+        std::vector<GroupAccumulator> &merged = r.locals[0];
+        for (size_t w = 1; w < r.locals.size(); ++w) {
+            for (size_t id = 0; id < merged.size(); ++id) {
+                GroupAccumulator &from = r.locals[w][id];
+                if (from.sketch == nullptr)
+                    continue;
+                GroupAccumulator &to = merged[id];
+                to.totals.size += from.totals.size;
+                to.totals.count += from.totals.count;
+                if (to.sketch == nullptr) {
+                    to.sketch = std::move(from.sketch);
+                }
+                else {
+                    from.sketch->finalize();
+                    to.sketch->add(*from.sketch);
+                }
+            }
+        }
+        for (size_t id = 0; id < merged.size(); ++id) {
+            GroupAccumulator &acc = merged[id];
+            if (acc.sketch == nullptr)
+                continue;
+            acc.sketch->finalize();
+            auto attribute = (id + 1 == merged.size()) ? AttributeDictionary::OTHER
+                                                       : static_cast<DirTree::attribute_t>(id);
+            result.groups.push_back(GroupByService::Group{
+                .id = attribute,
+                .name = dictionary->name(r.dimension, attribute),
+                .totals = acc.totals,
+                .chart = acc.sketch->chart()
+            });
+        }
+        std::sort(result.groups.begin(), result.groups.end(),
+                  [](const GroupByService::Group &a, const GroupByService::Group &b) {
+                      return a.totals.size > b.totals.size;
+                  });
+        r.promise.addResult(std::move(result));
+        r.promise.finish();
+    }
+
+    std::shared_ptr<GroupByRun>     m_run;
+    int                             m_num;
+};
+
+struct GroupByServicePrivate
+{
+    std::shared_ptr<GroupByRun>     run;
+
+    void cancel()
+    {
+        if (run != nullptr) {
+            auto fut = run->promise.future();
+            fut.cancel();
+            fut.waitForFinished();
+            run.reset();
+        }
+    }
+
+    ~GroupByServicePrivate()
+    {
+        cancel();
+    }
+};
+
+GroupByService::GroupByService(QObject *parent)
+    : QObject{parent},
+      p(new GroupByServicePrivate)
+{
+
+}
+
+GroupByService::~GroupByService()
+{
+    delete p;
+}
+
+QFuture<GroupByService::Result> GroupByService::start(DirTree *tree, DirTree::Dimension dimension)
+{
+    p->cancel();
+    // Interactive tasks may also use the worker kept for them.
+    int numWorkers = Executor::instance().threadCount() + 1;
+    p->run = std::make_shared<GroupByRun>(tree, dimension, numWorkers);
+    auto fut = p->run->promise.future();
+    for (int i = 0; i < numWorkers; ++i) {
+        Executor::instance().start(Executor::Priority::INTERACTIVE, new GroupByWorker(p->run, i));
+    }
+    return fut;
+}
+
+void GroupByService::cancel()
+{
+    p->cancel();
+}
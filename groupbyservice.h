@@ -0,0 +1,52 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef GROUPBYSERVICE_H
+#define GROUPBYSERVICE_H
+
+#include <QObject>
+#include <QFuture>
+#include "agechart.h"
+#include "dirtree.h"
+
+// Breaks the files of a subtree down by an attribute for the Controller.
+
+struct GroupByServicePrivate;
+class GroupByService final: public QObject
+{
+    Q_OBJECT
+public:
+    explicit GroupByService(QObject *parent = nullptr);
+    ~GroupByService();
+
+    struct Group
+    {
+        DirTree::attribute_t    id;
+        QString                 name;
+        DirTree::Totals         totals;
+        AgeChart                chart;  // From a sketch, see AgeChart::errorBound.
+    };
+
+    struct Result
+    {
+        DirTree::Dimension      dimension;
+        std::vector<Group>      groups;  // Largest first.
+        //! Files without the attribute: summarized, or scanned without it.
+        DirTree::Totals         unattributed;
+    };
+
+    //! Aggregate in parallel. Cancels a previous run.
+    QFuture<Result> start(DirTree *tree, DirTree::Dimension dimension);
+    void cancel();
+
+private:
+    GroupByServicePrivate *p;
+};
+
+#endif // GROUPBYSERVICE_H
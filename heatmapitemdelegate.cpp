@@ -0,0 +1,94 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "heatmapitemdelegate.h"
+#include "dirmodel.h"
+#include "sizeageheatmap.h"
+#include <QApplication>
+#include <QPainter>
+#include <QPalette>
+
+// Width of the column in row heights, so that the cells are twice as wide as they are high.
+constexpr int HEATMAP_WIDTH_PER_HEIGHT = 2;
+
+static QColor blend(const QColor &from, const QColor &to, double t)
+{
+    return QColor::fromRgbF(from.redF() + (to.redF() - from.redF()) * t,
+                            from.greenF() + (to.greenF() - from.greenF()) * t,
+                            from.blueF() + (to.blueF() - from.blueF()) * t);
+}
+
+HeatmapItemDelegate::HeatmapItemDelegate(QObject* parent):
+    QStyledItemDelegate(parent)
+{
+    m_rowHeight = QApplication::style()->pixelMetric(QStyle::PM_LargeIconSize);
+    calculateColors();
+}
+
+void HeatmapItemDelegate::paint(QPainter *painter,
+                                const QStyleOptionViewItem &option,
+                                const QModelIndex &index) const
+{
+    if (index.column() != DirModel::C_HEATMAP) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    QVariant v = index.data(Qt::DisplayRole);
+    if (!v.canConvert<SizeAgeHeatmap>())
+        return;
+    const SizeAgeHeatmap heatmap = v.value<SizeAgeHeatmap>();
+    const int maxLevel = heatmap.maxLevel();
+    if (maxLevel == 0)
+        return;
+
+    QRect rect = option.rect.adjusted(1, 1, -1, -1);
+    const int cellWidth = qMax(1, rect.width() / SizeAgeHeatmap::AGE_BUCKETS);
+    const int cellHeight = qMax(1, rect.height() / SizeAgeHeatmap::SIZE_BUCKETS);
+    // Centered, with what the cells do not fill around them.
+    const int left = rect.x()
+            + (rect.width() - cellWidth * SizeAgeHeatmap::AGE_BUCKETS) / 2;
+    const int bottom = rect.y()
+            + (rect.height() + cellHeight * SizeAgeHeatmap::SIZE_BUCKETS) / 2;
+
+    painter->save();
+    painter->setPen(Qt::NoPen);
+    for (int s = 0; s < SizeAgeHeatmap::SIZE_BUCKETS; ++s) {
+        for (int a = 0; a < SizeAgeHeatmap::AGE_BUCKETS; ++a) {
+            quint8 level = heatmap.level(s, a);
+            if (level == 0)
+                continue;
+            // Levels are logarithmic already.
+            double t = static_cast<double>(level) / maxLevel;
+            painter->fillRect(left + (SizeAgeHeatmap::AGE_BUCKETS - 1 - a) * cellWidth,
+                              bottom - (s + 1) * cellHeight,
+                              cellWidth, cellHeight,
+                              blend(m_lowColor, m_highColor, t));
+        }
+    }
+    painter->restore();
+}
+
+QSize HeatmapItemDelegate::sizeHint(const QStyleOptionViewItem &option,
+                                    const QModelIndex &index) const
+{
+    QSize hint = QStyledItemDelegate::sizeHint(option, index);
+    hint.setHeight(m_rowHeight);
+    hint.setWidth(m_rowHeight * HEATMAP_WIDTH_PER_HEIGHT);
+    return hint;
+}
+
+void HeatmapItemDelegate::calculateColors()
+{
+    QPalette palette = QApplication::palette();
+    QColor bgColor = palette.color(QPalette::Active, QPalette::Window);
+    m_highColor = palette.color(QPalette::Active, QPalette::WindowText);
+    // A quarter of the way from the background, so that the fewest files are still visible.
+    m_lowColor = blend(bgColor, m_highColor, 0.25);
+}
@@ -0,0 +1,42 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef HEATMAPITEMDELEGATE_H
+#define HEATMAPITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QColor>
+
+//! Paints a SizeAgeHeatmap: age from old on the left to new on the right, like the box plots,
+//! and size from small at the bottom to large at the top. Darker cells hold more files.
+class HeatmapItemDelegate final : public QStyledItemDelegate
+{
+    Q_OBJECT
+public:
+    HeatmapItemDelegate(QObject* parent = nullptr);
+
+    // QAbstractItemDelegate interface
+public:
+    virtual void paint(QPainter *painter,
+                       const QStyleOptionViewItem &option,
+                       const QModelIndex &index) const override;
+
+    virtual QSize sizeHint(const QStyleOptionViewItem &option,
+                           const QModelIndex &index) const override;
+
+public slots:
+    void calculateColors();
+
+private:
+    int m_rowHeight;
+    QColor m_lowColor;
+    QColor m_highColor;
+};
+
+#endif // HEATMAPITEMDELEGATE_H
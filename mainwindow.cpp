@@ -8,14 +8,21 @@
  */
 
 #include <QActionGroup>
+#include <QDialog>
 #include <QToolButton>
+#include <QTreeWidget>
+#include <QVBoxLayout>
 #include <QLineEdit>
+#include <QScrollBar>
 #include <QShortcut>
 #include <functional>
+#include <tuple>
+#include <vector>
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 
 #include "agechartitemdelegate.h"
+#include "heatmapitemdelegate.h"
 
 static void topDown(const QAbstractItemModel *model,
                     const QModelIndex &from,
@@ -91,6 +98,110 @@ MainWindow::MainWindow(Controller *controller, DirModel *model, QWidget *parent)
         ui->treeView->viewport()->update();
     });
 
+    // Scan options.
+    QToolButton *optionsButton = new QToolButton(this);
+    optionsButton->setText("Options");
+    optionsButton->setPopupMode(QToolButton::InstantPopup);
+    optionsButton->setIcon(QIcon::fromTheme("configure"));
+    optionsButton->setToolButtonStyle(Qt::ToolButtonTextBesideIcon);
+    QMenu *optionsMenu = new QMenu("Options", this);
+    QAction *sketchModeAction = optionsMenu->addAction("Low memory (approximate charts)");
+    sketchModeAction->setCheckable(true);
+    sketchModeAction->setToolTip("Keep only a summary of each directory. "
+                                 "Applies to the next scan.");
+    connect(sketchModeAction, &QAction::toggled, controller, &Controller::onSketchModeToggled);
+    QAction *spillAction = optionsMenu->addAction("Keep file lists on disk");
+    spillAction->setCheckable(true);
+    spillAction->setToolTip("Move scanned file lists to a temporary file. "
+                            "Applies to the next scan.");
+    connect(spillAction, &QAction::toggled, controller, &Controller::onSpillToDiskToggled);
+    QAction *budgetAction = optionsMenu->addAction("Memory Budget...");
+    connect(budgetAction, &QAction::triggered, controller, &Controller::onMemoryBudgetAction);
+    QAction *indexAction = optionsMenu->addAction("Index Threshold...");
+    indexAction->setToolTip("Index large subtrees for faster charts, about 24 bytes per file. "
+                            "Applies to the next scan.");
+    connect(indexAction, &QAction::triggered, controller, &Controller::onIndexThresholdAction);
+    QMenu *timeMenu = optionsMenu->addMenu("Time");
+    QActionGroup *timeGroup = new QActionGroup(this);
+    const std::pair<const char*, DirTree::TimeBasis> timeBases[] = {
+        { "Modified", DirTree::MTIME }, { "Accessed", DirTree::ATIME },
+        { "Changed", DirTree::CTIME }, { "Created", DirTree::BTIME } };
+    for (auto [text, basis] : timeBases) {
+        QAction *a = timeGroup->addAction(text);
+        a->setCheckable(true);
+        a->setChecked(basis == DirTree::MTIME);
+        connect(a, &QAction::triggered, controller, [controller, basis = basis]() {
+            controller->onTimeBasisChosen(basis);
+        });
+    }
+    timeMenu->addActions(timeGroup->actions());
+    timeMenu->addSeparator();
+    QAction *allTimesAction = timeMenu->addAction("Record All Times");
+    allTimesAction->setCheckable(true);
+    allTimesAction->setToolTip("Keep every timestamp so that the time can be switched without "
+                               "a rescan. Applies to the next scan.");
+    connect(allTimesAction, &QAction::toggled, controller, &Controller::onRecordAllTimesToggled);
+    QMenu *whiskersMenu = optionsMenu->addMenu("Whiskers");
+    QActionGroup *whiskersGroup = new QActionGroup(this);
+    for (int i = 0; i < int(ChartPercentiles::Whiskers::SENTINEL); ++i) {
+        auto whiskers = static_cast<ChartPercentiles::Whiskers>(i);
+        QAction *a = whiskersGroup->addAction(ChartPercentiles::name(whiskers));
+        a->setCheckable(true);
+        a->setChecked(whiskers == ChartPercentiles::whiskers());
+        connect(a, &QAction::triggered, controller, [controller, whiskers]() {
+            controller->onWhiskersChosen(whiskers);
+        });
+    }
+    whiskersMenu->addActions(whiskersGroup->actions());
+    QMenu *statsMenu = optionsMenu->addMenu("Statistics");
+    const std::tuple<const char*, ChartStore::Metric, std::vector<int>> metrics[] = {
+        { "Median Age by Count", ChartStore::M_COUNT_PERCENTILES, {DirModel::C_COUNT_MEDIAN_AGE} },
+        { "Mean Age and Deviation", ChartStore::M_AGE_MOMENTS,
+          {DirModel::C_MEAN_AGE, DirModel::C_AGE_STDDEV} },
+        { "Small Files", ChartStore::M_SMALL_FILES, {DirModel::C_SMALL_FILES} } };
+    for (const auto &[text, metric, columns] : metrics) {
+        QAction *a = statsMenu->addAction(text);
+        a->setCheckable(true);
+        a->setToolTip("Computed with the charts of the whole tree and added to reports.");
+        connect(a, &QAction::toggled, this,
+                [this, metric = metric, columns = columns](bool enabled) {
+            for (int column : columns) {
+                ui->treeView->setColumnHidden(column, !enabled);
+            }
+            m_controller->onMetricToggled(metric, enabled);
+        });
+    }
+    QAction *topFilesAction = optionsMenu->addAction("Track Largest and Oldest Files");
+    topFilesAction->setCheckable(true);
+    topFilesAction->setToolTip("Remember the largest and oldest files of each directory. "
+                               "Applies to the next scan.");
+    connect(topFilesAction, &QAction::toggled, controller, &Controller::onTrackTopFilesToggled);
+    QAction *heatmapsAction = optionsMenu->addAction("Size \u00d7 Age Heatmaps");
+    heatmapsAction->setCheckable(true);
+    heatmapsAction->setToolTip("Count the files of each directory by size and age, a few "
+                               "hundred bytes per directory. Applies to the next scan.");
+    connect(heatmapsAction, &QAction::toggled, this, [this](bool enabled) {
+        ui->treeView->setColumnHidden(DirModel::C_HEATMAP, !enabled);
+        m_controller->onHeatmapsToggled(enabled);
+    });
+    QMenu *attributesMenu = optionsMenu->addMenu("Record Attributes");
+    attributesMenu->setToolTip("Record attributes for breakdowns, two bytes per file each. "
+                               "Applies to the next scan.");
+    for (int d = 0; d < AttributeDictionary::NUM_DIMENSIONS; ++d) {
+        auto dimension = static_cast<DirTree::Dimension>(d);
+        QAction *a = attributesMenu->addAction(AttributeDictionary::dimensionName(dimension));
+        a->setCheckable(true);
+        connect(a, &QAction::toggled, controller, [controller, dimension](bool enabled) {
+            controller->onRecordAttributeToggled(dimension, enabled);
+        });
+    }
+    optionsMenu->addSeparator();
+    QAction *taskStatsAction = optionsMenu->addAction("Task Statistics...");
+    taskStatsAction->setToolTip("Show queued and running background tasks and their waits.");
+    connect(taskStatsAction, &QAction::triggered, controller, &Controller::onTaskStatsAction);
+    optionsButton->setMenu(optionsMenu);
+    ui->toolBar->addWidget(optionsButton);
+
     // Search bar.
     QLineEdit *searchBar = new QLineEdit(this);
     searchBar->setPlaceholderText("Search... (Ctrl+F)");
@@ -168,6 +279,12 @@ MainWindow::MainWindow(Controller *controller, DirModel *model, QWidget *parent)
         QModelIndex sourceIndex{m_sortProxy->mapToSource(index)};
         m_controller->onTreeExpanded(sourceIndex);
     });
+    connect(ui->treeView, &QTreeView::collapsed, this, [this](QModelIndex index) {
+        m_controller->onTreeCollapsed(m_sortProxy->mapToSource(index));
+        m_controller->onViewportChanged();
+    });
+    connect(ui->treeView->verticalScrollBar(), &QScrollBar::valueChanged,
+            m_controller, &Controller::onViewportChanged);
 
     // Tree view sorting.
     m_sortProxy = new QSortFilterProxyModel(this);
@@ -175,6 +292,8 @@ MainWindow::MainWindow(Controller *controller, DirModel *model, QWidget *parent)
     m_sortProxy->setSortRole(DirModel::R_SORT);
     ui->treeView->setModel(m_sortProxy);
     ui->treeView->setSortingEnabled(true);
+    // Several rows can be selected to aggregate them.
+    ui->treeView->setSelectionMode(QAbstractItemView::ExtendedSelection);
     connect(ui->treeView->header(), &QHeaderView::sortIndicatorChanged, this, [this]() {
         m_controller->onProxyOrderChanged(m_sortProxy);
     });
@@ -185,11 +304,26 @@ MainWindow::MainWindow(Controller *controller, DirModel *model, QWidget *parent)
 
     auto ageChartDelegate = new AgeChartItemDelegate(ui->treeView);
     ui->treeView->setItemDelegateForColumn(DirModel::C_AGE, ageChartDelegate);
+    auto heatmapDelegate = new HeatmapItemDelegate(ui->treeView);
+    ui->treeView->setItemDelegateForColumn(DirModel::C_HEATMAP, heatmapDelegate);
     ui->treeView->hideColumn(DirModel::C_TYPE);
+    // Statistics and heatmaps are shown when chosen in the Options menu.
+    for (int column = DirModel::C_COUNT_MEDIAN_AGE; column < DirModel::C_SENTINEL; ++column) {
+        ui->treeView->hideColumn(column);
+    }
     connect(this, &MainWindow::paletteChanged,
             ageChartDelegate, &AgeChartItemDelegate::calculateColors);
+    connect(this, &MainWindow::paletteChanged,
+            heatmapDelegate, &HeatmapItemDelegate::calculateColors);
     connect(this, &MainWindow::setScaling,
             ageChartDelegate, &AgeChartItemDelegate::setScaling);
+    connect(ageChartDelegate, &AgeChartItemDelegate::chartsMissing,
+            this, [this](QModelIndexList indexes) {
+        for (QModelIndex &index : indexes) {
+            index = m_sortProxy->mapToSource(index);
+        }
+        m_controller->onRowsPainted(indexes);
+    });
     ui->actionScaleSqrt->trigger();
 
     // Tree view context menu.
@@ -199,6 +333,9 @@ MainWindow::MainWindow(Controller *controller, DirModel *model, QWidget *parent)
 
     connect(m_controller, &Controller::scanStateChanged, this, &MainWindow::onScanStateChanged);
     connect(m_controller, &Controller::scanStatusMessage, this, &MainWindow::onScanStatusMessage);
+    connect(m_controller, &Controller::breakdownDone, this, &MainWindow::onBreakdownDone);
+    connect(m_controller, &Controller::topFilesDone, this, &MainWindow::onTopFilesDone);
+    connect(m_controller, &Controller::aggregateDone, this, &MainWindow::onAggregateDone);
 
     // Tree view status message.
     connect(ui->treeView->selectionModel(), &QItemSelectionModel::currentChanged,
@@ -251,7 +388,69 @@ void MainWindow::onContextMenuRequest(QPoint point)
     if (p.second == DirModel::IndexTarget::ITSELF) {
         m.addAction(ui->actionOpenFromView);
         m.addAction(ui->actionOpenFromViewInFM);
+        if (p.first->isCollapsed())
+            m.addAction(ui->actionExpandSummary);
+        if (!p.first->topFiles(DirTree::LARGEST).empty()) {
+            QAction *largest = m.addAction("Largest Files");
+            connect(largest, &QAction::triggered, m_controller, [this, index]() {
+                m_controller->onTopFilesAction(index, DirTree::LARGEST);
+            });
+            QAction *oldest = m.addAction("Oldest Files");
+            // Only known for the time of the scan.
+            oldest->setEnabled(!p.first->topFiles(DirTree::OLDEST).empty());
+            connect(oldest, &QAction::triggered, m_controller, [this, index]() {
+                m_controller->onTopFilesAction(index, DirTree::OLDEST);
+            });
+        }
+        // Offered for the attributes recorded by the scan.
+        if (p.first->dictionary() != nullptr) {
+            QMenu *breakdown = m.addMenu("Breakdown by");
+            for (int d = 0; d < AttributeDictionary::NUM_DIMENSIONS; ++d) {
+                auto dimension = static_cast<DirTree::Dimension>(d);
+                if (!p.first->hasAttribute(dimension))
+                    continue;
+                QAction *a = breakdown->addAction(AttributeDictionary::dimensionName(dimension));
+                connect(a, &QAction::triggered, m_controller, [this, index, dimension]() {
+                    m_controller->onBreakdownAction(index, dimension);
+                });
+            }
+            if (breakdown->isEmpty())
+                m.removeAction(breakdown->menuAction());
+        }
+    }
+    QModelIndexList selected = ui->treeView->selectionModel()->selectedRows();
+    for (QModelIndex &i : selected) {
+        i = m_sortProxy->mapToSource(i);
+    }
+    if (p.second != DirModel::IndexTarget::INVALID) {
+        // Marks the selection if the row is part of it.
+        QModelIndexList rows = selected.contains(index.siblingAtColumn(0))
+                ? selected : QModelIndexList{ index.siblingAtColumn(0) };
+        QAction *exclude = m.addAction("Exclude (What-If)");
+        exclude->setCheckable(true);
+        exclude->setChecked(m_dirModel->isExcluded(index));
+        exclude->setToolTip("Show the sizes and ages above as if this was deleted.");
+        connect(exclude, &QAction::toggled, m_controller, [this, rows](bool checked) {
+            m_controller->onExcludeToggled(rows, checked);
+            updateStatusMessage();
+        });
+    }
+    if (m_dirModel->hasExcluded()) {
+        QAction *clear = m.addAction("Clear Exclusions");
+        connect(clear, &QAction::triggered, m_controller, [this]() {
+            m_controller->onClearExclusionsAction();
+            updateStatusMessage();
+        });
+    }
+    if (selected.size() > 1) {
+        QAction *aggregate = m.addAction("Aggregate Selection");
+        connect(aggregate, &QAction::triggered, m_controller, [this, selected]() {
+            m_controller->onAggregateAction(selected);
+        });
     }
+    QAction *aggregatePattern = m.addAction("Aggregate by Pattern...");
+    connect(aggregatePattern, &QAction::triggered,
+            m_controller, &Controller::onAggregatePatternAction);
     m.addAction(ui->actionExpandAll);
     m.addAction(ui->actionExpandCollapseSiblingsToLevel);
     if (!m.isEmpty()) {
@@ -262,6 +461,9 @@ void MainWindow::onContextMenuRequest(QPoint point)
         else if (trigger == ui->actionOpenFromViewInFM) {
             m_controller->onOpenFromViewInFMAction(index);
         }
+        else if (trigger == ui->actionExpandSummary) {
+            m_controller->onExpandSummaryAction(index);
+        }
         else if (trigger == ui->actionExpandAll) {
             forSubtree(proxiedIndex.model(), proxiedIndex, [this](const QModelIndex &_i) {
                 ui->treeView->expand(_i);
@@ -282,6 +484,106 @@ void MainWindow::onSearchDone(int resultCount)
     updateStatusMessage();
 }
 
+void MainWindow::onBreakdownDone(QString title, GroupByService::Result result)
+{
+    QDialog *dlg = new QDialog(this);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    dlg->setWindowTitle(title);
+    QTreeWidget *list = new QTreeWidget(dlg);
+    list->setRootIsDecorated(false);
+    list->setHeaderLabels({ AttributeDictionary::dimensionName(result.dimension), "Files", "Size",
+                            "Median Age", "Middle Half" });
+    QDateTime now = QDateTime::currentDateTime();
+    for (const GroupByService::Group &g : result.groups) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(list);
+        item->setText(0, g.name);
+        item->setText(1, QString::number(g.totals.count));
+        item->setText(2, DirModel::displayFileSize(g.totals.size));
+        item->setText(3, DirModel::fuzzyDuration(g.chart.median, now));
+        item->setText(4, QStringLiteral("%1 \u2013 %2")
+                      .arg(DirModel::fuzzyDuration(g.chart.upperQuartile, now),
+                           DirModel::fuzzyDuration(g.chart.lowerQuartile, now)));
+    }
+    if (result.unattributed.count > 0) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(list);
+        item->setText(0, "(not recorded)");
+        item->setText(1, QString::number(result.unattributed.count));
+        item->setText(2, DirModel::displayFileSize(result.unattributed.size));
+        item->setToolTip(0, "Summarized directories, or scanned without this attribute");
+    }
+    for (int i = 0; i < list->columnCount(); ++i) {
+        list->resizeColumnToContents(i);
+    }
+    QVBoxLayout *layout = new QVBoxLayout(dlg);
+    layout->addWidget(list);
+    dlg->resize(600, 400);
+    dlg->show();
+}
+
+void MainWindow::onTopFilesDone(QString title, QList<QPair<QString, DirTree::TopFile>> files)
+{
+    QDialog *dlg = new QDialog(this);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    dlg->setWindowTitle(title);
+    QTreeWidget *list = new QTreeWidget(dlg);
+    list->setRootIsDecorated(false);
+    list->setHeaderLabels({ "File", "Size", "Age" });
+    QDateTime now = QDateTime::currentDateTime();
+    for (const auto &[path, f] : files) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(list);
+        item->setText(0, path.isEmpty() ? QStringLiteral("(changed since the scan)") : path);
+        item->setText(1, DirModel::displayFileSize(f.size));
+        item->setText(2, DirModel::fuzzyDuration(f.time, now));
+    }
+    for (int i = 0; i < list->columnCount(); ++i) {
+        list->resizeColumnToContents(i);
+    }
+    QVBoxLayout *layout = new QVBoxLayout(dlg);
+    layout->addWidget(list);
+    dlg->resize(600, 400);
+    dlg->show();
+}
+
+void MainWindow::onAggregateDone(QString title, ChartCalculatorService::Aggregate aggregate)
+{
+    QDialog *dlg = new QDialog(this);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    dlg->setWindowTitle(title);
+    QTreeWidget *list = new QTreeWidget(dlg);
+    list->setRootIsDecorated(false);
+    list->setHeaderLabels({ "", "Value" });
+    QDateTime now = QDateTime::currentDateTime();
+    const AgeChart &c = aggregate.chart;
+    auto ages = [&now](qint64 newer, qint64 older) {
+        return QStringLiteral("%1 \u2013 %2")
+                .arg(DirModel::fuzzyDuration(newer, now), DirModel::fuzzyDuration(older, now));
+    };
+    auto addRow = [list](const QString &name, const QString &value) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(list);
+        item->setText(0, name);
+        item->setText(1, value);
+    };
+    addRow("Subtrees and directories", QString::number(aggregate.requests));
+    addRow("Files", QString::number(aggregate.totals.count));
+    addRow("Size", DirModel::displayFileSize(aggregate.totals.size));
+    if (c.valid()) {
+        addRow("Median Age", DirModel::fuzzyDuration(c.median, now));
+        addRow("Middle Half", ages(c.upperQuartile, c.lowerQuartile));
+        addRow(ChartPercentiles::name(ChartPercentiles::whiskers()),
+               ages(c.upperWhisker, c.lowerWhisker));
+        addRow("Newest to Oldest", ages(c.max, c.min));
+        if (c.errorBound > 0.0)
+            addRow("Error", QStringLiteral("\u00b1%1%").arg(c.errorBound * 100.0, 0, 'f', 2));
+    }
+    for (int i = 0; i < list->columnCount(); ++i) {
+        list->resizeColumnToContents(i);
+    }
+    QVBoxLayout *layout = new QVBoxLayout(dlg);
+    layout->addWidget(list);
+    dlg->resize(400, 250);
+    dlg->show();
+}
+
 void MainWindow::updateStatusMessage()
 {
     if (m_lastScanMessage.has_value()) {
@@ -292,6 +594,10 @@ void MainWindow::updateStatusMessage()
         if (m_lastNumSearchResults > 0) {
             msg.append(QStringLiteral("%1 search results. ").arg(m_lastNumSearchResults));
         }
+        if (m_dirModel->hasExcluded()) {
+            msg.append(QStringLiteral("What-if: %1 excluded. ")
+                       .arg(DirModel::displayFileSize(m_dirModel->excludedSize())));
+        }
         if (m_lastSelected.isValid()) {
             QModelIndex i = m_lastSelected.siblingAtColumn(DirModel::C_AGE);
             QVariant v = i.data();
@@ -310,6 +616,11 @@ void MainWindow::updateStatusMessage()
                         arg(p50.toString(Qt::ISODate)).
                         arg(p75.toString(Qt::ISODate)).
                         arg(max.toString(Qt::ISODate));
+                if (c.errorBound > 0.0)
+                    msg2.append(QStringLiteral(" (\u00b1%1%)")
+                                .arg(c.errorBound * 100.0, 0, 'f', 2));
+                else if (c.approximate)
+                    msg2.append(QStringLiteral(" (approximate)"));
                 msg.append(msg2);
             }
         }
@@ -44,6 +44,9 @@ private slots:
     void onViewSelectionChanged(const QModelIndex &now, const QModelIndex &prev);
     void onContextMenuRequest(QPoint point);
     void onSearchDone(int resultCount);
+    void onBreakdownDone(QString title, GroupByService::Result result);
+    void onTopFilesDone(QString title, QList<QPair<QString, DirTree::TopFile>> files);
+    void onAggregateDone(QString title, ChartCalculatorService::Aggregate aggregate);
 
 private:
     Ui::MainWindow *ui;
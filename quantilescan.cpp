@@ -0,0 +1,255 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "chartpercentiles.h"
+#include "quantilescan.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QUANTILESCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Widest kernel chosen: 0 for generic, 1 for AVX2, 2 for AVX-512. The benchmarks are built
+// once per kernel.
+#ifndef QUANTILESCAN_MAX_KERNEL
+#define QUANTILESCAN_MAX_KERNEL 2
+#endif
+
+// A block reaching a weight is summed again in chunks of this many files, and only the chunk
+// that reaches it is walked file by file.
+constexpr size_t QUANTILESCAN_CHUNK_FILES = 64;
+
+using FileInfo = DirTree::FileInfo;
+
+constexpr qint64 LOW = std::numeric_limits<qint64>::lowest();
+
+// The kernels read sizes as the even 64-bit lanes of consecutive files.
+static_assert(sizeof(FileInfo) == 2 * sizeof(qint64) && offsetof(FileInfo, size) == 0);
+
+static qint64 sumSizesGeneric(const FileInfo *files, size_t n)
+{
+    qint64 sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += files[i].size;
+    }
+    return sum;
+}
+
+#ifdef QUANTILESCAN_X86
+__attribute__((target("avx2")))
+static qint64 sumSizesAvx2(const FileInfo *files, size_t n)
+{
+    // Each vector holds two files: size, time, size, time.
+    __m256i a = _mm256_setzero_si256();
+    __m256i b = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a = _mm256_add_epi64(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(files + i)));
+        b = _mm256_add_epi64(b, _mm256_loadu_si256(
+                                 reinterpret_cast<const __m256i*>(files + i + 2)));
+    }
+    a = _mm256_add_epi64(a, b);
+    __m128i lanes = _mm_add_epi64(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+    qint64 sum = _mm_cvtsi128_si64(lanes);
+    for (; i < n; ++i) {
+        sum += files[i].size;
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static qint64 sumSizesAvx512(const FileInfo *files, size_t n)
+{
+    // Each vector holds four files.
+    __m512i a = _mm512_setzero_si512();
+    __m512i b = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm512_add_epi64(a, _mm512_loadu_si512(files + i));
+        b = _mm512_add_epi64(b, _mm512_loadu_si512(files + i + 4));
+    }
+    qint64 sum = _mm512_mask_reduce_add_epi64(0x55, _mm512_add_epi64(a, b));
+    for (; i < n; ++i) {
+        sum += files[i].size;
+    }
+    return sum;
+}
+#endif
+
+using SumSizes = qint64 (*)(const FileInfo*, size_t);
+
+struct Kernel
+{
+    SumSizes        sumSizes;
+    const char*     name;
+};
+
+static Kernel chooseKernel()
+{
+#ifdef QUANTILESCAN_X86
+    __builtin_cpu_init();
+    if (QUANTILESCAN_MAX_KERNEL >= 2 && __builtin_cpu_supports("avx512f"))
+        return Kernel{sumSizesAvx512, "avx512"};
+    if (QUANTILESCAN_MAX_KERNEL >= 1 && __builtin_cpu_supports("avx2"))
+        return Kernel{sumSizesAvx2, "avx2"};
+#endif
+    return Kernel{sumSizesGeneric, "generic"};
+}
+
+static const Kernel s_kernel = chooseKernel();
+
+QuantileScan::QuantileScan(std::span<const qint64> weights):
+    m_numWeights{std::min(weights.size(), MAX_WEIGHTS)},
+    m_next{0},
+    m_accumulated{0}
+{
+    Q_ASSERT(weights.size() <= MAX_WEIGHTS);
+    std::copy_n(weights.begin(), m_numWeights, m_weights.begin());
+    m_times.fill(LOW);
+}
+
+bool QuantileScan::add(std::span<const FileInfo> files, const std::function<bool()> &isCanceled)
+{
+    for (size_t start = 0; start < files.size() && !done(); start += BLOCK_FILES) {
+        if (isCanceled && isCanceled())
+            return false;
+        _block(files.data() + start, std::min(BLOCK_FILES, files.size() - start));
+    }
+    return true;
+}
+
+void QuantileScan::_block(const FileInfo *files, size_t n)
+{
+    qint64 sum = s_kernel.sumSizes(files, n);
+    if (m_accumulated + sum < m_weights[m_next]) {
+        m_accumulated += sum;
+        return;
+    }
+    for (size_t chunk = 0; chunk < n; chunk += QUANTILESCAN_CHUNK_FILES) {
+        size_t end = std::min(n, chunk + QUANTILESCAN_CHUNK_FILES);
+        sum = s_kernel.sumSizes(files + chunk, end - chunk);
+        if (m_accumulated + sum < m_weights[m_next]) {
+            m_accumulated += sum;
+            continue;
+        }
+        for (size_t i = chunk; i < end; ++i) {
+            m_accumulated += files[i].size;
+            while (m_accumulated >= m_weights[m_next]) {
+                m_times[m_next++] = files[i].time;
+                if (done())
+                    return;
+            }
+        }
+    }
+}
+
+namespace {
+
+//! Files of a directory, sorted by time.
+struct FileRun
+{
+    std::span<const FileInfo>   files;
+    qint64                      totalWeight;
+
+    bool empty() const
+    { return files.empty(); }
+
+    bool scan(QuantileScan &scan, AgeChart &chart, const std::function<bool()> &isCanceled) const
+    {
+        chart.min = files.front().time;
+        chart.max = files.back().time;
+        return scan.add(files, isCanceled);
+    }
+};
+
+//! Files of a subtree, merged by time a block at a time.
+struct SubtreeRun
+{
+    DirTree*    tree;
+    qint64      totalWeight;
+
+    bool empty() const
+    { return totalWeight == 0; }
+
+    bool scan(QuantileScan &scan, AgeChart &chart, const std::function<bool()> &isCanceled) const
+    {
+        std::vector<FileInfo> block;
+        block.reserve(QuantileScan::BLOCK_FILES);
+        auto i = tree->begin();
+        if (i != tree->end())
+            chart.min = i->time;
+        for (; i != tree->end() && !scan.done(); ++i) {
+            block.push_back(*i);
+            if (block.size() < QuantileScan::BLOCK_FILES)
+                continue;
+            if (!scan.add(block, isCanceled))
+                return false;
+            block.clear();
+        }
+        if (!scan.add(block, isCanceled))
+            return false;
+        // The newest file is the last of one of the sorted directories.
+        chart.max = newest(tree);
+        return true;
+    }
+
+    static qint64 newest(DirTree *dir)
+    {
+        std::span<const FileInfo> files = dir->files();
+        qint64 ret = files.empty() ? LOW : files.back().time;
+        for (size_t i = 0; i < dir->numChildren(); ++i) {
+            ret = std::max(ret, newest(dir->child(i)));
+        }
+        return ret;
+    }
+};
+
+//! Chart of the files of the source, compiled for each set of percentiles.
+template <class Set, class Source>
+std::optional<AgeChart> chartOf(const Source &source, const std::function<bool()> &isCanceled)
+{
+    static_assert(Set::SIZE == ChartPercentiles::SIZE);
+    AgeChart ret;
+    if (source.empty())
+        return ret;
+    const std::array<qint64, Set::SIZE> weights = Set::weights(source.totalWeight);
+    QuantileScan scan{weights};
+    if (!source.scan(scan, ret, isCanceled))
+        return std::nullopt;
+    for (size_t i = 0; i < Set::SIZE; ++i) {
+        ret.*ChartPercentiles::FIELDS[i] = scan.time(i);
+    }
+    return ret;
+}
+
+}
+
+std::optional<AgeChart> QuantileScan::chart(std::span<const FileInfo> files, qint64 totalWeight,
+                                            const std::function<bool()> &isCanceled)
+{
+    return ChartPercentiles::dispatch([&]<class Set>(Set) {
+        return chartOf<Set>(FileRun{files, totalWeight}, isCanceled);
+    });
+}
+
+std::optional<AgeChart> QuantileScan::chart(DirTree *tree, const std::function<bool()> &isCanceled)
+{
+    return ChartPercentiles::dispatch([&]<class Set>(Set) {
+        return chartOf<Set>(SubtreeRun{tree, tree->subtreeSize()}, isCanceled);
+    });
+}
+
+const char *QuantileScan::kernelName()
+{
+    return s_kernel.name;
+}
@@ -0,0 +1,71 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef QUANTILESCAN_H
+#define QUANTILESCAN_H
+
+#include <array>
+#include <functional>
+#include <optional>
+#include <span>
+#include "agechart.h"
+#include "dirtree.h"
+
+//! Finds the times at which the accumulated size of files sorted by time first reaches each
+//! of a few ascending weights. Sizes are summed a block at a time with the widest vector
+//! instructions the CPU has, and blocks that reach no weight are skipped whole; only the
+//! short chunk holding a weight is walked file by file. Scanning stops once all are found.
+class QuantileScan
+{
+public:
+    static constexpr size_t MAX_WEIGHTS = 8;
+    //! Files summed between checks for cancellation.
+    static constexpr size_t BLOCK_FILES = 4096;
+
+    //! At most MAX_WEIGHTS, in ascending order.
+    explicit QuantileScan(std::span<const qint64> weights);
+
+    //! Continue with files sorted by time, none older than those added before. Returns false
+    //! if canceled, which is checked once per block.
+    bool add(std::span<const DirTree::FileInfo> files,
+             const std::function<bool()> &isCanceled = {});
+
+    //! Whether every weight has been reached.
+    bool done() const
+    { return m_next == m_numWeights; }
+
+    //! Time at which the weight was reached, or the lowest time if it was not.
+    qint64 time(size_t weight) const
+    { return m_times[weight]; }
+
+    //! Chart of files sorted by time whose sizes add up to the total, with the percentiles of
+    //! ChartPercentiles. Invalid if there are no files, and empty if canceled.
+    static std::optional<AgeChart> chart(std::span<const DirTree::FileInfo> files,
+                                         qint64 totalWeight,
+                                         const std::function<bool()> &isCanceled = {});
+
+    //! Chart of the files of a subtree without summaries or sketches, merged by time. The
+    //! merge stops at the last percentile.
+    static std::optional<AgeChart> chart(DirTree *tree,
+                                         const std::function<bool()> &isCanceled = {});
+
+    //! Instructions used for the sums: "avx512", "avx2" or "generic".
+    static const char *kernelName();
+
+private:
+    void _block(const DirTree::FileInfo *files, size_t n);
+
+    std::array<qint64, MAX_WEIGHTS>     m_weights;
+    std::array<qint64, MAX_WEIGHTS>     m_times;
+    size_t                              m_numWeights;
+    size_t                              m_next;
+    qint64                              m_accumulated;
+};
+
+#endif // QUANTILESCAN_H
@@ -0,0 +1,138 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+// Compares QuantileScan with a loop over the files that checks every file against the next
+// weight, on a directory and on a subtree of millions of files. Built once per kernel when
+// DIRAGE2_BENCHMARKS is on. The arguments are the numbers of files in millions.
+
+#include <QtCore>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+#include "chartpercentiles.h"
+#include "dirtree.h"
+#include "quantilescan.h"
+
+constexpr int BENCH_REPEATS = 10;
+constexpr size_t BENCH_SUBDIRS = 1024;
+
+//! The chart as calculated before QuantileScan, file by file.
+template <class Iterator>
+static AgeChart loopChart(Iterator begin, Iterator end, qint64 totalWeight)
+{
+    AgeChart ret;
+    const std::array<qint64, ChartPercentiles::SIZE> weights =
+            ChartPercentiles::weights(totalWeight);
+    size_t next = 0;
+    qint64 accumulated = 0;
+    for (Iterator i = std::move(begin); i != end; ++i) {
+        if (ret.min == std::numeric_limits<qint64>::lowest())
+            ret.min = i->time;
+        accumulated += i->size;
+        while (next < weights.size() && accumulated >= weights[next]) {
+            ret.*ChartPercentiles::FIELDS[next] = i->time;
+            ++next;
+        }
+        ret.max = i->time;
+    }
+    return ret;
+}
+
+static bool sameChart(const AgeChart &a, const AgeChart &b)
+{
+    if (a.min != b.min || a.max != b.max)
+        return false;
+    for (qint64 AgeChart::*field : ChartPercentiles::FIELDS) {
+        if (a.*field != b.*field)
+            return false;
+    }
+    return true;
+}
+
+//! Mean milliseconds of a calculation, and its chart.
+template <class F>
+static double millis(F &&calculate, AgeChart &chart)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_REPEATS; ++i) {
+        chart = calculate();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / BENCH_REPEATS;
+}
+
+static void appendFiles(DirTree *tree, size_t n, std::mt19937_64 &rng)
+{
+    for (size_t i = 0; i < n; ++i) {
+        tree->append(rng() % (1 << 20), 1000000000 + rng() % 100000000);
+    }
+}
+
+//! Prints the times of both and returns whether they calculated the same chart.
+static bool compare(const char *what, size_t numFiles, DirTree *tree)
+{
+    AgeChart loop, scan;
+    double loopMs, scanMs;
+    if (tree->numChildren() == 0) {
+        std::span<const DirTree::FileInfo> files = tree->files();
+        loopMs = millis([&]() {
+            return loopChart(files.begin(), files.end(), tree->subtreeSize());
+        }, loop);
+        scanMs = millis([&]() {
+            return QuantileScan::chart(files, tree->subtreeSize()).value();
+        }, scan);
+    }
+    else {
+        loopMs = millis([&]() {
+            return loopChart(tree->begin(), tree->end(), tree->subtreeSize());
+        }, loop);
+        scanMs = millis([&]() { return QuantileScan::chart(tree).value(); }, scan);
+    }
+    const bool same = sameChart(loop, scan);
+    std::printf("%s: %zu files in %s: loop %.2f ms, scan %.2f ms, %.2fx%s\n",
+                QuantileScan::kernelName(), numFiles, what, loopMs, scanMs, loopMs / scanMs,
+                same ? "" : ", DIFFERENT CHARTS");
+    return same;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> millions;
+    for (int i = 1; i < argc; ++i) {
+        millions.push_back(std::strtoul(argv[i], nullptr, 10));
+    }
+    if (millions.empty())
+        millions = {1, 4, 16};
+
+    std::mt19937_64 rng(1);
+    bool same = true;
+    for (size_t m : millions) {
+        const size_t numFiles = m << 20;
+        DirTree *dir = new DirTree();
+        appendFiles(dir, numFiles, rng);
+        dir->finalize();
+        same = compare("one directory", numFiles, dir) && same;
+        delete dir;
+
+        DirTree *root = new DirTree();
+        for (size_t i = 0; i < BENCH_SUBDIRS; ++i) {
+            DirTree *sub = new DirTree();
+            appendFiles(sub, numFiles / BENCH_SUBDIRS, rng);
+            sub->finalize();
+            root->append(sub);
+        }
+        root->finalize();
+        same = compare("1024 directories", numFiles, root) && same;
+        delete root;
+    }
+    return same ? 0 : 1;
+}
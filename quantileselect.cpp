@@ -0,0 +1,280 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <QSemaphore>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include "quantileselect.h"
+#include "chartpercentiles.h"
+#include "executor.h"
+
+// Buckets a range of times is cut into per round. Times in seconds need about three rounds.
+constexpr size_t QUANTILESELECT_BUCKETS = 1024;
+// Files of the directories handed to a worker at once.
+constexpr size_t QUANTILESELECT_JOB_FILES = 1 << 16;
+
+using FileInfo = DirTree::FileInfo;
+using file_size_t = DirTree::file_size_t;
+using file_time_t = DirTree::file_time_t;
+
+namespace {
+
+//! Times from lo to hi, both included, cut into buckets of equal width. Offsets from lo are
+//! unsigned so that no range of times can overflow.
+struct Range
+{
+    file_time_t     lo;
+    file_time_t     hi;
+    quint64         width;
+
+    Range(file_time_t from, file_time_t to):
+        lo{from},
+        hi{to},
+        width{(quint64(to) - quint64(from)) / QUANTILESELECT_BUCKETS + 1}
+    { }
+
+    bool operator==(const Range &other) const
+    { return lo == other.lo && hi == other.hi; }
+};
+
+//! Sizes and counts of the files in each bucket of each range.
+struct Buckets
+{
+    std::vector<file_size_t>    sizes;
+    std::vector<size_t>         counts;
+
+    void reset(size_t numRanges)
+    {
+        sizes.assign(numRanges * QUANTILESELECT_BUCKETS, 0);
+        counts.assign(numRanges * QUANTILESELECT_BUCKETS, 0);
+    }
+
+    void add(const Buckets &other)
+    {
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            sizes[i] += other.sizes[i];
+            counts[i] += other.counts[i];
+        }
+    }
+};
+
+//! Directories with files, and consecutive slices of them handed to the workers.
+class SelectPass
+{
+public:
+    SelectPass(std::span<const DirTree* const> dirs, const std::function<bool()> &isCanceled):
+        m_isCanceled{isCanceled}
+    {
+        for (const DirTree *dir : dirs) {
+            if (dir->numFiles() > 0)
+                m_dirs.push_back(dir);
+        }
+        size_t files = 0;
+        for (size_t i = 0; i < m_dirs.size(); ++i) {
+            if (files >= QUANTILESELECT_JOB_FILES) {
+                m_jobs.push_back(i);
+                files = 0;
+            }
+            files += m_dirs[i]->numFiles();
+        }
+        m_jobs.push_back(m_dirs.size());
+        m_numSlots = std::clamp<size_t>(Executor::instance().threadCount(), 1, m_jobs.size());
+    }
+
+    std::optional<AgeChart> chart(file_size_t total)
+    {
+        AgeChart ret;
+        if (m_dirs.empty())
+            return ret;
+
+        // Sorts the directories and finds the range of times.
+        std::vector<file_time_t> mins(m_numSlots, std::numeric_limits<file_time_t>::max());
+        std::vector<file_time_t> maxs(m_numSlots, std::numeric_limits<file_time_t>::lowest());
+        bool done = forEachDir([&](size_t slot, const DirTree *dir) {
+            std::span<const FileInfo> files = dir->files();
+            mins[slot] = std::min(mins[slot], files.front().time);
+            maxs[slot] = std::max(maxs[slot], files.back().time);
+        });
+        if (!done)
+            return std::nullopt;
+        ret.min = *std::min_element(mins.begin(), mins.end());
+        ret.max = *std::max_element(maxs.begin(), maxs.end());
+
+        // Each percentile keeps the range of times it is in and the size of older files.
+        std::array<file_size_t, ChartPercentiles::SIZE> weights = ChartPercentiles::weights(total);
+        std::vector<Range> ranges(weights.size(), Range(ret.min, ret.max));
+        std::vector<file_size_t> older(weights.size(), 0);
+        std::vector<Buckets> buckets(m_numSlots);
+        for (;;) {
+            std::vector<Range> open;
+            std::vector<size_t> rangeOf(weights.size());
+            for (size_t w = 0; w < weights.size(); ++w) {
+                if (ranges[w].lo == ranges[w].hi)
+                    continue;
+                auto i = std::find(open.begin(), open.end(), ranges[w]);
+                rangeOf[w] = i - open.begin();
+                if (i == open.end())
+                    open.push_back(ranges[w]);
+            }
+            if (open.empty())
+                break;
+
+            for (Buckets &b : buckets) {
+                b.reset(open.size());
+            }
+            done = forEachDir([&](size_t slot, const DirTree *dir) {
+                std::span<const FileInfo> files = dir->files();
+                for (size_t r = 0; r < open.size(); ++r) {
+                    fill(files, open[r], buckets[slot], r * QUANTILESELECT_BUCKETS);
+                }
+            });
+            if (!done)
+                return std::nullopt;
+            for (size_t slot = 1; slot < m_numSlots; ++slot) {
+                buckets[0].add(buckets[slot]);
+            }
+
+            // Narrow each percentile down to the first bucket with files that reaches it.
+            for (size_t w = 0; w < weights.size(); ++w) {
+                if (ranges[w].lo == ranges[w].hi)
+                    continue;
+                const Range &range = open[rangeOf[w]];
+                const size_t first = rangeOf[w] * QUANTILESELECT_BUCKETS;
+                size_t b = 0;
+                for (; b < QUANTILESELECT_BUCKETS; ++b) {
+                    if (buckets[0].counts[first + b] == 0)
+                        continue;
+                    if (older[w] + buckets[0].sizes[first + b] >= weights[w])
+                        break;
+                    older[w] += buckets[0].sizes[first + b];
+                }
+                Q_ASSERT(b < QUANTILESELECT_BUCKETS);
+                quint64 from = b * range.width;
+                quint64 to = std::min(from + (range.width - 1),
+                                      quint64(range.hi) - quint64(range.lo));
+                ranges[w] = Range(file_time_t(quint64(range.lo) + from),
+                                  file_time_t(quint64(range.lo) + to));
+            }
+        }
+
+        for (size_t w = 0; w < weights.size(); ++w) {
+            ret.*ChartPercentiles::FIELDS[w] = ranges[w].lo;
+        }
+        return ret;
+    }
+
+private:
+    //! Add the files of a sorted directory that fall in the range to its buckets.
+    static void fill(std::span<const FileInfo> files, const Range &range, Buckets &buckets,
+                     size_t first)
+    {
+        if (files.back().time < range.lo || files.front().time > range.hi)
+            return;
+        auto older = [](const FileInfo &f, file_time_t t) { return f.time < t; };
+        auto newer = [](file_time_t t, const FileInfo &f) { return t < f.time; };
+        auto begin = (files.front().time >= range.lo) ? files.begin()
+                : std::lower_bound(files.begin(), files.end(), range.lo, older);
+        auto end = (files.back().time <= range.hi) ? files.end()
+                : std::upper_bound(begin, files.end(), range.hi, newer);
+        // Times ascend, so the bucket only needs to be found again when it is left.
+        quint64 start = 0;
+        size_t b = 0;
+        for (auto i = begin; i != end; ++i) {
+            quint64 offset = quint64(i->time) - quint64(range.lo);
+            if (offset - start >= range.width) {
+                b = offset / range.width;
+                start = b * range.width;
+            }
+            buckets.sizes[first + b] += i->size;
+            ++buckets.counts[first + b];
+        }
+    }
+
+    //! Run on all directories, on this thread and on idle workers of the executor. Helpers
+    //! only take idle workers, so that waiting for them cannot starve it. Returns false if
+    //! canceled, which is checked once per job.
+    bool forEachDir(const std::function<void(size_t slot, const DirTree *dir)> &f)
+    {
+        std::atomic<size_t> nextJob{0};
+        std::atomic<size_t> nextSlot{0};
+        std::atomic<bool> canceled{false};
+        auto work = [&]() {
+            const size_t slot = nextSlot++;
+            for (size_t job = nextJob++; job < m_jobs.size(); job = nextJob++) {
+                if (canceled.load(std::memory_order_relaxed))
+                    return;
+                if (m_isCanceled && m_isCanceled()) {
+                    canceled.store(true, std::memory_order_relaxed);
+                    return;
+                }
+                for (size_t i = (job == 0) ? 0 : m_jobs[job - 1]; i < m_jobs[job]; ++i) {
+                    f(slot, m_dirs[i]);
+                }
+            }
+        };
+        QSemaphore done;
+        size_t started = 0;
+        for (; started + 1 < m_numSlots; ++started) {
+            if (!Executor::instance().tryStart(Executor::Priority::VISIBLE, [&work, &done]() {
+                work();
+                done.release();
+            })) {
+                break;
+            }
+        }
+        work();
+        done.acquire(started);
+        return !canceled.load(std::memory_order_relaxed);
+    }
+
+    const std::function<bool()>&    m_isCanceled;
+    std::vector<const DirTree*>     m_dirs;
+    std::vector<size_t>             m_jobs;  // End of each slice of m_dirs.
+    size_t                          m_numSlots;
+};
+
+void collect(DirTree *tree, std::vector<const DirTree*> &dirs)
+{
+    dirs.push_back(tree);
+    for (size_t i = 0; i < tree->numChildren(); ++i) {
+        collect(tree->child(i), dirs);
+    }
+}
+
+}
+
+bool QuantileSelect::worthwhile(const DirTree *tree)
+{
+    return tree->numSubtreeFiles() >= MIN_FILES &&
+            Executor::instance().threadCount() > 1;
+}
+
+std::optional<AgeChart> QuantileSelect::chart(DirTree *tree,
+                                              const std::function<bool()> &isCanceled)
+{
+    Q_ASSERT(!tree->hasCollapsed() && tree->subtreeSketch() == nullptr);
+    std::vector<const DirTree*> dirs;
+    collect(tree, dirs);
+    SelectPass pass{dirs, isCanceled};
+    return pass.chart(tree->subtreeSize());
+}
+
+std::optional<AgeChart> QuantileSelect::chart(std::span<const DirTree* const> dirs,
+                                              qint64 totalWeight,
+                                              const std::function<bool()> &isCanceled)
+{
+    Q_ASSERT(std::none_of(dirs.begin(), dirs.end(), [](const DirTree *dir) {
+        return dir->isCollapsed() || dir->filesSketch() != nullptr;
+    }));
+    SelectPass pass{dirs, isCanceled};
+    return pass.chart(totalWeight);
+}
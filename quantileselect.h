@@ -0,0 +1,45 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef QUANTILESELECT_H
+#define QUANTILESELECT_H
+
+#include <functional>
+#include <optional>
+#include <span>
+#include "agechart.h"
+#include "dirtree.h"
+
+//! Chart of a large subtree computed on all idle workers of the executor. Instead of merging the
+//! directories by time, the range of times is cut into buckets and the files of every
+//! directory are added to them in parallel. Only the buckets holding a percentile are cut
+//! again, found by binary searches in the sorted directories, until each holds a single time.
+//! That time is the one a sequential merge reaches the weight at, so the charts are equal.
+class QuantileSelect
+{
+public:
+    //! Subtrees with fewer files are merged sequentially.
+    static constexpr size_t MIN_FILES = size_t(1) << 21;
+
+    //! Whether the subtree is large enough and there are threads to share the work with.
+    static bool worthwhile(const DirTree *tree);
+
+    //! Chart of a subtree without summaries or sketches. Invalid if there are no files, and
+    //! empty if canceled.
+    static std::optional<AgeChart> chart(DirTree *tree,
+                                         const std::function<bool()> &isCanceled = {});
+
+    //! Chart of the files of the directories together, without those of their subdirectories.
+    //! Their sizes add up to the total, and none may be collapsed or sketched.
+    static std::optional<AgeChart> chart(std::span<const DirTree* const> dirs,
+                                         qint64 totalWeight,
+                                         const std::function<bool()> &isCanceled = {});
+};
+
+#endif // QUANTILESELECT_H
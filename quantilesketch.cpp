@@ -0,0 +1,203 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "quantilesketch.h"
+#include "chartpercentiles.h"
+#include <algorithm>
+#include <limits>
+
+QuantileSketch::QuantileSketch()
+{
+    m_leadError = 0;
+    m_total = 0;
+    m_count = 0;
+    m_min = std::numeric_limits<qint64>::max();
+    m_max = std::numeric_limits<qint64>::lowest();
+}
+
+void QuantileSketch::add(qint64 time, qint64 size)
+{
+    m_pending.push_back(Item{.time = time, .weight = size, .error = 0});
+    m_total += size;
+    m_count++;
+    m_min = std::min(m_min, time);
+    m_max = std::max(m_max, time);
+    if (m_pending.size() >= CAPACITY)
+        flush();
+}
+
+void QuantileSketch::add(const QuantileSketch &other)
+{
+    Q_ASSERT(other.m_pending.empty());
+    merge(other.m_items, other.m_leadError);
+    m_total += other.m_total;
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    if (m_items.size() >= 2 * CAPACITY)
+        compact(CAPACITY);
+}
+
+void QuantileSketch::finalize()
+{
+    flush();
+    compact(CAPACITY);
+    m_items.shrink_to_fit();
+    m_pending = std::vector<Item>();
+}
+
+void QuantileSketch::flush()
+{
+    if (m_pending.empty())
+        return;
+    std::sort(m_pending.begin(), m_pending.end(),
+              [](const Item &a, const Item &b) { return a.time < b.time; });
+    merge(m_pending, 0);
+    m_pending.clear();
+    if (m_items.size() >= 2 * CAPACITY)
+        compact(CAPACITY);
+}
+
+// Union of two summaries. The error at any time is the sum of both errors at that time.
+void QuantileSketch::merge(const std::vector<Item> &other, qint64 otherLeadError)
+{
+    std::vector<Item> out;
+    out.reserve(m_items.size() + other.size());
+    size_t i = 0;
+    size_t j = 0;
+    qint64 errA = m_leadError;
+    qint64 errB = otherLeadError;
+    while (i < m_items.size() || j < other.size()) {
+        bool takeA = j == other.size() || (i < m_items.size() && m_items[i].time <= other[j].time);
+        bool takeB = i == m_items.size() || (j < other.size() && other[j].time <= m_items[i].time);
+        Item item{.time = takeA ? m_items[i].time : other[j].time, .weight = 0, .error = 0};
+        if (takeA) {
+            item.weight += m_items[i].weight;
+            errA = m_items[i].error;
+            ++i;
+        }
+        if (takeB) {
+            item.weight += other[j].weight;
+            errB = other[j].error;
+            ++j;
+        }
+        item.error = errA + errB;
+        out.push_back(item);
+    }
+    m_leadError += otherLeadError;
+    m_items.swap(out);
+}
+
+void QuantileSketch::compact(size_t capacity)
+{
+    // Merge the cheapest disjoint neighbour pairs first, a pair costs its lighter weight.
+    std::vector<size_t> pairs;
+    std::vector<bool> starts;
+    while (m_items.size() > capacity) {
+        size_t excess = m_items.size() - capacity;
+        pairs.resize(m_items.size() - 1);
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            pairs[i] = i;
+        }
+        auto cost = [this](size_t i) {
+            return std::min(m_items[i].weight, m_items[i + 1].weight);
+        };
+        std::sort(pairs.begin(), pairs.end(),
+                  [cost](size_t a, size_t b) { return cost(a) < cost(b); });
+        starts.assign(m_items.size(), false);
+        std::vector<bool> used(m_items.size(), false);
+        for (size_t i = 0; i < pairs.size() && excess > 0; ++i) {
+            size_t p = pairs[i];
+            if (used[p] || used[p + 1])
+                continue;
+            used[p] = used[p + 1] = true;
+            starts[p] = true;
+            --excess;
+        }
+
+        std::vector<Item> out;
+        out.reserve(capacity + 1);
+        for (size_t i = 0; i < m_items.size(); ++i) {
+            if (!starts[i]) {
+                out.push_back(m_items[i]);
+                continue;
+            }
+            const Item &a = m_items[i];
+            const Item &b = m_items[i + 1];
+            // The interval between the two times absorbs the lighter weight.
+            qint64 between = a.error + std::min(a.weight, b.weight);
+            Item merged{.time = a.time, .weight = a.weight + b.weight, .error = 0};
+            if (a.weight >= b.weight) {
+                merged.error = std::max(between, b.error);
+            }
+            else {
+                merged.time = b.time;
+                merged.error = b.error;
+                qint64 &before = out.empty() ? m_leadError : out.back().error;
+                before = std::max(before, between);
+            }
+            out.push_back(merged);
+            ++i;
+        }
+        m_items.swap(out);
+    }
+}
+
+qint64 QuantileSketch::quantile(qint64 weight, qint64 *error) const
+{
+    Q_ASSERT(m_pending.empty());
+    qint64 accumulated = 0;
+    qint64 before = m_leadError;
+    for (const Item &it : m_items) {
+        accumulated += it.weight;
+        if (accumulated >= weight) {
+            if (error != nullptr)
+                *error = std::max(before, it.error);
+            return it.time;
+        }
+        before = it.error;
+    }
+    if (error != nullptr)
+        *error = before;
+    return m_max;
+}
+
+qint64 QuantileSketch::weightBefore(qint64 time, qint64 *error) const
+{
+    Q_ASSERT(m_pending.empty());
+    qint64 accumulated = 0;
+    qint64 gapError = m_leadError;
+    for (const Item &it : m_items) {
+        if (it.time >= time)
+            break;
+        accumulated += it.weight;
+        gapError = it.error;
+    }
+    if (error != nullptr)
+        *error = gapError;
+    return accumulated;
+}
+
+AgeChart QuantileSketch::chart() const
+{
+    AgeChart ret;
+    if (m_count == 0)
+        return ret;
+    qint64 totalWeight = m_total;
+    std::array<qint64, ChartPercentiles::SIZE> weights = ChartPercentiles::weights(totalWeight);
+    qint64 errors[ChartPercentiles::SIZE] = {};
+    ret.min = m_min;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        ret.*ChartPercentiles::FIELDS[i] = quantile(weights[i], &errors[i]);
+    }
+    ret.max = m_max;
+    qint64 error = *std::max_element(std::begin(errors), std::end(errors));
+    ret.errorBound = (totalWeight > 0) ? static_cast<double>(error) / totalWeight : 0.0;
+    return ret;
+}
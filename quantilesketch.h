@@ -0,0 +1,83 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+
+#include <QtCore>
+#include <vector>
+#include "agechart.h"
+
+//! Mergeable size-weighted quantile summary of file times with a deterministic error bound.
+//! Holds at most CAPACITY (time, weight) items once compacted. Compaction merges neighbouring
+//! items into the heavier one's time, which moves the cumulative weight only between the two
+//! times and by no more than the lighter weight. Each item tracks that bound for the interval up
+//! to the next item, so every answer comes with a guaranteed rank error.
+class QuantileSketch
+{
+public:
+    static constexpr size_t CAPACITY = 128;
+
+    QuantileSketch();
+
+    void add(qint64 time, qint64 size);
+    void add(const QuantileSketch &other);
+    //! Compact to the capacity and release the spare buffers. Needed before querying.
+    void finalize();
+
+    qint64 totalWeight() const
+    { return m_total; }
+
+    size_t count() const
+    { return m_count; }
+
+    qint64 min() const
+    { return m_min; }
+
+    qint64 max() const
+    { return m_max; }
+
+    //! Call f(time, weight) for each item, oldest first.
+    template<class F>
+    void forEachItem(F &&f) const
+    { for (const Item &it : m_items) f(it.time, it.weight); }
+
+    //! Approximate heap usage in bytes.
+    size_t memoryUsage() const
+    { return sizeof(*this) + (m_items.capacity() + m_pending.capacity()) * sizeof(Item); }
+
+    //! Time of the first item at which the accumulated weight reaches the given weight.
+    //! If error is given, it receives the largest possible difference between the weight
+    //! up to the returned time and the requested one.
+    qint64 quantile(qint64 weight, qint64 *error = nullptr) const;
+
+    //! Estimated weight of the items older than the time. If error is given, it receives the
+    //! largest possible difference from the exact weight.
+    qint64 weightBefore(qint64 time, qint64 *error = nullptr) const;
+
+    //! Chart with errorBound set relative to the total weight. Min and max are exact.
+    AgeChart chart() const;
+
+private:
+    //! Error applies to times from this item up to the next one.
+    struct Item { qint64 time; qint64 weight; qint64 error; };
+    void flush();
+    void compact(size_t capacity);
+    void merge(const std::vector<Item> &other, qint64 otherLeadError);
+
+    std::vector<Item>           m_items;  // Sorted, distinct times.
+    std::vector<Item>           m_pending;  // Exact items not merged yet.
+    qint64                      m_leadError;  // Error before the first item.
+    qint64                      m_total;
+    size_t                      m_count;
+    qint64                      m_min;
+    qint64                      m_max;
+};
+
+#endif // QUANTILESKETCH_H
@@ -0,0 +1,76 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <tuple>
+#include "rowcharts.h"
+
+RowCharts::RowCharts():
+    m_size{0}
+{ }
+
+void RowCharts::insert(quint32 node, bool files, const AgeChart &chart)
+{
+    std::vector<std::unique_ptr<Page>> &pages = m_pages[files];
+    const size_t p = node >> PAGE_BITS;
+    if (p >= pages.size())
+        pages.resize(p + 1);
+    if (pages[p] == nullptr)
+        pages[p] = std::make_unique<Page>();
+    const size_t i = node & (PAGE_SIZE - 1);
+    if (!pages[p]->valid[i]) {
+        pages[p]->valid[i] = true;
+        ++m_size;
+    }
+    pages[p]->charts[i] = chart;
+}
+
+void RowCharts::remove(quint32 node, bool files)
+{
+    std::vector<std::unique_ptr<Page>> &pages = m_pages[files];
+    const size_t p = node >> PAGE_BITS;
+    const size_t i = node & (PAGE_SIZE - 1);
+    if (p >= pages.size() || pages[p] == nullptr || !pages[p]->valid[i])
+        return;
+    pages[p]->valid[i] = false;
+    --m_size;
+    if (pages[p]->valid.none())
+        pages[p].reset();
+}
+
+void RowCharts::insertNodes(quint32 after, quint32 count)
+{
+    if (count == 0)
+        return;
+    // Few rows have charts, so moving them one by one is cheaper than moving the pages.
+    std::vector<std::tuple<quint32, bool, AgeChart>> moved;
+    forEach([after, &moved](quint32 node, bool files, const AgeChart &chart) {
+        if (node > after)
+            moved.emplace_back(node, files, chart);
+    });
+    for (const auto &[node, files, chart] : moved) {
+        remove(node, files);
+    }
+    for (const auto &[node, files, chart] : moved) {
+        insert(node + count, files, chart);
+    }
+}
+
+void RowCharts::clear()
+{
+    for (std::vector<std::unique_ptr<Page>> &pages : m_pages) {
+        std::vector<std::unique_ptr<Page>>().swap(pages);
+    }
+    m_size = 0;
+}
+
+void RowCharts::swap(RowCharts &other)
+{
+    m_pages.swap(other.m_pages);
+    std::swap(m_size, other.m_size);
+}
@@ -0,0 +1,96 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef ROWCHARTS_H
+#define ROWCHARTS_H
+
+#include <QtGlobal>
+#include <array>
+#include <bitset>
+#include <memory>
+#include <vector>
+#include "agechart.h"
+
+//! Charts calculated for the rows of the model, by the pre-order number of the directory, with
+//! a separate array for the [Files] rows. Lookups are two array accesses and a bit test. The
+//! arrays are split into pages allocated on first use, so that a tree of millions of
+//! directories with a few hundred rows expanded takes a few pages.
+class RowCharts
+{
+public:
+    static constexpr size_t PAGE_BITS = 9;
+    static constexpr size_t PAGE_SIZE = size_t(1) << PAGE_BITS;
+
+    RowCharts();
+
+    //! Chart of the directory's subtree, or of its own files, or null.
+    const AgeChart *find(quint32 node, bool files) const
+    {
+        const Page *page = this->page(node, files);
+        const size_t i = node & (PAGE_SIZE - 1);
+        return (page != nullptr && page->valid[i]) ? &page->charts[i] : nullptr;
+    }
+
+    bool contains(quint32 node, bool files) const
+    { return find(node, files) != nullptr; }
+
+    void insert(quint32 node, bool files, const AgeChart &chart);
+    void remove(quint32 node, bool files);
+
+    //! Shift the charts of the nodes after the node up by count, as when the subtree of a
+    //! collapsed directory is grafted into the tree in its place.
+    void insertNodes(quint32 after, quint32 count);
+
+    //! Drop all charts and free the pages.
+    void clear();
+
+    size_t size() const
+    { return m_size; }
+
+    bool isEmpty() const
+    { return m_size == 0; }
+
+    void swap(RowCharts &other);
+
+    //! Call f(node, files, chart) for each chart.
+    template <class F>
+    void forEach(F &&f) const
+    {
+        for (int files = 0; files < 2; ++files) {
+            const std::vector<std::unique_ptr<Page>> &pages = m_pages[files];
+            for (size_t p = 0; p < pages.size(); ++p) {
+                if (pages[p] == nullptr)
+                    continue;
+                for (size_t i = 0; i < PAGE_SIZE; ++i) {
+                    if (pages[p]->valid[i])
+                        f(quint32((p << PAGE_BITS) | i), files != 0, pages[p]->charts[i]);
+                }
+            }
+        }
+    }
+
+private:
+    struct Page
+    {
+        std::array<AgeChart, PAGE_SIZE>     charts;
+        std::bitset<PAGE_SIZE>              valid;
+    };
+
+    const Page *page(quint32 node, bool files) const
+    {
+        const std::vector<std::unique_ptr<Page>> &pages = m_pages[files];
+        const size_t p = node >> PAGE_BITS;
+        return (p < pages.size()) ? pages[p].get() : nullptr;
+    }
+
+    std::array<std::vector<std::unique_ptr<Page>>, 2>   m_pages;  // Subtrees, then files.
+    size_t                                              m_size;
+};
+
+#endif // ROWCHARTS_H
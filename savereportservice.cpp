@@ -11,8 +11,9 @@
 #include <QRunnable>
 #include <QThread>
 #include "dirtree.h"
+#include "executor.h"
 #include "savereportservice.h"
-#include "chartcalculatorservice.h"
+#include "treereclaimer.h"
 
 struct SaveReportService::Report
 {
@@ -21,28 +22,38 @@ struct SaveReportService::Report
 
 class JsonReportGenerator: public QRunnable
 {
-    struct TmpFuts
-    {
-        QFuture<AgeChart> subtreeChart;
-        QFuture<AgeChart> filesChart;
-    };
-
 public:
-    JsonReportGenerator(ChartCalculatorService *serv,
-                        DirTree *tree,
+    JsonReportGenerator(DirTree *tree,
+                        ChartStorePtr store,
+                        int metrics,
                         QPromise<SaveReportService::ReportPtr> &&pro)
     {
-        m_calcServ = serv;
         m_tree = tree;
+        m_store = std::move(store);
+        m_metrics = metrics;
+        m_pin = TreeReclaimer::pin();
         m_promise = std::move(pro);
     }
 
     virtual void run() override
     {
-        auto maybeObj = comp(m_tree);
+        if (m_store == nullptr || m_store->timeBasis() != m_tree->timeBasis() ||
+                !m_store->covers(m_tree) || (m_store->metrics() & m_metrics) != m_metrics) {
+            m_store = ChartStore::compute(m_tree, m_metrics,
+                                          [this]() { return m_promise.isCanceled(); });
+        }
+        auto maybeObj = (m_store != nullptr) ? comp(m_tree) : std::nullopt;
         if (maybeObj.has_value()) {
             SaveReportService::ReportPtr rep{new SaveReportService::Report};
             rep->obj = std::move(maybeObj.value());
+            rep->obj["timeBasis"] = DirTree::timeBasisName(m_tree->timeBasis());
+            if (m_metrics & ChartStore::M_SMALL_FILES) {
+                QJsonArray sizes;
+                for (qint64 size : ChartStore::SMALL_FILE_SIZES) {
+                    sizes.append(size);
+                }
+                rep->obj["smallFileSizes"] = sizes;
+            }
             m_promise.addResult(std::move(rep));
             m_promise.finish();
         }
@@ -60,7 +71,6 @@ private:
     {
         if (m_promise.isCanceled())
             return {};
-        TmpFuts tmp = node(tree);
         std::optional<QJsonArray> chArr;
         if (tree->numChildren() > 0) {
             chArr = QJsonArray{};
@@ -72,45 +82,64 @@ private:
                     return {};
             }
         }
-        tmp.subtreeChart.waitForFinished();
-        tmp.filesChart.waitForFinished();
         QJsonObject rv;
         rv["name"] = tree->name();
         rv["numFiles"] = static_cast<qint64>(tree->numFiles());
         rv["subtreeSize"] = tree->subtreeSize();
         rv["filesSize"] = tree->filesSize();
-        if (tmp.subtreeChart.isResultReadyAt(0))
-            rv["subtreeChart"] = chartToJson(tmp.subtreeChart.result());
-        else
-            return {};
-        if (tmp.filesChart.isResultReadyAt(0))
-            rv["filesChart"] = chartToJson(tmp.filesChart.result());
-        else
-            return {};
+        chartToJson(rv, "subtreeChart", m_store->subtree(tree));
+        chartToJson(rv, "filesChart", m_store->files(tree));
+        statsToJson(rv, "subtreeStats", m_store->subtreeStats(tree));
+        statsToJson(rv, "filesStats", m_store->filesStats(tree));
         if (chArr.has_value()) {
             rv["subdirs"] = chArr.value();
         }
         return rv;
     }
 
-    TmpFuts node(DirTree *tree)
+    //! Adds the array under the key, and the error bound if the chart is from a sketch.
+    void chartToJson(QJsonObject &obj, const QString &key, const AgeChart &chart)
     {
-        return {
-            .subtreeChart = m_calcServ->calculateSubtree(tree),
-            .filesChart = m_calcServ->calculateFiles(tree)
+        obj[key] = QJsonArray{
+            chart.min, chart.lowerWhisker, chart.lowerQuartile, chart.median,
+            chart.upperQuartile, chart.upperWhisker, chart.max
         };
+        if (chart.errorBound > 0.0)
+            obj[key + "ErrorBound"] = chart.errorBound;
     }
 
-    QJsonArray chartToJson(const AgeChart &chart)
+    //! Adds the object under the key with the fields of the metrics that are known.
+    void statsToJson(QJsonObject &obj, const QString &key, const ChartStore::Stats *stats)
     {
-        return QJsonArray{
-            chart.min, chart.lowerWhisker, chart.lowerQuartile, chart.median,
-            chart.upperQuartile, chart.upperWhisker, chart.max
-        };
+        if (stats == nullptr || (stats->known & m_metrics) == 0)
+            return;
+        const int known = stats->known & m_metrics;
+        QJsonObject rv;
+        if (known & ChartStore::M_COUNT_PERCENTILES) {
+            QJsonArray times;
+            for (qint64 time : stats->countPercentiles) {
+                times.append(time);
+            }
+            rv["countPercentiles"] = times;
+        }
+        if (known & ChartStore::M_AGE_MOMENTS) {
+            rv["meanTime"] = stats->meanTime;
+            rv["stddevTime"] = stats->stddevTime();
+        }
+        if (known & ChartStore::M_SMALL_FILES) {
+            QJsonArray counts;
+            for (quint64 count : stats->smallFiles) {
+                counts.append(static_cast<qint64>(count));
+            }
+            rv["smallFiles"] = counts;
+        }
+        obj[key] = rv;
     }
 
-    ChartCalculatorService*                 m_calcServ;
     DirTree*                                m_tree;
+    ChartStorePtr                           m_store;
+    int                                     m_metrics;
+    TreeReclaimer::Pin                      m_pin;
     QPromise<SaveReportService::ReportPtr>  m_promise;
 };
 
@@ -122,13 +151,12 @@ SaveReportService::SaveReportService(QObject *parent)
 }
 
 QFuture<SaveReportService::ReportPtr>
-SaveReportService::generateReport(ChartCalculatorService *serv, DirTree *tree)
+SaveReportService::generateReport(DirTree *tree, ChartStorePtr store, int metrics)
 {
     QPromise<SaveReportService::ReportPtr> pro;
     auto fut = pro.future();
-    QRunnable *task = new JsonReportGenerator(serv, tree, std::move(pro));
-    QThreadPool::globalInstance()->start(task);
-    task->setAutoDelete(true);
+    QRunnable *task = new JsonReportGenerator(tree, std::move(store), metrics, std::move(pro));
+    Executor::instance().start(Executor::Priority::REPORT, task);
     return fut;
 }
 
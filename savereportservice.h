@@ -13,7 +13,7 @@
 #include <QObject>
 #include <QFuture>
 #include <QSharedPointer>
-#include "chartcalculatorservice.h"
+#include "chartstore.h"
 
 class SaveReportService : public QObject
 {
@@ -23,7 +23,10 @@ public:
 
     struct Report;
     using ReportPtr = QSharedPointer<Report>;
-    QFuture<ReportPtr> generateReport(ChartCalculatorService *serv, DirTree *tree);
+    //! Report of the whole tree with the charts of the store, and the statistics of the
+    //! metrics. Without a store of the tree's current time basis and these metrics, the charts
+    //! are calculated in one pass first.
+    QFuture<ReportPtr> generateReport(DirTree *tree, ChartStorePtr store, int metrics = 0);
     QPair<QFileDevice::FileError, QString> saveReport(ReportPtr report, QString fileName);
 
 signals:
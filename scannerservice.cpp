@@ -7,17 +7,76 @@
  *  (at your option) any later version.
  */
 
+#include <algorithm>
 #include <optional>
+#include <queue>
 #include <stack>
+#include <unordered_map>
 #include <boost/smart_ptr/intrusive_ptr.hpp>
 #include <boost/pool/object_pool.hpp>
+#include "executor.h"
 #include "scannerservice.h"
 
 // POSIX.
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+// With a memory budget, collapsing starts above the high mark and stops below the low mark,
+// both in percent of the budget. Smaller subtrees are not worth a summary.
+constexpr size_t SCANNER_BUDGET_HIGH_PERCENT = 90;
+constexpr size_t SCANNER_BUDGET_LOW_PERCENT = 75;
+constexpr size_t SCANNER_COLLAPSE_MIN_BYTES = 64 * 1024;
+
+// Bounded candidates for the top files of one directory: min-heap of the largest, max-heap of the
+// oldest.
+class TopEntriesBuilder
+{
+public:
+    void add(const DirTree::TopEntry &e)
+    {
+        push(m_largest, e, [](const DirTree::TopEntry &a, const DirTree::TopEntry &b) {
+            return a.size > b.size;
+        });
+        push(m_oldest, e, [](const DirTree::TopEntry &a, const DirTree::TopEntry &b) {
+            return a.time < b.time;
+        });
+    }
+
+    //! Both sets without duplicates. The builder is empty again afterwards.
+    std::vector<DirTree::TopEntry> take()
+    {
+        std::vector<DirTree::TopEntry> entries = std::move(m_largest);
+        for (const DirTree::TopEntry &e : m_oldest) {
+            auto same = [&e](const DirTree::TopEntry &o) { return o.ordinal == e.ordinal; };
+            if (std::none_of(entries.begin(), entries.end(), same))
+                entries.push_back(e);
+        }
+        m_largest.clear();
+        m_oldest.clear();
+        return entries;
+    }
+
+private:
+    template <class Less>
+    static void push(std::vector<DirTree::TopEntry> &heap, const DirTree::TopEntry &e, Less less)
+    {
+        if (heap.size() < DirTree::TOP_FILES) {
+            heap.push_back(e);
+            std::push_heap(heap.begin(), heap.end(), less);
+        }
+        else if (less(e, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), less);
+            heap.back() = e;
+            std::push_heap(heap.begin(), heap.end(), less);
+        }
+    }
+
+    std::vector<DirTree::TopEntry>  m_largest;
+    std::vector<DirTree::TopEntry>  m_oldest;
+};
+
 // Path element used by the scanning routine. Only supposed to be allocated via the pool.
 struct _El;
 typedef boost::intrusive_ptr<_El> _ElPtr;
@@ -74,6 +133,9 @@ struct ScannerService::State::Private
     void incrErrors()
     { lock(); ++progress.numErrors; unlock(); }
 
+    void incrCollapsed()
+    { lock(); ++progress.numCollapsed; unlock(); }
+
     _ElPtr allocElement(std::string &&name, _ElPtr parent)
     {
         _El *e = elPool.construct();
@@ -103,8 +165,9 @@ ScannerService::Progress ScannerService::State::get() const
 class ScanWorker: public QRunnable
 {
 public:
-    ScanWorker(QString path, QSharedPointer<ScannerService::State::Private> state):
-        m_state{state}, m_rootPath{path}
+    ScanWorker(QString path, QSharedPointer<ScannerService::State::Private> state,
+               const ScannerService::Options &options):
+        m_state{state}, m_rootPath{path}, m_options{options}
     { m_state->promise.start(); }
 
     virtual void run()
@@ -160,10 +223,81 @@ private:
         }
     }
 
+    struct EntryInfo
+    {
+        mode_t mode;
+        DirTree::file_size_t size;
+        DirTree::FileTimes times;
+        quint32 uid;
+        quint32 gid;
+    };
+
+    //! Like lstat(). Birth times need statx(); files without one get their change time.
+    static bool statEntry(const char *path, bool birthTime, EntryInfo &out)
+    {
+#ifdef STATX_BTIME
+        if (birthTime) {
+            struct statx stx;
+            if (statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS | STATX_BTIME,
+                      &stx) == -1)
+                return false;
+            out.mode = stx.stx_mode;
+            out.size = stx.stx_size;
+            out.uid = stx.stx_uid;
+            out.gid = stx.stx_gid;
+            out.times[DirTree::MTIME] = stx.stx_mtime.tv_sec;
+            out.times[DirTree::ATIME] = stx.stx_atime.tv_sec;
+            out.times[DirTree::CTIME] = stx.stx_ctime.tv_sec;
+            out.times[DirTree::BTIME] = (stx.stx_mask & STATX_BTIME) ? stx.stx_btime.tv_sec
+                                                                     : stx.stx_ctime.tv_sec;
+            return true;
+        }
+#endif
+        struct stat st;
+        if (lstat(path, &st) == -1)
+            return false;
+        out.mode = st.st_mode;
+        out.size = st.st_size;
+        out.uid = st.st_uid;
+        out.gid = st.st_gid;
+        out.times[DirTree::MTIME] = st.st_mtime;
+        out.times[DirTree::ATIME] = st.st_atime;
+        out.times[DirTree::CTIME] = st.st_ctime;
+        out.times[DirTree::BTIME] = st.st_ctime;
+        return true;
+    }
+
     DirTree *scanPriv()
     {
+        // Sketches cannot be re-sorted, so they only get the active time.
+        const DirTree::TimeBasis timeBasis = m_options.timeBasis;
+        const quint8 timeBases = (1 << timeBasis) |
+                (m_options.sketchMode ? 0 : m_options.extraTimeBases);
+        const bool allTimes = timeBases != (1 << timeBasis);
+        const bool birthTime = (timeBases & (1 << DirTree::BTIME)) != 0;
+        const quint8 dimensions = m_options.sketchMode ? 0 : m_options.dimensions;
+        std::unique_ptr<AttributeDictionary> dictionary;
+        if (dimensions != 0)
+            dictionary = std::make_unique<AttributeDictionary>();
+        auto hasDimension = [dimensions](AttributeDictionary::Dimension d) {
+            return (dimensions & (1 << d)) != 0;
+        };
+
+        // Heatmaps of collapsed subtrees are built before they lose their sizes, at the time
+        // the scan started, so that all of them count ages from the same time.
+        m_heatmaps = m_options.heatmaps && !m_options.sketchMode;
+        m_heatmapReference = QDateTime::currentSecsSinceEpoch();
+
         std::unique_ptr<DirTree> root = std::make_unique<DirTree>();
         root->name(m_rootPath);
+        root->useTimeColumns(timeBases, timeBasis);
+        root->useAttributes(dimensions);
+        if (m_options.sketchMode)
+            root->useSketch();
+        // Sketches keep no files, so there is nothing to spill.
+        std::unique_ptr<SpillFile> spill;
+        if (m_options.spillToDisk && !m_options.sketchMode)
+            spill = SpillFile::create(QDir::tempPath());
 
         std::stack<DirTree*> stack;
         stack.push(root.get());
@@ -193,10 +327,13 @@ private:
 
             struct dirent *ent;
             size_t nameBufferLength = nameBuffer.size();
+            // Position in readdir() order, for finding top files again.
+            quint32 ordinal = 0;
+            TopEntriesBuilder topEntries;
 
             // Breadth-first: read all children at this level before proceeding.
-            while ((ent = readdir(dir)) != nullptr) {
-                
+            for (; (ent = readdir(dir)) != nullptr; ++ordinal) {
+
                 // Trim the path to parent's length.
                 nameBuffer.resize(nameBufferLength);
 
@@ -209,38 +346,142 @@ private:
 
                 // Append name of current child and stat().
                 nameBuffer.append(ent->d_name);
-                struct stat st;
-                if (lstat(nameBuffer.c_str(), &st) == -1) {
+                EntryInfo st;
+                if (!statEntry(nameBuffer.c_str(), birthTime, st)) {
                     m_state->incrErrors();
                     continue;
                 }
 
-                if (S_ISDIR(st.st_mode)) {
+                if (S_ISDIR(st.mode)) {
                     m_state->incrDirs();
                     DirTree *p = new DirTree();
                     p->name(QString(ent->d_name));
+                    p->useTimeColumns(timeBases, timeBasis);
+                    p->useAttributes(dimensions);
+                    if (m_options.sketchMode)
+                        p->useSketch();
                     top->append(p);
                     stack.push(p);
                     nameStack.push(m_state->allocElement(ent->d_name, topName));
                 }
-                else if (S_ISREG(st.st_mode)) {
+                else if (S_ISREG(st.mode)) {
                     m_state->incrFiles();
-                    top->append(st.st_size, st.st_mtime);
+                    if (m_options.topFiles)
+                        topEntries.add(DirTree::TopEntry{.size = st.size,
+                                                         .time = st.times[timeBasis],
+                                                         .ordinal = ordinal});
+                    if (dimensions != 0) {
+                        DirTree::Attributes attributes{};
+                        if (hasDimension(AttributeDictionary::EXTENSION))
+                            attributes[AttributeDictionary::EXTENSION] =
+                                    dictionary->extension(ent->d_name);
+                        if (hasDimension(AttributeDictionary::OWNER))
+                            attributes[AttributeDictionary::OWNER] = dictionary->owner(st.uid);
+                        if (hasDimension(AttributeDictionary::GROUP))
+                            attributes[AttributeDictionary::GROUP] = dictionary->group(st.gid);
+                        top->append(st.size, st.times, attributes);
+                    }
+                    else if (allTimes)
+                        top->append(st.size, st.times);
+                    else
+                        top->append(st.size, st.times[timeBasis]);
                 }
                 else {
                     // Symlinks and all other types are skipped.
                     m_state->incrSkipped();
                 }
             }
-            // Sort files at this level by timestamp and close the descriptor.
-            top->finalize();
+            // Files are sorted later, on first use, unless spilled. Close the descriptor.
+            top->finalize(spill.get());
+            if (m_options.topFiles)
+                top->setTopEntries(topEntries.take());
             closedir(dir);
+            if (m_options.memoryBudget > 0)
+                completed(top);
         }
+        if (m_state->promise.isCanceled())
+            return nullptr;
+        if (m_options.sketchMode)
+            root->buildSketches();
+        root->buildHistograms(QDateTime::currentSecsSinceEpoch(), DirTree::HISTOGRAM_MIN_FILES);
+        if (m_options.topFiles)
+            root->buildTopFiles();
+        if (m_heatmaps)
+            root->buildHeatmaps(m_heatmapReference);
+        root->numberNodes();
+        if (spill != nullptr)
+            root->adoptSpillFile(std::move(spill));
+        if (dictionary != nullptr)
+            root->adoptDictionary(std::move(dictionary));
         return root.release();
     }
 
+    // Bookkeeping for the memory budget. A directory is complete once all its subdirectories
+    // are. Complete subtrees large enough to be worth collapsing wait in a queue, deepest first,
+    // so that descendants always leave it before their ancestors are collapsed.
+    struct Pending { size_t numChildren = 0; size_t bytes = 0; };
+    struct Candidate
+    {
+        size_t depth;
+        DirTree *tree;
+        bool operator<(const Candidate &other) const { return depth < other.depth; }
+    };
+
+    //! Called when a directory has been read.
+    void completed(DirTree *tree)
+    {
+        m_memoryUsed += tree->memoryUsage();
+        m_pending[tree].numChildren += tree->numChildren();
+        // Directories are read before their subdirectories, so parents are still pending.
+        while (tree != nullptr) {
+            auto i = m_pending.find(tree);
+            if (i->second.numChildren > 0)
+                break;
+            size_t bytes = i->second.bytes + tree->memoryUsage();
+            m_pending.erase(i);
+            DirTree *parent = tree->parent();
+            if (parent != nullptr) {
+                if (bytes >= SCANNER_COLLAPSE_MIN_BYTES) {
+                    size_t depth = 0;
+                    for (DirTree *p = parent; p != nullptr; p = p->parent()) {
+                        ++depth;
+                    }
+                    m_candidates.push(Candidate{.depth = depth, .tree = tree});
+                }
+                Pending &pending = m_pending[parent];
+                pending.bytes += bytes;
+                --pending.numChildren;
+            }
+            tree = parent;
+        }
+        if (m_memoryUsed > m_options.memoryBudget / 100 * SCANNER_BUDGET_HIGH_PERCENT)
+            collapseCandidates();
+    }
+
+    void collapseCandidates()
+    {
+        const size_t low = m_options.memoryBudget / 100 * SCANNER_BUDGET_LOW_PERCENT;
+        while (m_memoryUsed > low && !m_candidates.empty()) {
+            DirTree *tree = m_candidates.top().tree;
+            m_candidates.pop();
+            if (tree->subtreeMemoryUsage() < SCANNER_COLLAPSE_MIN_BYTES)
+                continue;
+            if (m_heatmaps)
+                tree->buildHeatmaps(m_heatmapReference);
+            size_t freed = tree->collapse();
+            m_memoryUsed -= std::min(freed, m_memoryUsed);
+            m_state->incrCollapsed();
+        }
+    }
+
     QString                                         m_rootPath;
     QSharedPointer<ScannerService::State::Private>  m_state;
+    ScannerService::Options                         m_options;
+    size_t                                          m_memoryUsed = 0;
+    bool                                            m_heatmaps = false;
+    qint64                                          m_heatmapReference = 0;
+    std::unordered_map<DirTree*, Pending>           m_pending;
+    std::priority_queue<Candidate>                  m_candidates;
 };
 
 
@@ -264,17 +505,17 @@ bool ScannerService::isScanning() const
     return p->currentScan.has_value();
 }
 
-ScannerService::State ScannerService::start(QString dir)
+ScannerService::State ScannerService::start(QString dir, const Options &options)
 {
     cancel();
     State state;
-    ScanWorker *task = new ScanWorker(dir, state.p);
+    ScanWorker *task = new ScanWorker(dir, state.p, options);
     p->currentScan = state;
     auto fut = state.p->track.future();
     auto reset = [this]() { p->currentScan.reset(); };
     fut.then(this, reset).onCanceled(this, reset);
-    task->setAutoDelete(true);
-    QThreadPool::globalInstance()->start(task);
+    // Scans take minutes, so they leave the worker kept for searches alone.
+    Executor::instance().start(Executor::Priority::VISIBLE, task);
     return state;
 }
 
@@ -289,3 +530,39 @@ void ScannerService::cancel()
 }
 
 
+
+QString ScannerService::entryName(const QString &dirPath, quint32 ordinal, qint64 size)
+{
+    QByteArray path = dirPath.toLocal8Bit();
+    DIR *dir = opendir(path.constData());
+    if (dir == nullptr)
+        return QString();
+    path.append('/');
+    const qsizetype pathLength = path.size();
+    auto isFile = [&path, pathLength, size](const char *name) {
+        path.truncate(pathLength);
+        path.append(name);
+        struct stat st;
+        return lstat(path.constData(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size == size;
+    };
+    QString name;
+    struct dirent *ent;
+    for (quint32 i = 0; (ent = readdir(dir)) != nullptr; ++i) {
+        if (i == ordinal) {
+            if (isFile(ent->d_name))
+                name = QString::fromLocal8Bit(ent->d_name);
+            break;
+        }
+    }
+    if (name.isEmpty()) {
+        rewinddir(dir);
+        while ((ent = readdir(dir)) != nullptr) {
+            if (isFile(ent->d_name)) {
+                name = QString::fromLocal8Bit(ent->d_name);
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    return name;
+}
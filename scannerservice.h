@@ -18,12 +18,52 @@ class ScannerService final: public QObject
 {
     Q_OBJECT
 public:
+    struct Options
+    {
+        //! Keep only quantile sketches per directory instead of every file. Memory then grows
+        //! with the number of directories, and charts carry an error bound.
+        bool sketchMode = false;
+
+        //! Move the files of each directory into a memory-mapped temporary file once it is
+        //! scanned. Only the tree structure, names and summaries stay resident.
+        bool spillToDisk = false;
+
+        //! Approximate limit in bytes for the tree, or zero for none. Close to it, the deepest
+        //! completed subtrees are collapsed into summaries.
+        size_t memoryBudget = 0;
+
+        //! Subtrees with at least this many file entries get a cumulative index after the scan,
+        //! see DirTree::buildIndex(). Zero disables the index; lower values trade memory for
+        //! faster charts.
+        size_t indexMinFiles = 1 << 18;
+
+        //! Time of the files in the charts.
+        DirTree::TimeBasis timeBasis = DirTree::MTIME;
+
+        //! Other timestamps to record, a bit mask of (1 << DirTree::TimeBasis), so that the
+        //! chart's time can be switched without a rescan. Ignored with sketches.
+        quint8 extraTimeBases = 0;
+
+        //! Attributes to record for breakdowns, a bit mask of (1 << DirTree::Dimension). Ignored
+        //! with sketches.
+        quint8 dimensions = 0;
+
+        //! Remember the largest and oldest files of each directory by their position in it,
+        //! for DirTree::topFiles().
+        bool topFiles = false;
+
+        //! Count the files of each directory by size and age for heatmaps, a few hundred bytes
+        //! per directory. Ignored with sketches.
+        bool heatmaps = false;
+    };
+
     struct Progress
     {
         int numFiles = 0;
         int numDirs = 0;
         int numSkipped = 0;
         int numErrors = 0;
+        int numCollapsed = 0;
     };
 
     class State
@@ -42,9 +82,14 @@ public:
     ~ScannerService();
 
     bool isScanning() const;
-    State start(QString dir);
+    State start(QString dir, const Options &options = Options());
     void cancel();
 
+    //! Name of a regular file of the directory by its position in readdir() order, as recorded
+    //! for top files. If the directory changed since, the first regular file of that size.
+    //! Empty if there is none.
+    static QString entryName(const QString &dirPath, quint32 ordinal, qint64 size);
+
 private:
     struct Private;
     Private *p;
@@ -10,31 +10,56 @@
 #include <QPromise>
 #include <QQueue>
 #include <QSharedPointer>
+#include <QWaitCondition>
 #include <bit>
 #include "searchservice.h"
 #include "dirtree.h"
+#include "executor.h"
+#include "treereclaimer.h"
+
+// Longest sleep of an idle worker. Wakeups that race with falling asleep are caught by it.
+constexpr unsigned long SEARCH_IDLE_WAIT_MS = 2;
 
 class SearchWorker;
 struct SearchServicePrivate
 {
-    // Worker thread state.
-    QThreadPool                     threadPool;
+    // Worker thread state. The workers are owned here, so that any of them can steal from
+    // the others until the search is canceled.
     QList<SearchWorker*>            workers;
     QAtomicInt                      busyCounter = 0;
     QAtomicInt                      exitCounter = 0;
     QPromise<DirTree*>*             promise = nullptr;
+    // Idle workers sleep instead of spinning until there is work to steal.
+    QMutex                          idleLock;
+    QWaitCondition                  idle;
+    QAtomicInt                      sleeping = 0;
+    // Held until the search is done, not until the next one starts.
+    TreeReclaimer::Pin              pin;
+    quint64                         generation = 0;  // Of the search that holds the pin.
+    QObject*                        owner;  // Whose thread releases the pin.
+
+    void cancel();
+
+    //! Count the workers that ended, and finish the search with the last one.
+    void exited(int num)
+    {
+        if (exitCounter.fetchAndSubOrdered(num) != num)
+            return;
+        // The pin belongs to the main thread, which may have started another search by then.
+        // Posted before the search finishes, so that it is queued for whoever waited for it.
+        QMetaObject::invokeMethod(owner, [this, done = generation]() {
+            if (generation == done)
+                pin.release();
+        }, Qt::QueuedConnection);
+        promise->finish();
+    }
 
-    void cancel()
+    void wakeIdle()
     {
-        if (promise != nullptr) {
-            auto fut = promise->future();
-            fut.cancel();
-            fut.waitForFinished();
-            delete promise;
-            promise = nullptr;
+        if (sleeping.loadAcquire() > 0) {
+            QMutexLocker l{&idleLock};
+            idle.wakeAll();
         }
-        busyCounter = 0;
-        exitCounter = 0;
     }
 
     ~SearchServicePrivate()
@@ -81,6 +106,7 @@ public:
 
     virtual void run() override
     {
+        m_running.storeRelease(1);
         while (true) {
             lock();
             if (m_shared->promise->isCanceled()) {
@@ -93,7 +119,7 @@ public:
                 unlock();
                 process(t);
                 processChildren(t);
-                m_shared->busyCounter.fetchAndSubRelease(1);
+                done();
             }
             else {
                 unlock();
@@ -106,7 +132,7 @@ public:
                 if (t != nullptr) {
                     process(t);
                     processChildren(t);
-                    m_shared->busyCounter.fetchAndSubRelease(1);
+                    done();
                 }
                 else {
                     int busy = m_shared->busyCounter.loadAcquire();
@@ -114,9 +140,7 @@ public:
                         gracefulEnd();
                         return;
                     }
-                    else {
-                        //QThread::yieldCurrentThread();
-                    }
+                    sleep();
                 }
             }
         }
@@ -125,8 +149,9 @@ public:
     DirTree *stealFrom()
     {
         lock();
-        // Do not steal the victim's last item as that would not make more workers busy.
-        if (m_queue.size() > 1) {
+        // Do not steal the victim's last item as that would not make more workers busy, unless
+        // the victim still waits for a thread of the executor.
+        if (m_queue.size() > (m_running.loadAcquire() != 0 ? 1 : 0)) {
             auto *p = m_queue.dequeue();
             unlock();
             return p;
@@ -162,7 +187,10 @@ private:
             if (m_queue.size() < m_queue.capacity()) {
                 m_queue.enqueue(tree->child(i));
                 m_shared->busyCounter.fetchAndAddRelease(1);
+                const bool stealable = (m_queue.size() > 1);
                 unlock();
+                if (stealable)
+                    m_shared->wakeIdle();
             }
             else {
                 unlock();
@@ -179,17 +207,31 @@ private:
     void unlock()
     { m_mutex.storeRelease(0); }
 
+    //! A node taken from a queue was searched.
+    void done()
+    {
+        // The last one wakes the sleepers to end.
+        if (m_shared->busyCounter.fetchAndSubRelease(1) == 1)
+            m_shared->wakeIdle();
+    }
+
+    void sleep()
+    {
+        QMutexLocker l{&m_shared->idleLock};
+        m_shared->sleeping.fetchAndAddOrdered(1);
+        if (m_shared->busyCounter.loadAcquire() != 0 && !m_shared->promise->isCanceled())
+            m_shared->idle.wait(&m_shared->idleLock, SEARCH_IDLE_WAIT_MS);
+        m_shared->sleeping.fetchAndSubOrdered(1);
+    }
+
     void gracefulEnd()
     {
-        if (m_shared->exitCounter.fetchAndSubRelease(1) == 1) {
-            lock();
-            m_shared->promise->finish();
-            unlock();
-        }
+        m_shared->exited(1);
     }
 
     QQueue<DirTree*>        m_queue;
     QAtomicInt              m_mutex;
+    QAtomicInt              m_running = 0;
     SplitMixRNG             m_rng;
     SearchServicePrivate*   m_shared;
     int                     m_num;
@@ -262,11 +304,31 @@ private:
 
 // Main thread.
 
+void SearchServicePrivate::cancel()
+{
+    if (promise != nullptr) {
+        auto fut = promise->future();
+        fut.cancel();
+        {
+            QMutexLocker l{&idleLock};
+            idle.wakeAll();
+        }
+        fut.waitForFinished();
+        delete promise;
+        promise = nullptr;
+    }
+    qDeleteAll(workers);
+    workers.clear();
+    pin.release();
+    busyCounter = 0;
+    exitCounter = 0;
+}
+
 SearchService::SearchService(QObject *parent):
     QObject(parent)
 {
     p = new SearchServicePrivate;
-    p->threadPool.setObjectName("SearchThreadPool");
+    p->owner = this;
 }
 
 SearchService::~SearchService()
@@ -277,9 +339,12 @@ SearchService::~SearchService()
 QFuture<DirTree*> SearchService::start(const QString &str, DirTree *tree, Mode mode)
 {
     cancel();
+    p->pin = TreeReclaimer::pin();
     p->promise = new QPromise<DirTree*>();
     p->promise->start();
-    int numThreads = p->threadPool.maxThreadCount();
+    ++p->generation;
+    // Interactive tasks may also use the worker kept for them.
+    int numThreads = Executor::instance().threadCount() + 1;
     p->workers.reserve(numThreads);
     p->workers.resize(numThreads);
     p->exitCounter.storeRelaxed(numThreads);
@@ -298,12 +363,19 @@ QFuture<DirTree*> SearchService::start(const QString &str, DirTree *tree, Mode m
             break;
         }
         w->setSearchParam(str);
+        w->setAutoDelete(false);
         p->workers[i] = w;
-        w->setAutoDelete(true);
     }
-    for (int i = 0; i < numThreads; i++) {
-        p->threadPool.start(p->workers.at(i));
+    // The first worker holds the root and is queued. The others only help if a worker is
+    // idle now, so that the search does not wait for them behind longer tasks.
+    Executor::instance().start(Executor::Priority::INTERACTIVE, p->workers.at(0));
+    int started = 1;
+    while (started < numThreads &&
+           Executor::instance().tryStart(Executor::Priority::INTERACTIVE, p->workers.at(started))) {
+        ++started;
     }
+    if (started < numThreads)
+        p->exited(numThreads - started);
     return p->promise->future();
 }
 
@@ -0,0 +1,88 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "sizeageheatmap.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+// Levels per doubling of the count. The largest level is reached at about 3.6 billion files.
+constexpr double HEATMAP_LEVELS_PER_DOUBLING = 8.0;
+
+SizeAgeHeatmap::SizeAgeHeatmap()
+{
+    m_reference = 0;
+    m_levels.fill(0);
+}
+
+SizeAgeHeatmap::SizeAgeHeatmap(const Levels &levels, qint64 reference)
+{
+    m_reference = reference;
+    m_levels = levels;
+}
+
+SizeAgeHeatmap::Levels SizeAgeHeatmap::levels(const Counts &counts)
+{
+    Levels levels;
+    for (int i = 0; i < NUM_CELLS; ++i) {
+        levels[i] = encode(counts[i]);
+    }
+    return levels;
+}
+
+void SizeAgeHeatmap::addTo(const Levels &levels, Counts &counts)
+{
+    for (int i = 0; i < NUM_CELLS; ++i) {
+        counts[i] += decode(levels[i]);
+    }
+}
+
+quint8 SizeAgeHeatmap::maxLevel() const
+{
+    return *std::max_element(m_levels.begin(), m_levels.end());
+}
+
+int SizeAgeHeatmap::sizeBucket(qint64 size)
+{
+    int b = std::bit_width(static_cast<quint64>(std::max<qint64>(size, 0))) / 3;
+    return std::min(b, SIZE_BUCKETS - 1);
+}
+
+int SizeAgeHeatmap::ageBucket(qint64 age)
+{
+    int b = std::bit_width(static_cast<quint64>(std::max<qint64>(age, 0))) / 2;
+    return std::min(b, AGE_BUCKETS - 1);
+}
+
+qint64 SizeAgeHeatmap::bucketSize(int bucket)
+{
+    return (bucket == 0) ? 0 : qint64(1) << (3 * bucket - 1);
+}
+
+qint64 SizeAgeHeatmap::bucketAge(int bucket)
+{
+    return (bucket == 0) ? 0 : qint64(1) << (2 * bucket - 1);
+}
+
+quint8 SizeAgeHeatmap::encode(quint64 count)
+{
+    if (count == 0)
+        return 0;
+    double level = 1.0 + std::round(std::log2(static_cast<double>(count))
+                                    * HEATMAP_LEVELS_PER_DOUBLING);
+    return static_cast<quint8>(std::min(level, 255.0));
+}
+
+quint64 SizeAgeHeatmap::decode(quint8 level)
+{
+    if (level == 0)
+        return 0;
+    return static_cast<quint64>(std::llround(std::exp2((level - 1)
+                                                       / HEATMAP_LEVELS_PER_DOUBLING)));
+}
@@ -0,0 +1,82 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef SIZEAGEHEATMAP_H
+#define SIZEAGEHEATMAP_H
+
+#include <QtCore>
+#include <QVariant>
+#include <array>
+
+//! Number of files by log size and log age, relative to a reference time. Each cell keeps its
+//! count as one byte on a log scale, so the levels of a heatmap take 256 bytes and show at a
+//! glance what a box plot hides, e.g. many small new files next to a few large old ones. Exact
+//! counts are summed while building, then stored as levels; a tree keeps the reference once.
+class SizeAgeHeatmap
+{
+public:
+    static constexpr int SIZE_BUCKETS = 16;
+    static constexpr int AGE_BUCKETS = 16;
+    static constexpr int NUM_CELLS = SIZE_BUCKETS * AGE_BUCKETS;
+
+    //! Exact counts by cell, to build or merge heatmaps.
+    using Counts = std::array<quint64, NUM_CELLS>;
+    //! Stored counts by cell.
+    using Levels = std::array<quint8, NUM_CELLS>;
+
+    //! Empty, with no reference.
+    SizeAgeHeatmap();
+    SizeAgeHeatmap(const Levels &levels, qint64 reference);
+
+    static void add(Counts &counts, qint64 reference, qint64 time, qint64 size)
+    { ++counts[cell(sizeBucket(size), ageBucket(reference - time))]; }
+
+    static Levels levels(const Counts &counts);
+
+    //! Add the approximate counts, to merge stored levels into a parent's.
+    static void addTo(const Levels &levels, Counts &counts);
+
+    qint64 reference() const
+    { return m_reference; }
+
+    //! Count of the cell on a log scale: zero if empty, else one plus eight times its log2.
+    quint8 level(int sizeBucket, int ageBucket) const
+    { return m_levels[cell(sizeBucket, ageBucket)]; }
+
+    quint8 maxLevel() const;
+
+    //! Approximate number of files in the cell, within 5%.
+    quint64 count(int sizeBucket, int ageBucket) const
+    { return decode(level(sizeBucket, ageBucket)); }
+
+    //! Bucket 0 holds sizes below 4 bytes, then each one is 8 times larger. The last starts at
+    //! 16 TiB.
+    static int sizeBucket(qint64 size);
+    //! Bucket 0 holds ages below 2 s (and files from the future), then each one is 4 times
+    //! longer. The last starts at 17 years.
+    static int ageBucket(qint64 age);
+
+    //! Lower bounds of the buckets.
+    static qint64 bucketSize(int bucket);
+    static qint64 bucketAge(int bucket);
+
+private:
+    static int cell(int sizeBucket, int ageBucket)
+    { return sizeBucket * AGE_BUCKETS + ageBucket; }
+
+    static quint8 encode(quint64 count);
+    static quint64 decode(quint8 level);
+
+    qint64                              m_reference;
+    Levels                              m_levels;
+};
+
+Q_DECLARE_METATYPE(SizeAgeHeatmap);
+
+#endif // SIZEAGEHEATMAP_H
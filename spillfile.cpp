@@ -0,0 +1,111 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include "spillfile.h"
+#include <cstring>
+
+// POSIX.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Runs are packed into chunks of this size. Larger runs get a mapping of their own.
+constexpr size_t SPILLFILE_CHUNK_SIZE = size_t(64) << 20;
+constexpr size_t SPILLFILE_ALIGNMENT = 16;
+
+static size_t roundUp(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+std::unique_ptr<SpillFile> SpillFile::create(const QString &dir)
+{
+    QByteArray path = QDir(dir).filePath("dirage2-spill-XXXXXX").toLocal8Bit();
+    int fd = mkstemp(path.data());
+    if (fd == -1) {
+        qWarning() << "SpillFile::create(): cannot create a file in" << dir;
+        return nullptr;
+    }
+    unlink(path.constData());
+    return std::unique_ptr<SpillFile>(new SpillFile(fd));
+}
+
+SpillFile::SpillFile(int fd)
+{
+    m_fd = fd;
+    m_fileSize = 0;
+    m_used = 0;
+    m_current = -1;
+}
+
+SpillFile::~SpillFile()
+{
+    for (const Chunk &c : m_chunks) {
+        munmap(c.base, c.size);
+    }
+    close(m_fd);
+}
+
+//! Grow the file and map the new part. Returns the index of the chunk, or -1.
+qsizetype SpillFile::_newChunk(size_t size)
+{
+    size = roundUp(size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+#ifdef __linux__
+    // Allocate the blocks now, so that a full disk fails here and not as SIGBUS on a write.
+    if (posix_fallocate(m_fd, m_fileSize, size) != 0)
+        return -1;
+#else
+    if (ftruncate(m_fd, m_fileSize + size) != 0)
+        return -1;
+#endif
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, m_fileSize);
+    if (base == MAP_FAILED)
+        return -1;
+    // Runs are written once and read front to back, so read ahead and drop pages behind.
+    madvise(base, size, MADV_SEQUENTIAL);
+    m_fileSize += size;
+    m_chunks.push_back(Chunk{.base = static_cast<char*>(base), .size = size, .used = 0});
+    return m_chunks.size() - 1;
+}
+
+void *SpillFile::append(const void *data, size_t size)
+{
+    size_t needed = roundUp(size, SPILLFILE_ALIGNMENT);
+    qsizetype target;
+    if (needed > SPILLFILE_CHUNK_SIZE / 4) {
+        target = _newChunk(needed);
+    }
+    else {
+        if (m_current == -1 || m_chunks[m_current].size - m_chunks[m_current].used < needed) {
+#ifdef MADV_COLD
+            // The full chunk is not read again until charts are requested.
+            if (m_current != -1)
+                madvise(m_chunks[m_current].base, m_chunks[m_current].size, MADV_COLD);
+#endif
+            m_current = _newChunk(SPILLFILE_CHUNK_SIZE);
+        }
+        target = m_current;
+    }
+    if (target == -1)
+        return nullptr;
+    Chunk &c = m_chunks[target];
+    char *dst = c.base + c.used;
+    std::memcpy(dst, data, size);
+    c.used += needed;
+    m_used += size;
+    return dst;
+}
+
+void SpillFile::willRead(const void *addr, size_t size)
+{
+    const quintptr pageSize = static_cast<quintptr>(sysconf(_SC_PAGESIZE));
+    quintptr begin = reinterpret_cast<quintptr>(addr) & ~(pageSize - 1);
+    quintptr end = reinterpret_cast<quintptr>(addr) + size;
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
@@ -0,0 +1,52 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include <QtCore>
+#include <memory>
+#include <vector>
+
+//! Append-only temporary file mapped into memory in chunks. Data copied into it stays at a
+//! fixed address and is paged in and out by the OS like any other file. The file is unlinked
+//! right after creation, so it disappears with the process. Appends are not thread-safe.
+class SpillFile
+{
+public:
+    Q_DISABLE_COPY_MOVE(SpillFile)
+
+    //! Creates the file in the directory. Null if that fails.
+    static std::unique_ptr<SpillFile> create(const QString &dir);
+    ~SpillFile();
+
+    //! Copy the data to the end of the file. Returns its address in the mapping, valid for the
+    //! lifetime of this object, or null if the file cannot grow, e.g. when the disk is full.
+    void *append(const void *data, size_t size);
+
+    //! Hint that the range will be read soon, from start to end.
+    static void willRead(const void *addr, size_t size);
+
+    //! Bytes stored so far.
+    size_t size() const
+    { return m_used; }
+
+private:
+    struct Chunk { char *base; size_t size; size_t used; };
+    explicit SpillFile(int fd);
+    qsizetype _newChunk(size_t size);
+
+    int                     m_fd;
+    qint64                  m_fileSize;
+    size_t                  m_used;
+    std::vector<Chunk>      m_chunks;
+    qsizetype               m_current;  // Chunk receiving small runs, or -1.
+};
+
+#endif // SPILLFILE_H
@@ -0,0 +1,161 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "treereclaimer.h"
+#include "dirtree.h"
+#include "executor.h"
+
+namespace {
+
+struct Retired
+{
+    quint64     epoch;  // The last epoch in which it was current.
+    DirTree*    tree;
+};
+
+struct Waiter
+{
+    QPointer<QObject>       context;
+    std::function<void()>   f;
+};
+
+struct ReclaimerState
+{
+    QMutex                      lock;
+    quint64                     epoch = 0;
+    std::map<quint64, size_t>   pins;  // Epoch -> pins held.
+    std::vector<Retired>        retired;  // Ascending epochs.
+    std::vector<Waiter>         waiters;  // Until no pin is held.
+
+    //! Hand the trees no pin can reach to the executor. Called with the lock held.
+    void reclaim()
+    {
+        quint64 oldest = pins.empty() ? epoch : pins.begin()->first;
+        auto end = std::find_if(retired.begin(), retired.end(),
+                                [oldest](const Retired &r) { return r.epoch >= oldest; });
+        if (end == retired.begin())
+            return;
+        std::vector<DirTree*> trees;
+        for (auto i = retired.begin(); i != end; ++i) {
+            trees.push_back(i->tree);
+        }
+        retired.erase(retired.begin(), end);
+        // Deleting a large tree frees millions of blocks, so it runs below the charts.
+        Executor::instance().start(Executor::Priority::BACKGROUND, [trees = std::move(trees)]() {
+            for (DirTree *t : trees) {
+                delete t;
+            }
+        });
+    }
+};
+
+ReclaimerState &state()
+{
+    static ReclaimerState s;
+    return s;
+}
+
+}
+
+TreeReclaimer::Pin::Pin():
+    m_epoch{0},
+    m_held{false}
+{ }
+
+TreeReclaimer::Pin::Pin(quint64 epoch):
+    m_epoch{epoch},
+    m_held{true}
+{ }
+
+TreeReclaimer::Pin::Pin(Pin &&other):
+    m_epoch{other.m_epoch},
+    m_held{other.m_held}
+{
+    other.m_held = false;
+}
+
+TreeReclaimer::Pin &TreeReclaimer::Pin::operator=(Pin &&other)
+{
+    if (this != &other) {
+        release();
+        m_epoch = other.m_epoch;
+        m_held = other.m_held;
+        other.m_held = false;
+    }
+    return *this;
+}
+
+TreeReclaimer::Pin::~Pin()
+{
+    release();
+}
+
+void TreeReclaimer::Pin::release()
+{
+    if (!m_held)
+        return;
+    m_held = false;
+    ReclaimerState &s = state();
+    QMutexLocker l{&s.lock};
+    auto i = s.pins.find(m_epoch);
+    Q_ASSERT(i != s.pins.end());
+    if (--i->second == 0) {
+        s.pins.erase(i);
+        s.reclaim();
+    }
+    if (!s.pins.empty() || s.waiters.empty())
+        return;
+    std::vector<Waiter> waiters;
+    waiters.swap(s.waiters);
+    l.unlock();
+    for (Waiter &w : waiters) {
+        if (w.context.isNull())
+            continue;
+        // Checked again in its thread, which may have pinned meanwhile.
+        QObject *context = w.context.data();
+        QMetaObject::invokeMethod(context, [context, f = std::move(w.f)]() mutable {
+            whenUnpinned(context, std::move(f));
+        }, Qt::QueuedConnection);
+    }
+}
+
+TreeReclaimer::Pin TreeReclaimer::pin()
+{
+    ReclaimerState &s = state();
+    QMutexLocker l{&s.lock};
+    ++s.pins[s.epoch];
+    return Pin{s.epoch};
+}
+
+void TreeReclaimer::retire(DirTree *tree)
+{
+    if (tree == nullptr)
+        return;
+    ReclaimerState &s = state();
+    QMutexLocker l{&s.lock};
+    s.retired.push_back(Retired{s.epoch, tree});
+    ++s.epoch;
+    s.reclaim();
+}
+
+void TreeReclaimer::whenUnpinned(QObject *context, std::function<void()> f)
+{
+    ReclaimerState &s = state();
+    {
+        QMutexLocker l{&s.lock};
+        if (!s.pins.empty()) {
+            s.waiters.push_back(Waiter{context, std::move(f)});
+            return;
+        }
+    }
+    f();
+}
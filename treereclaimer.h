@@ -0,0 +1,59 @@
+
+/**
+ * This file is part of dirage2.
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef TREERECLAIMER_H
+#define TREERECLAIMER_H
+
+#include <QtCore>
+#include <functional>
+
+class DirTree;
+
+//! Epoch-based reclamation of trees that background readers may still hold.
+//! A reader pins the current epoch before it takes a tree from the model and keeps the pin
+//! until it stops reading. A replaced tree is retired instead of deleted: it is deleted in the
+//! executor once every pin taken while it was current has been released.
+//! Readers of a retired tree must only read it. In-place changes of the current tree wait
+//! for whenUnpinned() instead, so that the GUI thread does not block on readers.
+class TreeReclaimer
+{
+public:
+    //! Holds the epoch it was taken in. Movable, released when destroyed.
+    class Pin
+    {
+    public:
+        Pin();
+        Pin(Pin &&other);
+        Pin &operator=(Pin &&other);
+        ~Pin();
+        Q_DISABLE_COPY(Pin)
+
+        void release();
+
+    private:
+        friend class TreeReclaimer;
+        explicit Pin(quint64 epoch);
+
+        quint64     m_epoch;
+        bool        m_held;
+    };
+
+    //! Pin the current epoch. Trees in the model now stay alive until the pin is released.
+    static Pin pin();
+
+    //! Take ownership of a tree no longer in the model and advance the epoch.
+    static void retire(DirTree *tree);
+
+    //! Call the function in the thread of the context once no pin is held, right away if none
+    //! is. Readers are pinned in that thread when started, so none runs until it returns.
+    //! Cancel them first, or it waits for them to finish.
+    static void whenUnpinned(QObject *context, std::function<void()> f);
+};
+
+#endif // TREERECLAIMER_H